@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "../src/Compiler.h"
+#include "../src/Pipeline.h"
+#include "../src/ThreadPool.h"
+
+using namespace std;
+using namespace cream;
+
+/**
+ * Times compiling one generated module on the calling thread, then with
+ * its top-level statements parsed and compiled on pools of growing size,
+ * and with its stages pipelined on threads of their own, after checking
+ * each gives the same output. Prints the stats of each pipeline stage.
+ *
+ * Usage: CompilerBench [lines] [runs]
+ */
+
+// Generates a module of `count` top-level lines.
+string generate(int count)
+{
+    string source;
+    for (int i = 0; i < count; i++)
+    {
+        auto n = to_string(i);
+        switch (i % 3)
+        {
+            case 0: source += "int f" + n + "(int a, int b) -> return (a + b) * " + n + " << 1\n"; break;
+            case 1: source += "g" + n + " = (double x, double y) -> return x / (y - " + n + ")\n"; break;
+            case 2: source += "h" + n + " = a < b && 's" + n + "' == c || d\n"; break;
+        }
+    }
+    return source;
+}
+
+// Gets the best time of `runs` calls to `compile`, in milliseconds.
+template <typename Compile>
+double best(int runs, Compile compile)
+{
+    double best = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        auto output = compile();
+        chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+        if (i == 0 || time.count() < best)
+            best = time.count();
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    int lines = argc > 1 ? stoi(argv[1]) : 200000;
+    int runs = argc > 2 ? stoi(argv[2]) : 3;
+
+    auto source = generate(lines);
+    Compiler compiler;
+    auto expected = compiler.compile(source);
+    auto sequential = best(runs, [&] { return compiler.compile(source); });
+    cout << lines << " lines: " << sequential << " ms sequential" << endl;
+
+    size_t cores = max(1u, thread::hardware_concurrency());
+    for (size_t workers = 1; workers <= cores; workers *= 2)
+    {
+        ThreadPool pool(workers);
+        compiler.pool = &pool;
+        if (compiler.compile(source) != expected)
+        {
+            cerr << "Output with " << workers << " workers differs" << endl;
+            return 1;
+        }
+        auto time = best(runs, [&] { return compiler.compile(source); });
+        cout << workers << " workers: " << time << " ms, "
+             << sequential / time << "x, " << pool.steals() << " steals" << endl;
+        compiler.pool = nullptr;
+    }
+
+    Pipeline pipeline(compiler);
+    if (pipeline.compile(source) != expected)
+    {
+        cerr << "Pipelined output differs" << endl;
+        return 1;
+    }
+    auto time = best(runs, [&] { return pipeline.compile(source); });
+    cout << "pipelined: " << time << " ms, " << sequential / time << "x" << endl;
+    pipeline.report(cout);
+    return 0;
+}
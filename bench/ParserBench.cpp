@@ -0,0 +1,103 @@
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../src/Lexer.h"
+#include "../src/Parser.h"
+#include "../src/Traversal.h"
+
+using namespace std;
+using namespace cream;
+
+/**
+ * Times parsing of long operator chains and of deeply nested groups of
+ * growing size, after checking each parses to the expected tree. Parsing
+ * is linear when the time per operator or level stays flat as they grow.
+ * Nested groups are parsed recursively and iteratively.
+ *
+ * Usage: ParserBench [operators] [runs] [depth]
+ */
+
+// Generates one statement chaining `count` operators of mixed precedence.
+string generate(int count)
+{
+    const char* operators[] = { " + ", " * ", " - ", " / ", " << ", " & ", " < ", " | " };
+    string source = "x = a0";
+    for (int i = 0; i < count; i++)
+        source += operators[i % 8] + string("a") + to_string(i + 1);
+    return source + "\n";
+}
+
+// Generates one statement nesting `depth` groups.
+string generateNested(int depth)
+{
+    return "x = " + string(depth, '(') + "a" + string(depth, ')') + "\n";
+}
+
+// Gets the best time of `runs` calls to `parse`, in milliseconds.
+template <typename Parse>
+double best(int runs, Parse parse)
+{
+    double best = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        auto ast = parse();
+        chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+        if (i == 0 || time.count() < best)
+            best = time.count();
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? stoi(argv[1]) : 25000;
+    int runs = argc > 2 ? stoi(argv[2]) : 5;
+    int depth = argc > 3 ? stoi(argv[3]) : 500;
+
+    for (int operators = count; operators <= count * 8; operators *= 2)
+    {
+        auto source = generate(operators);
+        Lexer lexer;
+        auto tokens = lexer.tokenize(source);
+
+        Parser parser;
+        auto ast = parser.parse(tokens);
+        auto binaries = query(&ast.root, [](const Node* node) { return isBinaryOperation(node->kind); });
+        if (binaries.count() != size_t(operators) + 1)
+        {
+            cerr << "Parsed " << binaries.count() << " operations, expected " << operators + 1 << endl;
+            return 1;
+        }
+
+        auto time = best(runs, [&] { return parser.parse(tokens); });
+        cout << operators << " operators: " << time << " ms, "
+             << time * 1e6 / operators << " ns per operator" << endl;
+    }
+
+    for (int levels = depth; levels <= depth * 8; levels *= 2)
+    {
+        auto source = generateNested(levels);
+        Lexer lexer;
+        auto tokens = lexer.tokenize(source);
+
+        Parser parser;
+        auto ast = parser.parse(tokens);
+        auto groups = query(&ast.root, ofKind(NodeKind::ExpressionGroup));
+        if (groups.count() != size_t(levels))
+        {
+            cerr << "Parsed " << groups.count() << " groups, expected " << levels << endl;
+            return 1;
+        }
+
+        auto time = best(runs, [&] { return parser.parse(tokens); });
+        parser.iterative = true;
+        auto iterativeTime = best(runs, [&] { return parser.parse(tokens); });
+        cout << levels << " levels: " << time << " ms, "
+             << time * 1e6 / levels << " ns per level, iterative "
+             << iterativeTime << " ms, " << iterativeTime * 1e6 / levels << " ns per level" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "../src/Lexer.h"
+#include "../src/Rewriter.h"
+#include "../src/Scanner.h"
+#include "../src/TokenStream.h"
+
+using namespace std;
+using namespace cream;
+
+/**
+ * Times the fused rewriter against the rewriter passes on one generated
+ * source, after checking they give the same tokens.
+ *
+ * Usage: RewriterBench [functions] [runs]
+ */
+
+// Generates a source of `count` functions.
+string generate(int count)
+{
+    string source;
+    for (int i = 0; i < count; i++)
+    {
+        auto n = to_string(i);
+        source +=
+            "int f" + n + "(int a, double b) ->\n"
+            "  if a > b\n"
+            "    return a * " + n + "\n"
+            "\n"
+            "  c = (a + b) * (a - b)\n"
+            "  g = (x) -> return x + c\n"
+            "  return g('s" + n + "')\n"
+            "\n";
+    }
+    return source;
+}
+
+// Gets the best time of `runs` calls to `rewrite`, in milliseconds.
+template <typename Rewrite>
+double best(int runs, Rewrite rewrite)
+{
+    double best = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        auto stream = rewrite();
+        chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+        if (i == 0 || time.count() < best)
+            best = time.count();
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? stoi(argv[1]) : 20000;
+    int runs = argc > 2 ? stoi(argv[2]) : 5;
+
+    auto source = generate(count);
+    Lexer lexer;
+    Scanner scanner;
+    scanner.borrow(source);
+    auto scanned = lexer.scanTokens(scanner);
+
+    Rewriter rewriter;
+    auto fused = rewriter.rewrite(scanned);
+    auto passes = rewriter.rewritePasses(scanned);
+    if (fused.types != passes.types || fused.offsets != passes.offsets ||
+        fused.partners != passes.partners || fused.symbols != passes.symbols)
+    {
+        cerr << "Fused rewriter output differs from the passes" << endl;
+        return 1;
+    }
+
+    auto passesTime = best(runs, [&] { return rewriter.rewritePasses(scanned); });
+    auto fusedTime = best(runs, [&] { return rewriter.rewrite(scanned); });
+
+    cout << source.size() << " bytes, " << scanned.size() << " scanned tokens, "
+         << fused.size() << " rewritten tokens" << endl;
+    cout << "passes: " << passesTime << " ms" << endl;
+    cout << "fused:  " << fusedTime << " ms" << endl;
+    cout << "speedup: " << passesTime / fusedTime << "x" << endl;
+    return 0;
+}
@@ -0,0 +1,124 @@
+
+#include <chrono>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <sys/resource.h>
+#include "../src/Compiler.h"
+
+using namespace std;
+using namespace cream;
+
+/**
+ * Streams generated modules of growing size through the compiler, as
+ * they are generated, and prints the peak resident size after each. The
+ * peak stays flat while the modules grow when memory is bounded by the
+ * largest statement. Finally compiles the largest module held whole, for
+ * comparison.
+ *
+ * Usage: StreamBench [lines] [doublings]
+ */
+
+// Gets the line of a module at `index`. Names repeat every 1000 lines,
+// since the symbol table keeps each distinct name for the whole source.
+string line(long index)
+{
+    auto n = to_string(index % 1000);
+    switch (index % 3)
+    {
+        case 0: return "int f" + n + "(int a, int b) -> return (a + b) * " + n + " << 1\n";
+        case 1: return "g" + n + " = (double x, double y) -> return x / (y - " + n + ")\n";
+        default: return "h" + n + " = a < b && 's" + n + "' == c || d\n";
+    }
+}
+
+/**
+ * Generates the lines of a module as they are read, holding one at a time.
+ */
+
+class GeneratedSource : public streambuf
+{
+public:
+    explicit GeneratedSource(long lines)
+        : lines(lines)
+    {}
+
+protected:
+    int_type underflow()
+    {
+        if (next == lines)
+            return traits_type::eof();
+        current = line(next++);
+        setg(&current[0], &current[0], &current[0] + current.size());
+        return traits_type::to_int_type(current[0]);
+    }
+
+private:
+    long lines;
+    long next = 0;
+    string current;
+};
+
+/**
+ * Counts the bytes written to it, holding none.
+ */
+
+class CountingSink : public streambuf
+{
+public:
+    size_t bytes = 0;
+
+protected:
+    streamsize xsputn(const char*, streamsize count)
+    {
+        bytes += count;
+        return count;
+    }
+
+    int_type overflow(int_type c)
+    {
+        bytes++;
+        return c;
+    }
+};
+
+// Gets the peak resident size of the process, in megabytes.
+double peakMegabytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+int main(int argc, char** argv)
+{
+    long lines = argc > 1 ? stol(argv[1]) : 100000;
+    int doublings = argc > 2 ? stoi(argv[2]) : 4;
+
+    Compiler compiler;
+    long largest = lines << (doublings - 1);
+    for (int i = 0; i < doublings; i++)
+    {
+        long count = lines << i;
+        GeneratedSource source(count);
+        CountingSink sink;
+        istream input(&source);
+        ostream output(&sink);
+
+        auto start = chrono::steady_clock::now();
+        compiler.compile(input, output);
+        chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+        cout << count << " lines streamed: " << time.count() << " ms, "
+             << sink.bytes << " bytes out, peak " << peakMegabytes() << " MB" << endl;
+    }
+
+    string whole;
+    for (long i = 0; i < largest; i++)
+        whole += line(i);
+    auto start = chrono::steady_clock::now();
+    auto output = compiler.compile(whole);
+    chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+    cout << largest << " lines whole: " << time.count() << " ms, "
+         << output.size() << " bytes out, peak " << peakMegabytes() << " MB" << endl;
+    return 0;
+}
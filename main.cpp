@@ -1,19 +1,85 @@
 
+#include "src/Arena.h"
 #include "src/Compiler.h"
+#include "src/Diagnostics.h"
+#include "src/Grammar.h"
+#include "src/IncrementalLexer.h"
+#include "src/Interner.h"
 #include "src/Lexer.h"
+#include "src/LineTable.h"
+#include "src/ParallelLexer.h"
+#include "src/PassManager.h"
+#include "src/Pipeline.h"
 #include "src/Scanner.h"
+#include "src/Simd.h"
+#include "src/SpscQueue.h"
+#include "src/ThreadPool.h"
 #include "src/Parser.h"
 #include "src/Token.h"
+#include "src/TokenSource.h"
+#include "src/TokenStream.h"
+#include "src/Traversal.h"
+#include "src/Visitor.h"
 
 using namespace std;
 
-int main()
+// Prints the rewritten tokens of the file named in `args`, one per line,
+// with the rewriter passes chosen by the other arguments.
+int rewriteFile(vector<string> args)
 {
+    cream::Lexer lexer;
+    try
+    {
+        args = lexer.passes().applyOptions(args);
+        if (args.size() != 1)
+        {
+            cerr << "Usage: CreamScript [--passes=a,b] [--enable-pass=a] "
+                    "[--disable-pass=a] [--pass-stats] FILE" << endl;
+            return 2;
+        }
+        for (auto const& token : lexer.tokenizeFile(args[0]))
+            cout << token.toString() << endl;
+    }
+    catch (cream::CreamError& e)
+    {
+        // Reported as the compiler reports errors, trimmed to one line
+        cream::Diagnostics diagnostics;
+        diagnostics.error(e.span, e.what());
+        diagnostics.print(cerr);
+        return 1;
+    }
+    if (lexer.passes().timing)
+        lexer.passes().report(cerr);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        return rewriteFile(vector<string>(argv + 1, argv + argc));
+
     cout << "Running tests" << endl;
+    cream::grammar::testGrammar();
+    cream::interner::testInterner();
     cream::lexer::testLexer();
+    cream::token::testLineTable();
+    cream::token::testPair();
+    cream::rewriter::testPassManager();
     cream::scanner::testScanner();
+    cream::simd::testSimd();
+    cream::util::testThreadPool();
+    cream::util::testSpscQueue();
+    cream::util::testArena();
+    cream::common::testDiagnostics();
+    cream::token::testTokenStream();
+    cream::lexer::testTokenSource();
+    cream::lexer::testParallelLexer();
+    cream::lexer::testIncrementalLexer();
     cream::parser::testParser();
+    cream::parser::testVisitor();
+    cream::parser::testTraversal();
     cream::compiler::testCompiler();
+    cream::compiler::testPipeline();
     cout << "Done!" << endl;
     return 0;
 }
@@ -0,0 +1,211 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cream {
+namespace util {
+
+using namespace std;
+
+/**
+ * A fixed-size array allocated in an Arena.
+ */
+
+template <typename T>
+struct ArenaList
+{
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+    T& operator[](size_t i) const { return items[i]; }
+    T& at(size_t i) const { assert(i < count); return items[i]; }
+};
+
+/**
+ * The Arena class.
+ *
+ * A bump allocator for objects that live and die together. Objects are
+ * placed one after another in large blocks and never freed one by one:
+ * destroying the arena releases every block at once, without running
+ * destructors, so only trivially destructible types may be stored. An
+ * arena can also be reset to build the next batch of objects in its first
+ * block, without going back to the heap.
+ */
+
+class Arena
+{
+public:
+    static constexpr size_t defaultBlockSize = 1 << 16;
+
+    explicit Arena(size_t blockSize=defaultBlockSize)
+        : blockSize(blockSize)
+    {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Constructs a `T` in the arena.
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(is_trivially_destructible<T>::value,
+                      "Arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies `values` into an array in the arena.
+    template <typename T>
+    ArenaList<T> copy(const vector<T> & values)
+    {
+        static_assert(is_trivially_destructible<T>::value,
+                      "Arena objects are never destroyed");
+        ArenaList<T> list;
+        if (values.empty())
+            return list;
+        list.items = (T*) allocate(sizeof(T) * values.size(), alignof(T));
+        list.count = (uint32_t) values.size();
+        uninitialized_copy(values.begin(), values.end(), list.items);
+        return list;
+    }
+
+    // Copies `text` into the arena.
+    string_view save(string_view text)
+    {
+        auto data = (char*) allocate(text.size(), 1);
+        memcpy(data, text.data(), text.size());
+        return string_view(data, text.size());
+    }
+
+    // Reserves `size` bytes aligned to `align`.
+    void* allocate(size_t size, size_t align)
+    {
+        auto offset = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || offset + size > capacity)
+        {
+            capacity = max(blockSize, size + align);
+            if (blocks.empty())
+                firstCapacity = capacity;
+            blocks.emplace_back(new char[capacity]);
+            auto base = (uintptr_t) blocks.back().get();
+            offset = ((base + align - 1) & ~(uintptr_t) (align - 1)) - base;
+        }
+        used = offset + size;
+        bytes += size;
+        return blocks.back().get() + offset;
+    }
+
+    // Frees every object at once, keeping the first block to reuse.
+    void reset()
+    {
+        if (blocks.empty())
+            return;
+        blocks.resize(1);
+        capacity = firstCapacity;
+        used = 0;
+        bytes = 0;
+    }
+
+    // Gets the number of bytes handed out.
+    size_t bytesUsed() const
+    {
+        return bytes;
+    }
+
+    // Gets the number of blocks held.
+    size_t blockCount() const
+    {
+        return blocks.size();
+    }
+
+private:
+    size_t blockSize;
+    size_t capacity = 0;
+    size_t firstCapacity = 0;
+    size_t used = 0;
+    size_t bytes = 0;
+    vector<unique_ptr<char[]>> blocks;
+};
+
+void testArena()
+{
+    cout << "Testing Arena" << endl;
+
+    struct Point
+    {
+        Point(int x, int y) : x(x), y(y) {}
+        int x;
+        int y;
+    };
+
+    {
+        // Test objects are constructed and aligned
+        Arena arena(64);
+        arena.save("abc");
+        auto point = arena.make<Point>(1, 2);
+        assert(point->x == 1 && point->y == 2);
+        assert((uintptr_t) point % alignof(Point) == 0);
+        auto big = arena.make<double>(1.5);
+        assert((uintptr_t) big % alignof(double) == 0);
+        assert(*big == 1.5);
+    }
+
+    {
+        // Test blocks grow to fit, and earlier objects stay put
+        Arena arena(64);
+        vector<Point*> points;
+        for (int i = 0; i < 1000; i++)
+            points.push_back(arena.make<Point>(i, -i));
+        for (int i = 0; i < 1000; i++)
+            assert(points[i]->x == i && points[i]->y == -i);
+        assert(arena.blockCount() > 1);
+        assert(arena.bytesUsed() == 1000 * sizeof(Point));
+
+        vector<int> values(100, 7);
+        auto list = arena.copy(values);
+        assert(list.size() == 100 && list[99] == 7);
+        assert(arena.copy(vector<int>()).empty());
+        assert(arena.save("text") == "text");
+
+        // Test a reset arena builds again in its first block
+        arena.reset();
+        assert(arena.blockCount() == 1);
+        assert(arena.bytesUsed() == 0);
+        auto point = arena.make<Point>(3, 4);
+        assert((void*) point == (void*) points[0]);
+        assert(point->x == 3 && point->y == 4);
+        assert(arena.blockCount() == 1);
+    }
+
+    {
+        // Test resetting an unused arena does nothing
+        Arena arena;
+        arena.reset();
+        assert(arena.blockCount() == 0);
+        assert(arena.make<int>(5) && arena.blockCount() == 1);
+    }
+}
+
+} // end cream::util
+
+using Arena = cream::util::Arena;
+template <typename T>
+using ArenaList = cream::util::ArenaList<T>;
+
+} // end cream
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 
@@ -9,16 +10,33 @@ namespace common {
 
 using namespace std;
 
+/**
+ * A position in a source, counted from line 1 and column 1. A line of 0
+ * marks a problem with no one position, such as the end of the source.
+ */
+
+struct SourceSpan
+{
+    int64_t line = 0;
+    int64_t column = 0;
+};
+
 /**
  * The CreamError class.
+ *
+ * Carries the position of the problem apart from its message, so the
+ * message reads the same wherever it is reported.
  */
 
 class CreamError: public runtime_error
 {
 public:
-    CreamError(const string message="Cream Error")
-        : runtime_error(message.c_str())
+    CreamError(const string message="Cream Error", SourceSpan span={})
+        : runtime_error(message.c_str()), span(span)
     {}
+
+    // Where the problem is, or line 0 when not known
+    SourceSpan span;
 };
 
 /**
@@ -35,6 +53,7 @@ inline void creamAssert(bool condition, string message)
 
 } // end cream::common
 
+using SourceSpan = common::SourceSpan;
 using CreamError = common::CreamError;
 auto creamAssert = common::creamAssert;
 
@@ -0,0 +1,72 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Common.h"
+#include "Diagnostics.h"
+
+namespace cream {
+namespace compiler {
+
+using namespace std;
+
+/**
+ * The CompilationContext struct.
+ *
+ * Holds the state the stages of one compilation share: the indent size of
+ * the source, the positions given to implicit tokens and where errors are
+ * reported. Each compilation starts a new context, so one source never
+ * changes how another is read, and sources compiled on separate threads
+ * share nothing.
+ */
+
+struct CompilationContext
+{
+    // Indent size of the first indented line, or 0 before one is seen
+    int firstIndentSize = 0;
+
+    // Indent size used until an indented line is seen
+    int defaultIndentSize = 2;
+
+    // Last position given to an implicit token
+    int64_t lastImplicitPos = 0;
+
+    // Where errors are reported when recovering from them, or NULL to
+    // throw the first
+    Diagnostics* diagnostics = nullptr;
+
+    // Gets the indent size of one level.
+    int indentSize() const
+    {
+        return firstIndentSize ? firstIndentSize : defaultIndentSize;
+    }
+
+    // Records the indent of a line, keeping the first one seen.
+    void noteIndent(size_t size)
+    {
+        if (firstIndentSize == 0)
+            firstIndentSize = (int) size;
+    }
+
+    // Gets the next position for implicit tokens.
+    int64_t implicitPosition()
+    {
+        return --lastImplicitPos;
+    }
+
+    // Reports an error to recover from, or throws it when not recovering.
+    void error(SourceSpan span, const string & message)
+    {
+        if (!diagnostics)
+            throw CreamError(message, span);
+        diagnostics->error(span, message);
+    }
+};
+
+} // end cream::compiler
+
+using CompilationContext = cream::compiler::CompilationContext;
+
+} // end cream
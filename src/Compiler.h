@@ -1,10 +1,20 @@
 
 #pragma once
 
+#include <future>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "CompilationContext.h"
+#include "Diagnostics.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "ThreadPool.h"
+#include "Visitor.h"
 
 namespace cream {
 namespace compiler {
@@ -16,21 +26,36 @@ class Backend
 public:
     Backend() {}
     virtual ~Backend() {}
-    virtual string compile(AST ast) {}
+    virtual string compile(const AST & ast) = 0;
+
+    // Makes a new backend of the same kind, to compile on another thread.
+    virtual unique_ptr<Backend> clone() const = 0;
 };
 
-class CppBackend : Backend
+class CppBackend : Backend, public Visitor<CppBackend, string>
 {
 public:
     CppBackend() {}
     virtual ~CppBackend() {}
 
-    string compile(AST ast)
+    string compile(const AST & ast)
     {
+        symbols = ast.symbols;
         string output = compileStatements(ast.root.statements);
         return output;
     }
 
+    unique_ptr<Backend> clone() const
+    {
+        return unique_ptr<Backend>(new CppBackend);
+    }
+
+    // Gets the name of a symbol.
+    string name(SymbolId symbol)
+    {
+        return string(symbols->name(symbol));
+    }
+
     string compileBlock(Block* block)
     {
         string output;
@@ -41,7 +66,7 @@ public:
         return output;
     }
 
-    string compileStatements(vector<Statement> statements)
+    string compileStatements(ArenaList<Statement> statements)
     {
         string output;
         int len = statements.size();
@@ -59,6 +84,8 @@ public:
     string compileStatement(Statement statement)
     {
         string output;
+        if (!statement.outer)
+            return output;
         output += compileExpression(statement.outer);
         output += compileStatementTerminator(statement);
         return output;
@@ -67,7 +94,7 @@ public:
     string compileStatementTerminator(Statement statement)
     {
         string output;
-        if (statement.outer->type == "Function Definition")
+        if (statement.outer->kind == NodeKind::FunctionDefinition)
             output = "";
         else
             output = ";";
@@ -75,58 +102,71 @@ public:
     }
 
     string compileExpression(Expression* expression)
+    {
+        return visit(expression);
+    }
+
+    string visitFunctionDefinition(FunctionDefinition* definition)
+    {
+        return compileFunctionDefinition(definition);
+    }
+
+    string visitAssignment(Assignment* assignment)
     {
         string output;
-        if (expression->type == "Function Definition")
-        {
-            output += compileFunctionDefinition((FunctionDefinition*) expression);
-        }
-        else if (expression->type == "Assignment")
-        {
-            output += compileExpression(expression->left);
-            output += " = ";
-            output += compileExpression(expression->right);
-        }
-        else if (expression->type == "Lambda")
-        {
-            output += compileLambda((Lambda*) expression);
-        }
-        else if (expression->type == "Return")
-        {
-            output += compileReturn((Return*) expression);
-        }
-        else if (expression->left && expression->right)
-        {
-            auto binOp = dynamic_cast<BinaryOperation*>(expression);
-            output += compileBinaryOperation(binOp);
-        }
-        else if (expression->type == "Identifier")
-        {
-            output += expression->value;
-        }
-        else if (expression->type == "Number")
-        {
-            output += expression->value;
-        }
-        else if (expression->type == "String")
-        {
-            output += compileString((String*) expression);
-        }
+        output += compileExpression(assignment->left);
+        output += " = ";
+        output += compileExpression(assignment->right);
         return output;
     }
 
+    string visitLambda(Lambda* lambda)
+    {
+        return compileLambda(lambda);
+    }
+
+    string visitReturn(Return* returnExpr)
+    {
+        return compileReturn(returnExpr);
+    }
+
+    string visitBinaryOperation(BinaryOperation* binOp)
+    {
+        return compileBinaryOperation(binOp);
+    }
+
+    string visitExpressionGroup(ExpressionGroup* group)
+    {
+        return compileExpressionGroup(group);
+    }
+
+    string visitIdentifier(Identifier* identifier)
+    {
+        return string(identifier->value);
+    }
+
+    string visitNumber(Number* number)
+    {
+        return string(number->value);
+    }
+
+    string visitString(String* s)
+    {
+        return compileString(s);
+    }
+
     string compileFunctionDefinition(FunctionDefinition* definition)
     {
         string output;
-        output += compileFunction((Function*) definition->function);
+        output += compileFunction(definition->function);
         return output;
     }
 
     string compileFunction(Function* function)
     {
         string output;
-        output += function->returnType + " ";
-        output += function->functionName;
+        output += name(function->returnType) + " ";
+        output += name(function->functionName);
         output += compileLambdaParams(function->lambda) + " ";
         output += compileLambdaBlock(function->lambda);
         return output;
@@ -154,8 +194,8 @@ public:
         {
             auto param = *iter;
             auto next = iter; next++;
-            output += param.paramType + " ";
-            output += param.paramName;
+            output += name(param.paramType) + " ";
+            output += name(param.paramName);
             if (next != params.end())
                 output += ", ";
         }
@@ -177,15 +217,20 @@ public:
     {
         string output;
         output += compileExpression(binOp->left) + " ";
-        output += compileOperator(&binOp->token) + " ";
+        output += compileOperator(binOp) + " ";
         output += compileExpression(binOp->right);
         return output;
     }
 
-    string compileOperator(Token* opToken)
+    string compileExpressionGroup(ExpressionGroup* group)
+    {
+        return "(" + compileExpression(group->inner) + ")";
+    }
+
+    string compileOperator(Operation* operation)
     {
         string output;
-        output += opToken->value;
+        output += operation->value;
         return output;
     }
 
@@ -196,7 +241,7 @@ public:
         return output;
     }
 
-    string encodeString(string s)
+    string encodeString(string_view s)
     {
         string output;
         for (auto iter = s.begin(); iter != s.end(); iter++)
@@ -213,11 +258,22 @@ public:
         }
         return output;
     }
+
+    shared_ptr<const Interner> symbols;
  };
 
 class Compiler
 {
 public:
+    static constexpr size_t defaultChunkSize = 1 << 14;
+
+    // Pool to parse and compile top-level statements on in parallel, or
+    // NULL to compile on the calling thread. Output is the same either way.
+    ThreadPool* pool = nullptr;
+
+    // Number of tokens of whole statements to give each parallel task
+    size_t chunkSize = defaultChunkSize;
+
     Compiler()
     {
         this->lexer = new Lexer;
@@ -232,17 +288,254 @@ public:
         delete backend;
     }
 
-    string compile(string source)
+    // Compiles a borrowed source in a new context.
+    string compile(SourceText source)
     {
-        auto tokens = lexer->tokenize(source);
-        auto ast = parser->parse(tokens);
-        auto output = backend->compile(ast);
-        return output;
+        return compile(source, nullptr);
+    }
+
+    // Compiles a source as above, recovering from errors to report all of
+    // them to `diagnostics` in one run, up to its limit. Gives no output
+    // when an error is found.
+    string compile(SourceText source, Diagnostics & diagnostics)
+    {
+        try
+        {
+            return compile(source, &diagnostics);
+        }
+        catch (TooManyErrors& e)
+        {
+            return "";
+        }
+    }
+
+    // Compiles a source read from `input` as it is read, writing the
+    // output of each top-level statement to `output` before reading on.
+    // The tokens, tree and text of a statement are freed once it is
+    // written, so memory is bounded by the largest statement and the
+    // distinct names, not by the size of the source. Throws the first
+    // error, after writing the statements before it.
+    void compile(istream & input, ostream & output)
+    {
+        compile(input, output, nullptr);
+    }
+
+    // Compiles a stream as above, recovering from errors to report all of
+    // them to `diagnostics` in one run, up to its limit. Writes nothing
+    // from the first error on. Returns whether no error was found.
+    bool compile(istream & input, ostream & output, Diagnostics & diagnostics)
+    {
+        try
+        {
+            compile(input, output, &diagnostics);
+        }
+        catch (TooManyErrors& e)
+        {
+        }
+        return !diagnostics.hasErrors();
     }
 
     Lexer* lexer;
     Parser* parser;
     Backend* backend;
+
+private:
+    /**
+     * Points the lexer and parser at where one compilation reports its
+     * errors, until it ends, so neither keeps the caller's Diagnostics
+     * once it may be gone.
+     */
+
+    struct Reporting
+    {
+        Reporting(Compiler & compiler, Diagnostics* diagnostics)
+            : compiler(compiler)
+        {
+            compiler.lexer->context->diagnostics = diagnostics;
+            compiler.parser->diagnostics = diagnostics;
+        }
+
+        ~Reporting()
+        {
+            compiler.lexer->context->diagnostics = nullptr;
+            compiler.parser->diagnostics = nullptr;
+        }
+
+        Compiler & compiler;
+    };
+
+    void compile(istream & input, ostream & output, Diagnostics* diagnostics)
+    {
+        lexer->resetSymbols();
+        lexer->resetContext();
+        Reporting reporting(*this, diagnostics);
+        TokenSource source(*lexer, input);
+
+        vector<Token> tokens;
+        vector<size_t> ends(1);
+        AST ast;
+        ast.symbols = source.symbols();
+        size_t written = 0;
+        while (source.nextStatement(tokens))
+        {
+            ends[0] = tokens.size();
+            parser->parse(tokens, ends, ast);
+            if ((!diagnostics || !diagnostics->hasErrors()) && ast.root.statements.size())
+            {
+                // Join statements as one tree's would be
+                if (written++)
+                    output << "\n";
+                output << backend->compile(ast);
+            }
+
+            // Free the statement before reading on, keeping the first
+            // block of the arena for the next
+            ast.reset();
+            tokens.clear();
+            source.release();
+        }
+    }
+
+    string compile(SourceText source, Diagnostics* diagnostics)
+    {
+        lexer->resetSymbols();
+        lexer->resetContext();
+        Reporting reporting(*this, diagnostics);
+        TokenSource tokens(*lexer, source);
+        if (pool)
+            return compileInParallel(tokens, diagnostics);
+        auto ast = parser->parse(tokens);
+        if (diagnostics && diagnostics->hasErrors())
+            return "";
+        auto output = backend->compile(ast);
+        return output;
+    }
+
+    /**
+     * Whole top-level statements to parse in one task, with where each
+     * statement's tokens end.
+     */
+
+    struct Chunk
+    {
+        vector<Token> tokens;
+        vector<size_t> ends;
+    };
+
+    /**
+     * The tree of a chunk, and what its parser reported.
+     */
+
+    struct ParsedChunk
+    {
+        AST ast;
+        vector<Diagnostic> diagnostics;
+    };
+
+    // Parses chunks of statements in tasks as they are pulled from
+    // `tokens`, so lexing overlaps parsing. Once the source is pulled and
+    // its symbols are final, compiles each tree in a task, and joins the
+    // outputs in source order. Errors of the lexer are reported as they
+    // are found, before those of the parser.
+    string compileInParallel(TokenSource & tokens, Diagnostics* diagnostics)
+    {
+        bool recovering = diagnostics != nullptr;
+        vector<future<ParsedChunk>> parsed;
+        Chunk chunk;
+        try
+        {
+            while (tokens.nextStatement(chunk.tokens))
+            {
+                chunk.ends.push_back(chunk.tokens.size());
+                if (chunk.tokens.size() >= chunkSize)
+                    parsed.push_back(parseChunk(chunk, tokens.symbols(), recovering));
+            }
+            if (!chunk.ends.empty())
+                parsed.push_back(parseChunk(chunk, tokens.symbols(), recovering));
+        }
+        catch (CreamError& e)
+        {
+            // Statements before the error fail first when parsed in order
+            chunk.tokens.resize(chunk.ends.empty() ? 0 : chunk.ends.back());
+            if (!chunk.ends.empty())
+                parsed.push_back(parseChunk(chunk, tokens.symbols(), false));
+            waitAll(parsed);
+            for (auto& result : parsed)
+                result.get();
+            throw;
+        }
+        catch (...)
+        {
+            waitAll(parsed);
+            throw;
+        }
+
+        vector<future<string>> outputs;
+        try
+        {
+            for (auto& result : parsed)
+            {
+                auto chunk = result.get();
+                for (auto const& diagnostic : chunk.diagnostics)
+                    diagnostics->report(diagnostic);
+                if (recovering && diagnostics->hasErrors())
+                    continue;
+                outputs.push_back(pool->submit([ast = std::move(chunk.ast), backend = backend->clone()]() mutable
+                {
+                    return backend->compile(ast);
+                }));
+            }
+        }
+        catch (...)
+        {
+            waitAll(parsed);
+            waitAll(outputs);
+            throw;
+        }
+        if (recovering && diagnostics->hasErrors())
+        {
+            waitAll(outputs);
+            return "";
+        }
+
+        string output;
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            if (i)
+                output += "\n";
+            output += outputs[i].get();
+        }
+        return output;
+    }
+
+    // Queues a task parsing `chunk`, which is left empty.
+    future<ParsedChunk> parseChunk(Chunk & chunk, shared_ptr<const Interner> symbols, bool recovering)
+    {
+        auto task = [chunk = std::move(chunk), symbols, recovering, iterative = parser->iterative]() mutable
+        {
+            Parser parser;
+            parser.iterative = iterative;
+            Diagnostics diagnostics(0);
+            if (recovering)
+                parser.diagnostics = &diagnostics;
+            ParsedChunk parsed { parser.parse(chunk.tokens, chunk.ends), diagnostics.list() };
+            parsed.ast.symbols = symbols;
+            return parsed;
+        };
+        chunk = Chunk();
+        return pool->submit(std::move(task));
+    }
+
+    // Waits for the tasks of `results` not yet taken.
+    template <typename Result>
+    static void waitAll(vector<future<Result>> & results)
+    {
+        for (auto& result : results)
+        {
+            if (result.valid())
+                result.wait();
+        }
+    }
 };
 
 void testCompiler()
@@ -302,6 +595,27 @@ void testCompiler()
         assert(output == expected);
     }
 
+    {
+        // Test operator precedence compilation
+        auto source = "a = b + c * d << 1";
+        auto expected = "a = b + c * d << 1;";
+        auto output = compiler.compile(source);
+        assert(output == expected);
+    }
+
+    {
+        // Test grouped expressions keep their parentheses
+        const char* sources[][2] =
+        {
+            { "x = (a + b) * c", "x = (a + b) * c;" },
+            { "x = a - (b - c)", "x = a - (b - c);" },
+            { "x = ((a))", "x = ((a));" },
+            { "int f(int a) -> return a * (a + 1)", "int f(int a) { return a * (a + 1); }" },
+        };
+        for (auto source : sources)
+            assert(compiler.compile(source[0]) == source[1]);
+    }
+
     {
         // Test lambda param
         auto source = "(double a) -> return a * a";
@@ -335,6 +649,108 @@ void testCompiler()
         assert(output == expected);
     }
 
+    {
+        // Test return on the last line of a block
+        auto source = "int main() ->\n"
+                      "  return 42";
+        auto expected = "int main() { return 42; }";
+        auto output = compiler.compile(source);
+        assert(output == expected);
+    }
+
+    {
+        // Test the indent size of one source doesn't carry to the next
+        auto wide = "int f() ->\n"
+                    "    return 1";
+        auto narrow = "int g() ->\n"
+                      "  return 2";
+        assert(compiler.compile(wide) == "int f() { return 1; }");
+        assert(compiler.compile(narrow) == "int g() { return 2; }");
+        assert(compiler.compile(wide) == "int f() { return 1; }");
+    }
+
+    {
+        // Test compiling many sources at once matches one at a time
+        vector<string> sources;
+        for (int i = 0; i < 64; i++)
+        {
+            auto n = to_string(i);
+            string indent(2 + 2 * (i % 3), ' ');
+            sources.push_back(
+                "int f" + n + "(int a) ->\n" +
+                indent + "return a * " + n + "\n"
+            );
+        }
+        vector<string> expected;
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            auto n = to_string(i);
+            expected.push_back(Compiler().compile(sources[i]));
+            assert(expected[i] == "int f" + n + "(int a) { return a * " + n + "; }");
+        }
+
+        ThreadPool pool(8);
+        for (int round = 0; round < 4; round++)
+        {
+            vector<future<string>> outputs;
+            for (size_t i = 0; i < sources.size(); i++)
+            {
+                auto& source = sources[(i * 7 + round) % sources.size()];
+                outputs.push_back(pool.submit([&source]
+                {
+                    Compiler compiler;
+                    return compiler.compile(source);
+                }));
+            }
+            for (size_t i = 0; i < outputs.size(); i++)
+                assert(outputs[i].get() == expected[(i * 7 + round) % sources.size()]);
+        }
+    }
+
+
+    {
+        // Test compiling in parallel gives the same output and errors
+        string module;
+        for (int i = 0; i < 200; i++)
+        {
+            auto n = to_string(i);
+            module += "int f" + n + "(int a, int b) -> return a * " + n + " + b << 1\n"
+                      "g" + n + " = (double x) -> return (x / " + n + ")\n"
+                      "h" + n + " = 'h' == i && j\n";
+        }
+        const char* broken = "a = 1\nb = 2 *\nc = )\nd = 'e\n";
+
+        Compiler sequential;
+        auto expected = sequential.compile(module);
+        string expectedError;
+        try { sequential.compile(broken); }
+        catch (CreamError& e) { expectedError = e.what(); }
+        Diagnostics expectedDiagnostics;
+        sequential.compile(broken, expectedDiagnostics);
+
+        ThreadPool pool(4);
+        for (size_t chunkSize : { (size_t) 1, (size_t) 50, Compiler::defaultChunkSize })
+        {
+            for (bool iterative : { false, true })
+            {
+                Compiler parallel;
+                parallel.pool = &pool;
+                parallel.chunkSize = chunkSize;
+                parallel.parser->iterative = iterative;
+                assert(parallel.compile(module) == expected);
+                assert(parallel.compile("") == "");
+
+                string error;
+                try { parallel.compile(broken); }
+                catch (CreamError& e) { error = e.what(); }
+                assert(error == expectedError);
+
+                Diagnostics diagnostics;
+                assert(parallel.compile(broken, diagnostics) == "");
+                assert(diagnostics.errorCount() == expectedDiagnostics.errorCount());
+            }
+        }
+    }
     /*
     {
         // Test lambda assignment
@@ -432,6 +848,103 @@ void testCompiler()
         assert(output == expected);
     }
     */
+
+    {
+        // Test errors of every stage are reported in one run
+        auto source = "g = () ->\n"
+                      "  h = 1\n"
+                      "b = )\n"
+                      "c = 2 *\n"
+                      "d = 3 ,\n"
+                      "      e = 5\n"
+                      "f = 'g\n";
+        Diagnostics diagnostics;
+        auto output = compiler.compile(source, diagnostics);
+        assert(output.empty());
+        assert(diagnostics.errorCount() == 4);
+        vector<int64_t> lines;
+        vector<int64_t> columns;
+        for (auto const& diagnostic : diagnostics.list())
+        {
+            lines.push_back(diagnostic.span.line);
+            columns.push_back(diagnostic.span.column);
+        }
+
+        // Test each is reported at the offending token, not its statement
+        assert((lines == vector<int64_t> { 3, 4, 5, 6, 7 }));
+        assert((columns == vector<int64_t> { 5, 7, 7, 1, 5 }));
+        assert(diagnostics.list()[0].message == "Extra closing parenthesis found");
+        assert(diagnostics.list()[1].toString() == "4:7: error: Expect an expression after '*'");
+        assert(diagnostics.list()[2].severity == Severity::Warning);
+
+        // Test a return without an expression is reported, not compiled
+        Diagnostics missing;
+        assert(compiler.compile("int main() ->\n  return\n", missing).empty());
+        assert(missing.errorCount() == 1);
+        assert(missing.list()[0].message == "Expect an expression after 'return'");
+
+        // Test the lexer and parser let go of the diagnostics after
+        assert(!compiler.lexer->context->diagnostics);
+        assert(!compiler.parser->diagnostics);
+
+        // Test compiling again starts over
+        Diagnostics clean;
+        assert(compiler.compile("a = 1", clean) == "a = 1;");
+        assert(clean.list().empty());
+        assert(compiler.compile("a = 1") == "a = 1;");
+    }
+
+    {
+        // Test compiling a stream writes the output of compiling it whole
+        const char* sources[] =
+        {
+            "",
+            "a = 1\nb = 2",
+            "int main() ->\n  a = 'b\nc'\n  return a\n",
+            "f = (double a, double b) -> return a\nc = 'd'\n",
+            "x = () -> y = () -> 1\n",
+        };
+        for (auto source : sources)
+        {
+            istringstream input(source);
+            ostringstream output;
+            compiler.compile(input, output);
+            assert(output.str() == compiler.compile(source));
+        }
+
+        // Test the statements before an error are written, and nothing
+        // after the first error when recovering
+        auto broken = "a = 1\nb = 2 *\nc = 3\nd = )\n";
+        istringstream input(broken);
+        ostringstream output;
+        string error;
+        try { compiler.compile(input, output); }
+        catch (CreamError& e) { error = e.what(); }
+        assert(output.str() == "a = 1;");
+        assert(error == "Expect an expression after '*'");
+
+        Diagnostics expected, diagnostics;
+        compiler.compile(broken, expected);
+        istringstream recovering(broken);
+        ostringstream partial;
+        assert(!compiler.compile(recovering, partial, diagnostics));
+        assert(partial.str() == "a = 1;");
+        assert(!compiler.lexer->context->diagnostics);
+        assert(!compiler.parser->diagnostics);
+        assert(diagnostics.errorCount() == expected.errorCount());
+    }
+
+    {
+        // Test compiling stops at the limit of errors
+        string source;
+        for (int i = 0; i < 100; i++)
+            source += "a" + to_string(i) + " = \n";
+        Diagnostics diagnostics(10);
+        auto output = compiler.compile(source, diagnostics);
+        assert(output.empty());
+        assert(diagnostics.errorCount() == 10);
+        assert(diagnostics.list().back().severity == Severity::Note);
+    }
 }
 
 } // end cream::compiler
@@ -0,0 +1,227 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Common.h"
+
+namespace cream {
+namespace common {
+
+using namespace std;
+
+/**
+ * How serious a diagnostic is. Only errors stop a compilation producing
+ * output.
+ */
+
+enum class Severity : uint8_t
+{
+    Note,
+    Warning,
+    Error,
+};
+
+// Gets the name of `severity` as printed.
+const char* severityName(Severity severity)
+{
+    switch (severity)
+    {
+        case Severity::Note: return "note";
+        case Severity::Warning: return "warning";
+        case Severity::Error: return "error";
+    }
+    return "error";
+}
+
+/**
+ * One problem found in a source.
+ */
+
+struct Diagnostic
+{
+    Severity severity;
+    SourceSpan span;
+    string message;
+
+    // Formats as `line:column: severity: message`.
+    string toString() const
+    {
+        string output;
+        if (span.line)
+            output += to_string(span.line) + ":" + to_string(span.column) + ": ";
+        output += severityName(severity);
+        output += ": " + message;
+        return output;
+    }
+};
+
+/**
+ * Thrown when a compilation reaches its limit of errors. Not a
+ * CreamError, so stages recovering from errors let it through.
+ */
+
+class TooManyErrors : public runtime_error
+{
+public:
+    TooManyErrors()
+        : runtime_error("Too many errors")
+    {}
+};
+
+/**
+ * The Diagnostics class.
+ *
+ * Collects the problems of one compilation, so stages can recover from an
+ * error and report the next instead of stopping at the first. Once
+ * `maxErrors` errors are reported a note is added and TooManyErrors is
+ * thrown, ending the compilation with what was found so far. A limit of
+ * 0 means no limit.
+ */
+
+class Diagnostics
+{
+public:
+    static constexpr size_t defaultMaxErrors = 20;
+
+    explicit Diagnostics(size_t maxErrors=defaultMaxErrors)
+        : maxErrors(maxErrors)
+    {}
+
+    // Reports an error, stopping at the limit of errors.
+    void error(SourceSpan span, string message)
+    {
+        add({ Severity::Error, span, trim(message) });
+        errors++;
+        if (maxErrors && errors >= maxErrors)
+        {
+            add({ Severity::Note, {}, "Stopped after " + to_string(errors) + " errors" });
+            throw TooManyErrors();
+        }
+    }
+
+    // Reports a warning.
+    void warning(SourceSpan span, string message)
+    {
+        add({ Severity::Warning, span, trim(message) });
+    }
+
+    // Reports a diagnostic collected elsewhere, such as on another thread.
+    void report(const Diagnostic & diagnostic)
+    {
+        if (diagnostic.severity == Severity::Error)
+            error(diagnostic.span, diagnostic.message);
+        else
+            add(diagnostic);
+    }
+
+    // Takes the diagnostics reported so far, starting over empty.
+    vector<Diagnostic> take()
+    {
+        auto taken = std::move(diagnostics);
+        diagnostics.clear();
+        errors = 0;
+        return taken;
+    }
+
+    // Gets the diagnostics in the order reported.
+    const vector<Diagnostic>& list() const
+    {
+        return diagnostics;
+    }
+
+    // Gets the number of errors reported.
+    size_t errorCount() const
+    {
+        return errors;
+    }
+
+    // Checks whether any error was reported.
+    bool hasErrors() const
+    {
+        return errors > 0;
+    }
+
+    // Prints each diagnostic on its own line.
+    void print(ostream & out) const
+    {
+        for (auto const& diagnostic : diagnostics)
+            out << diagnostic.toString() << endl;
+    }
+
+    size_t maxErrors;
+
+private:
+    void add(Diagnostic diagnostic)
+    {
+        diagnostics.push_back(std::move(diagnostic));
+    }
+
+    // Drops the newline ending the messages of thrown errors.
+    static string trim(string message)
+    {
+        while (!message.empty() && message.back() == '\n')
+            message.pop_back();
+        return message;
+    }
+
+    vector<Diagnostic> diagnostics;
+    size_t errors = 0;
+};
+
+void testDiagnostics()
+{
+    cout << "Testing Diagnostics" << endl;
+
+    {
+        // Test diagnostics are kept in order and formatted
+        Diagnostics diagnostics;
+        diagnostics.warning({ 1, 3 }, "Skipping unknown token during parse: '$'");
+        diagnostics.error({ 2, 1 }, "Unexpected indent\n");
+        assert(diagnostics.list().size() == 2);
+        assert(diagnostics.errorCount() == 1);
+        assert(diagnostics.list()[0].severity == Severity::Warning);
+        assert(diagnostics.list()[1].toString() == "2:1: error: Unexpected indent");
+        assert((Diagnostic { Severity::Error, {}, "a" }).toString() == "error: a");
+
+        // Test diagnostics taken from one set report the same to another
+        Diagnostics other;
+        for (auto const& diagnostic : diagnostics.take())
+            other.report(diagnostic);
+        assert(diagnostics.list().empty() && !diagnostics.hasErrors());
+        assert(other.errorCount() == 1 && other.list().size() == 2);
+    }
+
+    {
+        // Test the limit of errors, which warnings do not count toward
+        Diagnostics diagnostics(3);
+        bool thrown = false;
+        try
+        {
+            for (int i = 0; i < 10; i++)
+            {
+                diagnostics.warning({}, "w");
+                diagnostics.error({ i + 1, 1 }, "e");
+            }
+        }
+        catch (TooManyErrors& e) { thrown = true; }
+        assert(thrown);
+        assert(diagnostics.errorCount() == 3);
+        assert(diagnostics.list().size() == 7);
+        assert(diagnostics.list().back().severity == Severity::Note);
+    }
+}
+
+} // end cream::common
+
+using Severity = common::Severity;
+using Diagnostic = common::Diagnostic;
+using Diagnostics = common::Diagnostics;
+using TooManyErrors = common::TooManyErrors;
+
+} // end cream
@@ -0,0 +1,350 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include "Grammar.h"
+#include "Interner.h"
+#include "LineTable.h"
+#include "Token.h"
+#include "TokenStream.h"
+
+namespace cream {
+namespace rewriter {
+
+using namespace std;
+
+/**
+ * The FusedRewriter class.
+ *
+ * Does the work of every Rewriter pass in one forward pass over a scanned
+ * TokenStream, appending to the columns of the output stream. Tokens are
+ * pulled through a window of a few tokens:
+ *
+ * - Empty lines and whitespace are dropped, and indentation changes become
+ *   blocks, as the raw tokens are read.
+ * - Keywords and types are rewritten with one token of lookbehind.
+ * - An implicit return group or lambda block opens where it starts. Its
+ *   end is counted as pending, and written before the next newline or
+ *   block end, returns first.
+ * - Params are written before an arrow, or converted from the group just
+ *   written; pairs are linked as tokens are appended.
+ *
+ * The output matches the pass-based Rewriter token for token. Malformed
+ * indentation or pairs are not reported here: `rewrite` returns false,
+ * and the caller runs the passes to report the error as they would.
+ */
+
+class FusedRewriter
+{
+public:
+    // Rewrites `input` into `output`. Returns false on an error.
+    bool rewrite(const TokenStream & input, TokenStream & output)
+    {
+        in = &input;
+        out = &output;
+        out->source = input.source;
+        out->base = input.base;
+        out->owner = input.owner;
+        out->lines = input.lines;
+        out->interner = input.interner;
+        out->reserve(input.size() + input.size() / 4);
+
+        reset();
+        Item item;
+        while (next(item))
+        {
+            if (failed)
+                return false;
+
+            if (isLineEnd(item.type))
+            {
+                closePending();
+                append(item);
+                lastIdentifier = none;
+            }
+            else if (item.type == token::KEYWORD && item.symbol == interner::SYMBOL_RETURN)
+            {
+                append(item);
+                lastIdentifier = none;
+
+                // Open an implicit group, unless one is written
+                auto following = peek();
+                if (!following || following->type != token::EXPRESSION_START)
+                {
+                    appendImplicit(token::EXPRESSION_START);
+                    pendingGroups++;
+                }
+            }
+            else if (item.type == token::ARROW)
+            {
+                rewriteArrow(item);
+                lastIdentifier = none;
+            }
+            else
+            {
+                if (item.type == token::EXPRESSION_START)
+                {
+                    groups.push_back(out->size());
+                }
+                else if (item.type == token::EXPRESSION_END)
+                {
+                    if (groups.empty())
+                        return false;
+                    lastGroupStart = groups.back();
+                    groups.pop_back();
+                }
+
+                // Rewrite identifiers followed by an identifier to a type
+                if (item.type == token::IDENTIFIER && lastIdentifier != none)
+                    out->types[lastIdentifier] = token::TYPE;
+                lastIdentifier = item.type == token::IDENTIFIER ? out->size() : none;
+                append(item);
+            }
+        }
+        if (failed)
+            return false;
+        closePending();
+        return true;
+    }
+
+private:
+    static constexpr size_t none = SIZE_MAX;
+
+    /**
+     * A token of the window: a scanned token or an implicit one.
+     */
+
+    struct Item
+    {
+        int type;
+        uint32_t offset = TokenStream::implicit;
+        uint32_t length = 0;
+        interner::SymbolId symbol = interner::noSymbol;
+    };
+
+    // Clears the state of the last rewrite.
+    void reset()
+    {
+        position = 0;
+        line = 0;
+        prevLine = -1;
+        depth = 0;
+        finished = false;
+        failed = false;
+        window.clear();
+        parens.clear();
+        blocks.clear();
+        groups.clear();
+        lastGroupStart = none;
+        lastIdentifier = none;
+        pendingGroups = 0;
+        pendingBlocks = 0;
+    }
+
+    // Rewrites an arrow and the params before it, and opens its block
+    // unless an indented one follows.
+    void rewriteArrow(const Item & arrow)
+    {
+        auto last = out->size();
+        if (last == 0 || out->types[last - 1] != token::EXPRESSION_END)
+        {
+            appendImplicit(token::PARAMS_START);
+            appendImplicit(token::PARAMS_END);
+        }
+        else
+        {
+            out->types[lastGroupStart] = token::PARAMS_START;
+            out->types[last - 1] = token::PARAMS_END;
+        }
+        append(arrow);
+
+        // Join the next line, unless an end is pending before the newline
+        if (!pendingGroups && !pendingBlocks)
+        {
+            Item newline;
+            while (peek() && peek()->type == token::NEWLINE)
+                next(newline);
+        }
+
+        auto following = peek();
+        if (pendingGroups || pendingBlocks || !following || following->type != token::BLOCK_START)
+        {
+            appendImplicit(token::BLOCK_START);
+            pendingBlocks++;
+        }
+    }
+
+    // Writes the pending ends of return groups, then lambda blocks.
+    void closePending()
+    {
+        for (; pendingGroups; pendingGroups--)
+            appendImplicit(token::EXPRESSION_END);
+        for (; pendingBlocks; pendingBlocks--)
+            appendImplicit(token::BLOCK_END);
+    }
+
+    // Checks whether `type` ends a line for returns and lambdas.
+    static bool isLineEnd(int type)
+    {
+        return type == token::NEWLINE || type == token::BLOCK_END;
+    }
+
+    // Appends an implicit token.
+    void appendImplicit(int type)
+    {
+        Item item;
+        item.type = type;
+        append(item);
+    }
+
+    // Appends a token, linking it to its partner.
+    void append(const Item & item)
+    {
+        uint32_t i = out->size();
+        out->push(item.type, item.offset, item.length, item.symbol);
+        switch (item.type)
+        {
+            case token::EXPRESSION_START:
+            case token::PARAMS_START:
+                parens.push_back(i);
+                break;
+            case token::BLOCK_START:
+                blocks.push_back(i);
+                break;
+            case token::EXPRESSION_END:
+            case token::PARAMS_END:
+                link(parens, i);
+                break;
+            case token::BLOCK_END:
+                link(blocks, i);
+                break;
+        }
+    }
+
+    // Pairs token `i` with the innermost open start.
+    void link(vector<uint32_t> & starts, uint32_t i)
+    {
+        if (starts.empty())
+            return;
+        out->partners[i] = starts.back();
+        out->partners[starts.back()] = i;
+        starts.pop_back();
+    }
+
+    // Gets the next token of the window without taking it, or NULL.
+    const Item* peek()
+    {
+        if (window.empty() && !fill())
+            return nullptr;
+        return &window.front();
+    }
+
+    // Takes the next token of the window, or returns false at the end.
+    bool next(Item & item)
+    {
+        if (window.empty() && !fill())
+            return false;
+        item = window.front();
+        window.pop_front();
+        return true;
+    }
+
+    // Reads scanned tokens until one or more are added to the window:
+    // the blocks opened or closed by its indentation, then the token.
+    bool fill()
+    {
+        auto const& lines = *in->lines;
+        while (position < in->size())
+        {
+            auto i = position++;
+            auto type = in->types[i];
+            auto offset = in->offsets[i];
+            while (line + 1 < lines.size() && lines.start(line + 1) <= offset)
+                line++;
+
+            // Remove empty lines
+            if (type == token::NEWLINE && lines.isEmpty(line))
+                continue;
+
+            // Add indents and outdents as blocks
+            if (offset == lines.start(line) && line != 0 && prevLine >= 0)
+            {
+                int shift = lines.indentLevel(line) - lines.indentLevel(prevLine);
+                if (shift > 1)
+                    failed = true;
+                if (shift == 1)
+                {
+                    window.push_back({ token::BLOCK_START });
+                    depth++;
+                }
+                for (int j = 0; j > shift; j--)
+                {
+                    if (depth == 0)
+                        failed = true;
+                    window.push_back({ token::BLOCK_END });
+                    depth--;
+                }
+            }
+            prevLine = line;
+
+            // Remove whitespace
+            if (type == token::WHITESPACE)
+            {
+                if (!window.empty())
+                    return true;
+                continue;
+            }
+
+            // Rewrite keywords
+            auto symbol = in->symbols[i];
+            if (type == token::IDENTIFIER)
+            {
+                auto word = grammar::keywordFor(symbol);
+                if (word && word->type == token::KEYWORD)
+                    type = token::KEYWORD;
+            }
+            window.push_back({ type, offset, in->lengths[i], symbol });
+            return true;
+        }
+
+        // Close any blocks on last line
+        if (!finished)
+        {
+            finished = true;
+            for (; depth > 0; depth--)
+                window.push_back({ token::BLOCK_END });
+        }
+        return !window.empty();
+    }
+
+    const TokenStream* in = nullptr;
+    TokenStream* out = nullptr;
+
+    // Reading state
+    size_t position = 0;
+    size_t line = 0;
+    int64_t prevLine = -1;
+    int depth = 0;
+    bool finished = false;
+    bool failed = false;
+    deque<Item> window;
+
+    // Writing state
+    vector<uint32_t> parens;
+    vector<uint32_t> blocks;
+    vector<size_t> groups;
+    size_t lastGroupStart = none;
+    size_t lastIdentifier = none;
+    int pendingGroups = 0;
+    int pendingBlocks = 0;
+};
+
+} // end cream::rewriter
+
+using FusedRewriter = cream::rewriter::FusedRewriter;
+
+} // end cream
@@ -0,0 +1,216 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+#include "Interner.h"
+#include "Symbol.h"
+#include "Token.h"
+
+namespace cream {
+namespace grammar {
+
+using namespace std;
+using namespace cream::token;
+
+/**
+ * A fixed spelling of a token, either an operator or a keyword.
+ */
+
+struct Spelling
+{
+    const char* text;
+    TokenType type;
+    const char* name;
+};
+
+/**
+ * The operator and keyword spec.
+ *
+ * Operators are matched by the lexer DFA, longest spelling first. Keywords
+ * are matched against whole identifiers: word operators such as `and` are
+ * rewritten by the lexer, and reserved words by `Rewriter::rewriteKeywords`.
+ */
+
+constexpr Spelling spellings[] =
+{
+    // Operators
+    { "\n", NEWLINE,          "Newline"          },
+    { "=",  ASSIGN,           "Assign"           },
+    { "==", COMPARE_EQ,       "Compare Eq"       },
+    { "->", ARROW,            "Arrow"            },
+    { "(",  EXPRESSION_START, "Expression Start" },
+    { ")",  EXPRESSION_END,   "Expression End"   },
+    { ",",  COMMA,            "Comma"            },
+    { "+",  OP_ADD,           "Add"              },
+    { "++", OP_INCREMENT,     "Increment"        },
+    { "-",  OP_SUBTRACT,      "Subtract"         },
+    { "--", OP_DECREMENT,     "Decrement"        },
+    { "*",  OP_MULTIPLY,      "Multiply"         },
+    { "/",  OP_DIVIDE,        "Divide"           },
+    { "&",  BITWISE_AND,      "Bitwise And"      },
+    { "|",  BITWISE_OR,       "Bitwise Or"       },
+    { "<<", BITWISE_LEFT,     "Bitwise Left"     },
+    { ">>", BITWISE_RIGHT,    "Bitwise Right"    },
+    { "<",  COMPARE_LT,       "Compare LT"       },
+    { ">",  COMPARE_GT,       "Compare GT"       },
+    { "<=", COMPARE_LTE,      "Compare LTE"      },
+    { ">=", COMPARE_GTE,      "Compare GTE"      },
+    { "&&", LOGICAL_AND,      "And"              },
+    { "||", LOGICAL_OR,       "Or"               },
+
+    // Keywords
+    { "and",    LOGICAL_AND,  "And"              },
+    { "or",     LOGICAL_OR,   "Or"               },
+    { "return", KEYWORD,      "Return"           },
+};
+
+constexpr int spellingCount = sizeof(spellings) / sizeof(spellings[0]);
+
+/**
+ * A DFA over every spelling in the spec, built at compile time.
+ *
+ * State 0 is the start state, and a transition to 0 means no match.
+ * `accept[state]` holds the index of the spelling ending there, plus one.
+ */
+
+struct Dfa
+{
+    static constexpr int maxStates = 64;
+
+    uint8_t next[maxStates][256];
+    uint8_t accept[maxStates];
+    int states;
+
+    // Gets the spelling accepted in `state`, or NULL.
+    constexpr const Spelling* accepted(int state) const
+    {
+        return accept[state] ? &spellings[accept[state] - 1] : nullptr;
+    }
+};
+
+constexpr Dfa makeDfa()
+{
+    Dfa dfa {};
+    dfa.states = 1;
+    for (int i = 0; i < spellingCount; i++)
+    {
+        int state = 0;
+        for (const char* c = spellings[i].text; *c; c++)
+        {
+            auto& target = dfa.next[state][(uint8_t) *c];
+            if (!target)
+                target = (uint8_t) dfa.states++;
+            state = target;
+        }
+        dfa.accept[state] = (uint8_t) (i + 1);
+    }
+    return dfa;
+}
+
+constexpr Dfa dfa = makeDfa();
+
+static_assert(dfa.states <= Dfa::maxStates, "Too many DFA states for the spec");
+
+/**
+ * Gets the spelling matching all of `word`, or NULL.
+ */
+
+constexpr const Spelling* spelling(string_view word)
+{
+    int state = 0;
+    for (char c : word)
+    {
+        state = dfa.next[state][(uint8_t) c];
+        if (!state)
+            return nullptr;
+    }
+    return dfa.accepted(state);
+}
+
+/**
+ * Gets the keyword spelling matching all of `word`, or NULL.
+ */
+
+constexpr const Spelling* keyword(string_view word)
+{
+    auto match = spelling(word);
+    bool isWord = !word.empty() && symbol::characters.type(word[0]) == symbol::ALPHA;
+    return isWord ? match : nullptr;
+}
+
+static_assert(keyword("return")->type == KEYWORD, "Missing return keyword");
+static_assert(keyword("returns") == nullptr, "Keywords match whole words");
+
+/**
+ * Keyword spellings, indexed by their common symbol ID.
+ */
+
+struct KeywordTable
+{
+    const Spelling* spellings[interner::KEYWORD_SYMBOLS];
+};
+
+constexpr KeywordTable makeKeywordTable()
+{
+    KeywordTable table {};
+    for (interner::SymbolId i = 0; i < interner::KEYWORD_SYMBOLS; i++)
+        table.spellings[i] = keyword(interner::commonNames[i]);
+    return table;
+}
+
+constexpr KeywordTable keywords = makeKeywordTable();
+
+constexpr int countKeywords()
+{
+    int count = 0;
+    for (auto& s : spellings)
+        count += keyword(s.text) == &s;
+    return count;
+}
+
+static_assert(countKeywords() == interner::KEYWORD_SYMBOLS,
+              "Every keyword needs a common symbol");
+
+/**
+ * Gets the keyword spelling of a symbol, or NULL.
+ */
+
+constexpr const Spelling* keywordFor(interner::SymbolId symbol)
+{
+    return symbol < interner::KEYWORD_SYMBOLS ? keywords.spellings[symbol] : nullptr;
+}
+
+static_assert(keywordFor(interner::SYMBOL_RETURN)->type == KEYWORD, "Misordered keyword symbols");
+static_assert(keywordFor(interner::SYMBOL_AND)->type == LOGICAL_AND, "Misordered keyword symbols");
+static_assert(keywordFor(interner::SYMBOL_OR)->type == LOGICAL_OR, "Misordered keyword symbols");
+
+void testGrammar()
+{
+    cout << "Testing Grammar" << endl;
+
+    // Every spelling is accepted by the DFA
+    for (auto& s : spellings)
+    {
+        assert(spelling(s.text) == &s);
+    }
+
+    // Prefixes and unknown words are rejected
+    assert(spelling("") == nullptr);
+    assert(spelling("-") != nullptr);
+    assert(spelling("<<=") == nullptr);
+    assert(keyword("an") == nullptr);
+    assert(keyword("and")->type == LOGICAL_AND);
+    assert(keyword("->") == nullptr);
+
+    // Keyword symbols map to their spellings
+    for (interner::SymbolId i = 0; i < interner::KEYWORD_SYMBOLS; i++)
+        assert(keywordFor(i)->text == string_view(interner::commonNames[i]));
+    assert(keywordFor(interner::KEYWORD_SYMBOLS) == nullptr);
+    assert(keywordFor(interner::noSymbol) == nullptr);
+}
+
+} // end cream::grammar
+} // end cream
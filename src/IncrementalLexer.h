@@ -0,0 +1,403 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Common.h"
+#include "Lexer.h"
+#include "LineTable.h"
+#include "ParallelLexer.h"
+#include "Symbol.h"
+#include "Token.h"
+#include "TokenStream.h"
+
+namespace cream {
+namespace lexer {
+
+using namespace std;
+
+/**
+ * A change to a source: `removed` bytes at `offset` replaced by `inserted`.
+ */
+
+struct TextEdit
+{
+    size_t offset;
+    size_t removed;
+    string inserted;
+};
+
+/**
+ * The IncrementalLexer class.
+ *
+ * Keeps a source and its TokenStream up to date through edits, re-lexing
+ * only the top-level statements an edit touches. Statements are split at
+ * cuts: tokens starting a top-level line outside every pair, where the
+ * rewriter needs nothing from the text before. An edit re-lexes the text
+ * between the cuts around it, so an indentation change is re-lexed with
+ * its whole enclosing block.
+ *
+ * The new tokens are checked to end the region as the whole source would,
+ * with every pair closed and the blocks of the last line closed, the same
+ * check used between parallel chunks. Then they are spliced into the
+ * stream: later offsets, partners and line starts are shifted, not
+ * re-scanned. When the check fails or the region does not lex, the whole
+ * source is lexed again, reporting any error as `Lexer::lex` would.
+ *
+ * Token views of the stream are invalidated by each edit.
+ */
+
+class IncrementalLexer
+{
+public:
+    // Keeps streams lexed with the symbols of `lexer`.
+    IncrementalLexer(Lexer & lexer)
+        : lexer(lexer)
+    {}
+
+    // Lexes all of `source`, keeping a copy to edit.
+    const TokenStream & lex(string source)
+    {
+        text = make_shared<string>(std::move(source));
+        relexAll();
+        return tokens;
+    }
+
+    // Applies `edits`, sorted and not overlapping, with offsets into the
+    // current source, and re-lexes the regions they touch.
+    const TokenStream & edit(const vector<TextEdit> & edits)
+    {
+        relexedBytes = 0;
+        for (auto edit = edits.rbegin(); edit != edits.rend(); edit++)
+        {
+            if (edit->offset + edit->removed > text->size())
+            {
+                throw CreamError(
+                    "Edit past the end of the source at "
+                    "offset " + to_string(edit->offset) + "\n"
+                );
+            }
+            if (!valid)
+                text->replace(edit->offset, edit->removed, edit->inserted);
+            else if (!relexEdit(*edit))
+                valid = false;
+        }
+        if (!valid)
+            relexAll();
+        return tokens;
+    }
+
+    // Gets the current tokens.
+    const TokenStream & stream() const
+    {
+        return tokens;
+    }
+
+    // Gets the current source.
+    string_view source() const
+    {
+        return *text;
+    }
+
+    // Number of bytes lexed by the last edit.
+    size_t relexedBytes = 0;
+
+private:
+    /**
+     * A cut before token `index`, at `offset` in the source.
+     */
+
+    struct Cut
+    {
+        uint32_t offset;
+        uint32_t index;
+    };
+
+    // Lexes the whole source, finding its cuts.
+    void relexAll()
+    {
+        valid = false;
+        relexedBytes += text->size();
+        tokens = lexer.lex(*text);
+        tokens.owner = text;
+        lines = make_shared<LineTable>(*text, lexer.context);
+        tokens.lines = lines;
+
+        cuts.assign(1, { 0, 0 });
+        findCuts(tokens, { 0, 0 }, cuts);
+        valid = true;
+    }
+
+    // Applies `edit` and re-lexes the region around it. Returns false when
+    // the region can't be spliced.
+    bool relexEdit(const TextEdit & edit)
+    {
+        auto oldEnd = (uint32_t) (edit.offset + edit.removed);
+        auto delta = (int64_t) edit.inserted.size() - (int64_t) edit.removed;
+
+        // Find the cuts around the edit
+        auto before = lower_bound(cuts.begin(), cuts.end(), edit.offset,
+            [](const Cut & cut, size_t offset) { return cut.offset < offset; });
+        if (before != cuts.begin())
+            before--;
+        auto after = upper_bound(cuts.begin(), cuts.end(), oldEnd,
+            [](uint32_t offset, const Cut & cut) { return offset < cut.offset; });
+
+        Cut start = *before;
+        Cut end = { (uint32_t) text->size(), (uint32_t) tokens.size() };
+        bool last = after == cuts.end();
+        if (!last)
+            end = *after;
+
+        // Lex the edited region alone
+        text->replace(edit.offset, edit.removed, edit.inserted);
+        if (text->size() >= TokenStream::implicit)
+            return false;
+        auto newEnd = (uint32_t) (end.offset + delta);
+        auto regionText = string_view(*text).substr(start.offset, newEnd - start.offset);
+        relexedBytes += regionText.size();
+
+        TokenStream region;
+        try
+        {
+            Lexer regionLexer{string(regionText), lexer.context};
+            regionLexer.symbols = lexer.symbols;
+            region = regionLexer.lex();
+        }
+        catch (CreamError& e)
+        {
+            return false;
+        }
+        if (!last && region.size() && !ParallelLexer::closesBlocks(region, 0, *region.lines))
+            return false;
+        for (size_t i = 0; i < region.size(); i++)
+        {
+            if (isPairType(region.types[i]) && region.partners[i] == TokenStream::unpaired)
+                return false;
+        }
+
+        // Shift the tokens after the region
+        auto tokenDelta = (int64_t) region.size() - (end.index - start.index);
+        for (size_t i = end.index; i < tokens.size(); i++)
+        {
+            if (!tokens.isImplicit(i))
+                tokens.offsets[i] += delta;
+            if (tokens.partners[i] != TokenStream::unpaired)
+                tokens.partners[i] += tokenDelta;
+        }
+
+        // Move the region tokens into place
+        vector<Cut> regionCuts;
+        findCuts(region, start, regionCuts);
+        for (size_t i = 0; i < region.size(); i++)
+        {
+            if (!region.isImplicit(i))
+                region.offsets[i] += start.offset;
+            if (region.partners[i] != TokenStream::unpaired)
+                region.partners[i] += start.index;
+        }
+        splice(tokens.types, start.index, end.index, region.types);
+        splice(tokens.offsets, start.index, end.index, region.offsets);
+        splice(tokens.lengths, start.index, end.index, region.lengths);
+        splice(tokens.partners, start.index, end.index, region.partners);
+        splice(tokens.symbols, start.index, end.index, region.symbols);
+
+        // Replace the cuts inside the region
+        for (auto cut = after; cut != cuts.end(); cut++)
+        {
+            cut->offset += delta;
+            cut->index += tokenDelta;
+        }
+        auto first = cuts.erase(before + 1, after);
+        cuts.insert(first, regionCuts.begin(), regionCuts.end());
+
+        tokens.source = *text;
+        lines->splice(*text, start.offset, end.offset, newEnd);
+        return true;
+    }
+
+    // Replaces `column[first, last)` with `values`.
+    template <typename T>
+    static void splice(vector<T> & column, size_t first, size_t last, const vector<T> & values)
+    {
+        column.erase(column.begin() + first, column.begin() + last);
+        column.insert(column.begin() + first, values.begin(), values.end());
+    }
+
+    // Checks whether tokens of `type` are always paired.
+    static bool isPairType(int type)
+    {
+        switch (type)
+        {
+            case token::EXPRESSION_START:
+            case token::EXPRESSION_END:
+            case token::PARAMS_START:
+            case token::PARAMS_END:
+            case token::BLOCK_START:
+            case token::BLOCK_END:
+                return true;
+        }
+        return false;
+    }
+
+    // Appends the cuts of `stream` after its first token, moved by `base`.
+    // A cut is a letter starting a line outside every pair, after a newline
+    // and the blocks it closes.
+    static void findCuts(const TokenStream & stream, Cut base, vector<Cut> & cuts)
+    {
+        int depth = 0;
+        for (size_t i = 0; i < stream.size(); i++)
+        {
+            if (depth == 0 && i > 0 && isCut(stream, i))
+                cuts.push_back({ (uint32_t) (base.offset + stream.offsets[i]), (uint32_t) (base.index + i) });
+
+            switch (stream.types[i])
+            {
+                case token::EXPRESSION_START:
+                case token::PARAMS_START:
+                case token::BLOCK_START:
+                    depth++;
+                    break;
+                case token::EXPRESSION_END:
+                case token::PARAMS_END:
+                case token::BLOCK_END:
+                    depth--;
+                    break;
+            }
+        }
+    }
+
+    // Checks whether token `i` starts a top-level line.
+    static bool isCut(const TokenStream & stream, size_t i)
+    {
+        if (stream.isImplicit(i))
+            return false;
+        auto offset = stream.offsets[i];
+        if (offset == 0 || stream.source[offset - 1] != '\n')
+            return false;
+        if (symbol::characters.type(stream.source[offset]) != symbol::ALPHA)
+            return false;
+
+        auto prev = i - 1;
+        while (prev > 0 && stream.types[prev] == token::BLOCK_END)
+            prev--;
+        return stream.types[prev] == token::NEWLINE && !stream.isImplicit(prev);
+    }
+
+    Lexer & lexer;
+    shared_ptr<string> text = make_shared<string>();
+    shared_ptr<LineTable> lines;
+    TokenStream tokens;
+    vector<Cut> cuts;
+    bool valid = false;
+};
+
+// Checks that `stream` matches a fresh lex of its source, by name.
+void assertSameTokens(const TokenStream & stream, const TokenStream & expected)
+{
+    assert(stream.size() == expected.size());
+    assert(stream.types == expected.types);
+    assert(stream.offsets == expected.offsets);
+    assert(stream.lengths == expected.lengths);
+    assert(stream.partners == expected.partners);
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        auto token = stream.at(i);
+        auto other = expected.at(i);
+        assert(token.toString() == other.toString());
+        assert(token.meta.line == other.meta.line);
+        assert(token.meta.column == other.meta.column);
+        assert(token.meta.position == other.meta.position);
+        assert(token.partner == other.partner);
+        if (stream.symbols[i] != interner::noSymbol)
+            assert(stream.interner->name(stream.symbols[i]) == expected.interner->name(expected.symbols[i]));
+    }
+}
+
+void testIncrementalLexer()
+{
+    cout << "Testing IncrementalLexer" << endl;
+
+    string source;
+    for (int i = 0; i < 100; i++)
+    {
+        auto n = to_string(i);
+        source +=
+            "int f" + n + "(int a) ->\n"
+            "  if a\n"
+            "    return a * " + n + "\n"
+            "  b = (a +\n"
+            "c)\n"
+            "\n"
+            "g" + n + " = () -> return 1\n";
+    }
+    Lexer lexer;
+    IncrementalLexer incremental(lexer);
+    incremental.lex(source);
+
+    // Applies `edits` to both, checking the stream matches a full lex
+    auto check = [&](vector<TextEdit> edits, bool local)
+    {
+        auto& stream = incremental.edit(edits);
+        for (auto edit = edits.rbegin(); edit != edits.rend(); edit++)
+            source.replace(edit->offset, edit->removed, edit->inserted);
+        assert(incremental.source() == source);
+        if (local)
+            assert(incremental.relexedBytes < 400);
+
+        Lexer fresh;
+        assertSameTokens(stream, fresh.lex(source));
+    };
+
+    // Rename a variable
+    auto middle = source.find("int f50");
+    check({ { middle + 30, 1, "xyz" } }, true);
+
+    // Insert a top-level line
+    check({ { middle, 0, "h = 1\n" } }, true);
+
+    // Outdent a line out of a block
+    check({ { source.find("  b = (a", middle), 2, "" } }, true);
+
+    // Apply two edits at once
+    check({ { 10, 1, "q" }, { middle + 40, 0, " + 2" } }, true);
+
+    // Open a parenthesis, left unclosed until the next edit
+    check({ { middle, 0, "k = (\n" } }, false);
+    check({ { middle, 6, "" } }, false);
+
+    // Indent a top-level line under the one before
+    check({ { source.find("g50"), 0, "  " } }, true);
+
+    // Delete a whole statement
+    auto f70 = source.find("int f70");
+    check({ { f70, source.find("g70") - f70, "" } }, true);
+
+    // Edit both ends
+    check({ { 0, 3, "double" }, { source.size() - 2, 1, "2" } }, true);
+
+    {
+        // Test errors are reported as by a full lex, and cleared by an edit
+        auto bad = source.find("g30");
+        bool thrown = false;
+        try { incremental.edit({ { bad, 0, "'" } }); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
+        incremental.edit({ { bad, 1, "" } });
+        Lexer fresh;
+        assertSameTokens(incremental.stream(), fresh.lex(source));
+    }
+}
+
+} // end cream::lexer
+
+using IncrementalLexer = cream::lexer::IncrementalLexer;
+using TextEdit = cream::lexer::TextEdit;
+
+} // end cream
@@ -0,0 +1,185 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace cream {
+namespace interner {
+
+using namespace std;
+
+typedef uint32_t SymbolId;
+
+constexpr SymbolId noSymbol = UINT32_MAX;
+
+/**
+ * Symbols with fixed IDs in the common table.
+ *
+ * Keywords come first, in the order of the grammar spec, so a keyword
+ * check is an integer comparison.
+ */
+
+enum CommonSymbol : SymbolId
+{
+    SYMBOL_AND,
+    SYMBOL_OR,
+    SYMBOL_RETURN,
+    KEYWORD_SYMBOLS
+};
+
+constexpr const char* commonNames[] =
+{
+    // Keywords
+    "and", "or", "return",
+
+    // Types
+    "int", "double", "float", "char", "bool", "void", "auto",
+    "long", "short", "unsigned", "size_t", "string", "vector", "map",
+
+    // Names
+    "true", "false", "if", "else", "for", "while",
+    "std", "cout", "cin", "cerr", "endl", "main"
+};
+
+constexpr SymbolId commonCount = sizeof(commonNames) / sizeof(commonNames[0]);
+
+/**
+ * The Interner class.
+ *
+ * Assigns each distinct name a 32-bit symbol ID and stores it once. A table
+ * can be chained to a read-only parent, whose IDs it shares: the common
+ * table is built once per process and frozen, so compilations running on
+ * many threads can share it, each adding its own names to a private table.
+ * Names stay at a stable address for the life of their table.
+ */
+
+class Interner
+{
+public:
+    // Constructs a table chained to the common names.
+    Interner()
+        : Interner(&common())
+    {}
+
+    // Constructs a table chained to `parent`, which must not change.
+    explicit Interner(const Interner* parent)
+        : parent(parent),
+          first(parent ? parent->end() : 0)
+    {}
+
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    // Gets the ID of `name`, adding it if new.
+    SymbolId intern(string_view name)
+    {
+        auto id = find(name);
+        if (id != noSymbol)
+            return id;
+
+        id = end();
+        names.emplace_back(name);
+        ids.emplace(names.back(), id);
+        return id;
+    }
+
+    // Gets the ID of `name`, or noSymbol.
+    SymbolId find(string_view name) const
+    {
+        if (parent)
+        {
+            auto id = parent->find(name);
+            if (id != noSymbol)
+                return id;
+        }
+        auto found = ids.find(name);
+        return found != ids.end() ? found->second : noSymbol;
+    }
+
+    // Gets the name of symbol `id`.
+    string_view name(SymbolId id) const
+    {
+        if (id < first)
+            return parent->name(id);
+        return names.at(id - first);
+    }
+
+    // Gets the ID after the last symbol in this table.
+    SymbolId end() const
+    {
+        return first + (SymbolId) names.size();
+    }
+
+    // Gets the shared table of common names.
+    static const Interner& common()
+    {
+        static const Interner table(commonNames, commonCount);
+        return table;
+    }
+
+private:
+    // Constructs a root table holding `names`.
+    Interner(const char* const* names, SymbolId count)
+        : Interner(nullptr)
+    {
+        for (SymbolId i = 0; i < count; i++)
+            intern(names[i]);
+    }
+
+    const Interner* parent;
+    SymbolId first;
+    deque<string> names;
+    unordered_map<string_view, SymbolId> ids;
+};
+
+void testInterner()
+{
+    cout << "Testing Interner" << endl;
+
+    {
+        // Test common symbols
+        auto& common = Interner::common();
+        assert(common.find("return") == SYMBOL_RETURN);
+        assert(common.find("and") == SYMBOL_AND);
+        assert(common.name(SYMBOL_OR) == "or");
+        assert(common.end() == commonCount);
+        assert(common.find("foo") == noSymbol);
+    }
+
+    {
+        // Test chained tables
+        Interner a;
+        Interner b;
+        auto foo = a.intern("foo");
+        assert(foo == commonCount);
+        assert(a.intern("foo") == foo);
+        assert(a.intern("int") == Interner::common().find("int"));
+        assert(b.find("foo") == noSymbol);
+        assert(b.intern("bar") == foo);
+        assert(a.name(foo) == "foo");
+        assert(b.name(foo) == "bar");
+    }
+
+    {
+        // Test names are stored once, at stable addresses
+        Interner table;
+        auto first = table.name(table.intern("x0")).data();
+        for (int i = 1; i < 1000; i++)
+            table.intern("x" + to_string(i));
+        assert(table.name(table.find("x0")).data() == first);
+        assert(table.end() == commonCount + 1000);
+    }
+}
+
+} // end cream::interner
+
+using Interner = cream::interner::Interner;
+using SymbolId = cream::interner::SymbolId;
+
+} // end cream
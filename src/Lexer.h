@@ -3,26 +3,40 @@
 
 #include <cassert>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "CompilationContext.h"
+#include "Common.h"
+#include "Grammar.h"
+#include "Interner.h"
+#include "LineTable.h"
 #include "Rewriter.h"
 #include "Scanner.h"
+#include "Simd.h"
+#include "Symbol.h"
 #include "Token.h"
+#include "TokenStream.h"
 
 namespace cream {
 namespace lexer {
 
 using namespace std;
+using symbol::characters;
 
 class Lexer
 {
 public:
-    // Constructs a new Lexer instance.
-    Lexer(string source="")
+    // Constructs a new Lexer instance, starting a new context unless one
+    // is given.
+    Lexer(string source="", shared_ptr<CompilationContext> context=nullptr)
     {
         scanner = new Scanner();
-        scanner->load(source);
+        scanner->load(std::move(source));
         rewriter = new Rewriter();
+        resetSymbols();
+        resetContext(context);
     }
 
     // Destroys the Lexer.
@@ -32,30 +46,98 @@ public:
         delete rewriter;
     }
 
+    // Starts a new symbol table, chained to the common names.
+    void resetSymbols()
+    {
+        symbols = make_shared<Interner>();
+    }
+
+    // Starts a new compilation with `context`, or a new context.
+    void resetContext(shared_ptr<CompilationContext> context=nullptr)
+    {
+        this->context = context ? context : make_shared<CompilationContext>();
+        rewriter->context = this->context;
+    }
+
     // Converts the current source string to Tokens.
     vector<Token> tokenize()
     {
-        return tokenize(scanner->source);
+        return lex().tokens();
     }
 
     // Converts the source string into a series of Token objects.
-    vector<Token> tokenize(string source)
+    // The source is borrowed, and must stay alive.
+    vector<Token> tokenize(SourceText source)
+    {
+        scanner->borrow(source);
+        return tokenize();
+    }
+
+    // Maps the file at `path` and converts it to Tokens without copying.
+    vector<Token> tokenizeFile(const string& path)
+    {
+        scanner->map(path);
+        return tokenize();
+    }
+
+    // Converts the current source string to a TokenStream.
+    TokenStream lex()
+    {
+        return rewrite(scanTokens(*scanner));
+    }
+
+    // Converts a borrowed source to a TokenStream.
+    TokenStream lex(SourceText source)
+    {
+        scanner->borrow(source);
+        return lex();
+    }
+
+    // Maps the file at `path` and converts it to a TokenStream.
+    TokenStream lexFile(const string& path)
+    {
+        scanner->map(path);
+        return lex();
+    }
+
+    // Converts a stream to a TokenStream, reading it through a window of
+    // `windowSize` bytes. The TokenStream owns a copy of the text.
+    TokenStream lexStream(int fd, size_t windowSize=1 << 16)
+    {
+        StreamScanner stream(fd, windowSize);
+        return rewrite(scanTokens(stream));
+    }
+
+    // Rewrites a TokenStream to simplify parsing.
+    TokenStream rewrite(const TokenStream & stream)
+    {
+        return rewriter->rewrite(stream);
+    }
+
+    // Scans a borrowed source for Token objects.
+    vector<Token> scan(SourceText source)
     {
-        auto tokens = scan(source);
-        tokens = rewrite(tokens);
-        return tokens;
+        scanner->borrow(source);
+        return scan();
     }
 
-    // Rewrites tokens to simplify parsing.
-    vector<Token> rewrite(vector<Token> tokens)
+    // Scans the current source for Token objects.
+    vector<Token> scan()
     {
-        return rewriter->rewrite(tokens);
+        return scanTokens(*scanner).tokens();
     }
 
-    // Scans source for Token objects.
-    vector<Token> scan(string source)
+    // Scans source into a TokenStream using any scanner type.
+    template <typename ScannerType>
+    TokenStream scanTokens(ScannerType & scanner)
     {
-        vector<Token> tokens;
+        TokenStream stream;
+        stream.interner = symbols;
+
+        // Text copied from scanners with unstable slices
+        shared_ptr<string> copy;
+        if constexpr (!ScannerType::stable)
+            copy = make_shared<string>();
 
         // Token metadata
         token::Metadata meta;
@@ -63,319 +145,174 @@ public:
         meta.column = 1;
         meta.position = 1;
 
-        // Line pointers
-        auto currentLine = make_shared<Line>();
-        auto sourceLines = make_shared<vector<Line*>>();
-        sourceLines->push_back(&*currentLine);
-
         // Scanner setup
-        scanner->source = source;
-        scanner->position = -1;
-        while (scanner->remaining() > 0)
+        scanner.position = 0;
+        while (!scanner.atEnd(scanner.position))
         {
-            Token token;
-            string value;
-            char c = scanner->next();
-
-            // Tokenize Characters
-            if (isalpha(c))
+            // Match the next lexeme and slice its text
+            auto lexeme = match(scanner, meta);
+            auto text = scanner.slice(lexeme.start, lexeme.start + lexeme.length);
+            auto end = lexeme.start + lexeme.length;
+            if (end >= TokenStream::implicit)
             {
-                handle_identifier:
-
-                value += scanner->peek();
-                char next = scanner->peek(1);
-                if (isalnum(next) || next == '_')
-                {
-                    scanner->seek(1);
-                    goto handle_identifier;
-                }
-                else
-                {
-                    token = { token::IDENTIFIER, "Identifier", value };
-                }
-            }
-            else if (isdigit(c))
-            {
-                handle_number:
-
-                value += scanner->peek();
-                char next = scanner->peek(1);
-                if (isdigit(next) || next == '.')
-                {
-                    scanner->seek(1);
-                    goto handle_number;
-                }
-                else
-                {
-                    token = { token::NUMBER, "Number", value };
-                }
+                throw CreamError("Source too large for a token stream\n",
+                                 { meta.line, meta.column });
             }
-            else if (c == '"' || c == '\'')
-            {
-                char delimiter = scanner->peek();
-                char escape = '\\';
+            if (copy)
+                copy->append(text);
 
-                handle_string:
-                char next = scanner->peek(1);
-                if (next == delimiter)
-                {
-                    scanner->seek(1);
-                    goto finalize_string;
-                }
-                else if (next == escape)
-                {
-                    value += scanner->seek(2);
-                    goto handle_string;
-                }
-                else
-                {
-                    value += scanner->seek(1);
-                    goto handle_string;
-                }
-
-                finalize_string:
-                token = { token::STRING, "String", value };
-            }
-            else if (isblank(c))
-            {
-                handle_whitespace:
+            if (lexeme.type == token::WHITESPACE && meta.column == 1)
+                context->noteIndent(text.size());
 
-                value += scanner->peek();
-                char next = scanner->peek(1);
-                if (isblank(next))
-                {
-                    scanner->seek(1);
-                    goto handle_whitespace;
-                }
-                else
-                {
-                    if (meta.column == 1)
-                    {
-                        auto indent = value;
-                        if (Line::firstIndentSize == 0)
-                            Line::firstIndentSize = indent.size();
-                        currentLine->indent = indent;
-                    }
-                    token = { token::WHITESPACE, "Whitespace", value };
-                }
-            }
-            else if (c == '\n')
-            {
-                handle_newline:
-
-                value += scanner->peek();
-                char next = scanner->peek(1);
-                token = { token::NEWLINE, "Newline", value };
-            }
-            else if (c == '=')
-            {
-                handle_equal:
-
-                value += scanner->peek();
-                char next = scanner->peek(1);
-                if (next == '=')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::COMPARE_EQ, "Compare Eq", value };
-                }
-                else
-                {
-                    token = { token::ASSIGN, "Assign", value };
-                }
-            }
-            else if (c == '+')
-            {
-                handle_plus:
+            // Add the token
+            if (lexeme.type)
+                stream.push(lexeme.type, (uint32_t) lexeme.start, (uint32_t) lexeme.length, lexeme.symbol);
 
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '+')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::OP_INCREMENT, "Increment", value };
-                }
-                else
-                {
-                    token = { token::OP_ADD, "Add", value };
-                }
-            }
-            else if (c == '-')
-            {
-                handle_minus:
+            // Update position
+            meta.position += lexeme.length;
+            scanner.to(end);
 
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '-')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::OP_DECREMENT, "Decrement", value };
-                }
-                else if (next == '>')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::ARROW, "Arrow", value };
-                }
-                else
-                {
-                    token = { token::OP_SUBTRACT, "Subtract", value };
-                }
-            }
-            else if (c == '*')
+            // Update line and column
+            if (lexeme.type == token::NEWLINE)
             {
-                value += c;
-                token = { token::OP_MULTIPLY, "Multiply", value };
+                meta.column = 1;
+                meta.line += 1;
             }
-            else if (c == '/')
+            else
             {
-                value += c;
-                token = { token::OP_DIVIDE, "Divide", value };
+                meta.column += lexeme.length;
             }
-            else if (c == '&')
-            {
-                handle_ampersand:
+        }
 
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '&')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::LOGICAL_AND, "And", value };
-                }
-                else
-                {
-                    token = { token::BITWISE_AND, "Bitwise And", value };
-                }
-            }
-            else if (c == '|')
-            {
-                handle_pipe:
+        if constexpr (ScannerType::stable)
+        {
+            stream.source = scanner.source;
+            stream.owner = scanner.owner();
+        }
+        else
+        {
+            stream.source = *copy;
+            stream.owner = copy;
+        }
+        stream.lines = make_shared<LineTable>(stream.source, context);
+        return stream;
+    }
 
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '|')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::LOGICAL_OR, "Or", value };
-                }
-                else
-                {
-                    token = { token::BITWISE_OR, "Bitwise Or", value };
-                }
-            }
-            else if (c == '<')
-            {
-                handle_less:
+    /**
+     * A token matched in the source, as a slice of `length` bytes
+     * from position `start`, with the symbol ID of words.
+     */
 
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '<')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::BITWISE_LEFT, "Bitwise Left", value };
-                }
-                else if (next == '=')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::COMPARE_LTE, "Compare LTE", value };
-                }
-                else
-                {
-                    token = { token::COMPARE_LT, "Compare LT", value };
-                }
-            }
-            else if (c == '>')
+    struct Lexeme
+    {
+        int type;
+        int64_t start;
+        int64_t length;
+        interner::SymbolId symbol = interner::noSymbol;
+    };
+
+    // Matches the lexeme at the current position, without moving.
+    template <typename ScannerType>
+    Lexeme match(ScannerType & scanner, const token::Metadata & meta)
+    {
+        auto start = scanner.position;
+        char c = scanner.current();
+        switch (characters.type(c))
+        {
+            case symbol::ALPHA:
             {
-                handle_greater:
-
-                value += c;
-                char next = scanner->peek(1);
-                if (next == '>')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::BITWISE_RIGHT, "Bitwise Right", value };
-                }
-                else if (next == '=')
-                {
-                    value += next;
-                    scanner->seek(1);
-                    token = { token::COMPARE_LTE, "Compare GTE", value };
-                }
-                else
-                {
-                    token = { token::COMPARE_LT, "Compare GT", value };
-                }
+                auto end = scanner.skip(start + 1, simd::skipIdentifier);
+                auto symbol = symbols->intern(scanner.slice(start, end));
+                auto word = grammar::keywordFor(symbol);
+                if (word && word->type != token::KEYWORD)
+                    return { word->type, start, end - start, symbol };
+                return { token::IDENTIFIER, start, end - start, symbol };
             }
-            else if (c == '(')
+            case symbol::DIGIT:
             {
-                value += c;
-                token = { token::EXPRESSION_START, "Expression Start", value };
+                auto end = scanner.skip(start + 1, simd::skipNumber);
+                return { token::NUMBER, start, end - start };
             }
-            else if (c == ')')
+            case symbol::SPACE:
+            case symbol::TAB:
             {
-                value += c;
-                token = { token::EXPRESSION_END, "Expression End", value };
+                auto end = scanner.skip(start + 1, simd::skipBlank);
+                return { token::WHITESPACE, start, end - start };
             }
-            else if (c == ',')
+            case symbol::QUOTE_DOUBLE:
+            case symbol::QUOTE_SINGLE:
             {
-                value += c;
-                token = { token::COMMA, "Comma", value };
+                auto end = matchString(scanner, c, meta);
+                return { token::STRING, start, end - start };
             }
-
-            // Rewrite Identifiers
-            if (token.type == token::IDENTIFIER)
+            default:
             {
-                if (token.value == "and")
+                // Run the operator DFA for the longest spelling
+                const grammar::Spelling* longest = NULL;
+                int64_t length = 0;
+                int state = 0;
+                for (int64_t i = 0; ; i++)
                 {
-                    token = { token::LOGICAL_AND, "And", token.value };
-                }
-                else if (token.value == "or")
-                {
-                    token = { token::LOGICAL_OR, "Or", token.value };
+                    state = grammar::dfa.next[state][(uint8_t) scanner.peek(i)];
+                    if (!state)
+                        break;
+                    if (grammar::dfa.accept[state])
+                    {
+                        longest = grammar::dfa.accepted(state);
+                        length = i + 1;
+                    }
                 }
-            }
-
-            // Set line
-            token.line = currentLine;
-
-            // Set lines
-            token.lines = sourceLines;
+                if (longest)
+                    return { longest->type, start, length };
 
-            // Set token metadata
-            token.meta = meta;
+                // Skip unknown characters
+                return { token::UNDEFINED, start, 1 };
+            }
+        }
+    }
 
-            // Update position
-            meta.position += token.value.size();
+    // Gets the position after the string starting at the current position.
+    template <typename ScannerType>
+    int64_t matchString(ScannerType & scanner, char delimiter, const token::Metadata & meta)
+    {
+        char escape = '\\';
+        auto skipBody = [delimiter](const char* p, const char* end)
+        {
+            return simd::skipString(p, end, delimiter);
+        };
 
-            // Update line and column
-            if (token.type == token::NEWLINE)
-            {
-                meta.column = 1;
-                meta.line += token.value.size();
-                currentLine = make_shared<Line>();
-                sourceLines->push_back(&*currentLine);
-            }
-            else
+        auto pos = scanner.position + 1;
+        while (true)
+        {
+            // Skip the string body up to a delimiter, escape or NUL
+            pos = scanner.skip(pos, skipBody);
+            char next = scanner.peek(pos - scanner.position);
+            if (next == delimiter)
+                return pos + 1;
+
+            if ((next == '\0' && scanner.atEnd(pos)) ||
+                (next == escape && scanner.atEnd(pos + 1)))
             {
-                meta.column += token.value.size();
-                currentLine->content += token.value;
+                throw CreamError("Unterminated string\n", { meta.line, meta.column });
             }
 
-            // Add the token
-            if (token.type)
-                tokens.push_back(token);
+            // Skip the escaped character, or an embedded NUL
+            pos += (next == escape) ? 2 : 1;
         }
-        return tokens;
     }
 
+    // Gets the rewriter passes, to enable, disable or time them.
+    PassManager<Rewriter> & passes()
+    {
+        return rewriter->passes;
+    }
+
+    // Symbol table of the current compilation
+    shared_ptr<Interner> symbols;
+
+    // Context of the current compilation
+    shared_ptr<CompilationContext> context;
+
 private:
     Scanner* scanner;
     Rewriter* rewriter;
@@ -429,7 +366,7 @@ void testLexer()
         auto tokens = lexer.tokenize();
         assert(tokens.size() == 3);
         assert(tokens[0].toString() == "String Hello there!");
-        assert(tokens[1].toString() == "String I'm Alice.");
+        assert(tokens[1].toString() == "String I\\'m Alice.");
         assert(tokens[2].toString() == "String Nice to meet you.");
     }
 
@@ -514,6 +451,19 @@ void testLexer()
         assert(tokens[6].toString() == "Identifier d");
         assert(tokens[7].toString() == "Compare GTE >=");
         assert(tokens[8].toString() == "Identifier e");
+        assert(tokens[5].type == cream::token::COMPARE_GT);
+        assert(tokens[7].type == cream::token::COMPARE_GTE);
+    }
+
+    {
+        // Test positions after strings and unknown characters
+        string source = "'a\\'b' ; c";
+        Lexer lexer(source);
+        auto tokens = lexer.tokenize();
+        assert(tokens.size() == 2);
+        assert(tokens[0].value == "a\\'b");
+        assert(tokens[1].meta.position == 10);
+        assert(tokens[1].meta.column == 10);
     }
 
 
@@ -540,14 +490,13 @@ void testLexer()
         Lexer lexer(source);
         auto tokens = lexer.tokenize();
         assert(tokens.size() == 13);
-        assert(tokens[0].pair.start == 1);
-        assert(tokens[0].pair.end == 19);
-        assert(tokens[1].pair.start == 2);
-        assert(tokens[1].pair.end == 8);
-        assert(tokens[11].pair.start == 12);
-        assert(tokens[11].pair.end == 18);
-        assert(tokens[12].pair.start == 1);
-        assert(tokens[12].pair.end == 19);
+        assert(tokens[0].partner == 12);
+        assert(tokens[1].partner == 4);
+        assert(tokens[5].partner == -4);
+        assert(tokens[7].partner == 4);
+        assert(tokens[11].partner == -4);
+        assert(tokens[12].partner == -12);
+        assert(tokens[2].partner == 0);
     }
 
     {
@@ -670,18 +619,18 @@ void testLexer()
                         "  a = 1\n"
                         "  b = 2";
         Lexer lexer(source);
-        auto tokens = lexer.tokenize();
-        assert(tokens[0].lines->size() == 3);
-        assert(tokens[0].lines == tokens[1].lines);
-        assert(tokens[0].lines->at(0)->content == "() ->");
-        assert(tokens[0].lines->at(1)->content == "  a = 1");
-        assert(tokens[0].lines->at(2)->content == "  b = 2");
-        assert(tokens[0].lines->at(0)->indent == "");
-        assert(tokens[0].lines->at(1)->indent == "  ");
-        assert(tokens[0].lines->at(2)->indent == "  ");
-        assert(tokens[0].lines->at(0)->indentLevel() == 0);
-        assert(tokens[0].lines->at(1)->indentLevel() == 1);
-        assert(tokens[0].lines->at(2)->indentLevel() == 1);
+        auto stream = lexer.lex();
+        auto& lines = *stream.lines;
+        assert(lines.size() == 3);
+        assert(lines.text(0) == "() ->");
+        assert(lines.text(1) == "  a = 1");
+        assert(lines.text(2) == "  b = 2");
+        assert(lines.indent(0) == "");
+        assert(lines.indent(1) == "  ");
+        assert(lines.indent(2) == "  ");
+        assert(lines.indentLevel(0) == 0);
+        assert(lines.indentLevel(1) == 1);
+        assert(lines.indentLevel(2) == 1);
     }
 
     {
@@ -695,20 +644,20 @@ void testLexer()
                         "\n"
                         "bar()";
         Lexer lexer(source);
-        auto tokens = lexer.tokenize();
-        assert(tokens[0].lines->size() == 8);
-        assert(tokens[0].lines == tokens[1].lines);
-        assert(tokens[0].lines->at(0)->indent == "");
-        assert(tokens[0].lines->at(1)->indent == "  ");
-        assert(tokens[0].lines->at(2)->indent == "    ");
-        assert(tokens[0].lines->at(0)->indentLevel() == 0);
-        assert(tokens[0].lines->at(1)->indentLevel() == 1);
-        assert(tokens[0].lines->at(2)->indentLevel() == 2);
-        assert(tokens[0].lines->at(3)->indentLevel() == 0);
-        assert(tokens[0].lines->at(4)->indentLevel() == 1);
-        assert(tokens[0].lines->at(5)->indentLevel() == 2);
-        assert(tokens[0].lines->at(6)->indentLevel() == 0);
-        assert(tokens[0].lines->at(7)->indentLevel() == 0);
+        auto stream = lexer.lex();
+        auto& lines = *stream.lines;
+        assert(lines.size() == 8);
+        assert(lines.indent(0) == "");
+        assert(lines.indent(1) == "  ");
+        assert(lines.indent(2) == "    ");
+        assert(lines.indentLevel(0) == 0);
+        assert(lines.indentLevel(1) == 1);
+        assert(lines.indentLevel(2) == 2);
+        assert(lines.indentLevel(3) == 0);
+        assert(lines.indentLevel(4) == 1);
+        assert(lines.indentLevel(5) == 2);
+        assert(lines.indentLevel(6) == 0);
+        assert(lines.indentLevel(7) == 0);
     }
 
     {
@@ -724,20 +673,205 @@ void testLexer()
         Lexer lexer(source);
         auto tokens = lexer.tokenize();
         assert(tokens[3].name == "Block Start");
-        assert(tokens[3].pair.end == tokens[21].meta.position);
+        assert(tokens[3].partner == 18);
         assert(tokens[4].value == "if");
         assert(tokens[7].name == "Block Start");
-        assert(tokens[7].pair.end == tokens[12].meta.position);
+        assert(tokens[7].partner == 5);
         assert(tokens[8].value == "a");
         assert(tokens[12].name == "Block End");
         assert(tokens[13].value == "else");
         assert(tokens[15].name == "Block Start");
-        assert(tokens[15].pair.end == tokens[20].meta.position);
+        assert(tokens[15].partner == 5);
         assert(tokens[16].value == "b");
         assert(tokens[20].name == "Block End");
         assert(tokens[21].name == "Block End");
         assert(tokens[22].value == "bar");
     }
+
+    {
+        // Test borrowed source
+        string source = "a = \"b\"";
+        Lexer lexer;
+        auto tokens = lexer.tokenize(source);
+        assert(tokens.size() == 3);
+        assert(tokens[2].toString() == "String b");
+    }
+
+    {
+        // Test mapped source
+        char path[] = "/tmp/cream-lexer-XXXXXX";
+        int fd = ::mkstemp(path);
+        string source = "int main() ->\n  return 42\n";
+        ssize_t written = ::write(fd, source.data(), source.size());
+        assert(written == (ssize_t) source.size());
+        ::close(fd);
+
+        Lexer lexer;
+        Lexer copier(source);
+        auto mapped = lexer.tokenizeFile(path);
+        auto copied = copier.tokenize();
+        assert(mapped.size() == copied.size());
+        for (size_t i = 0; i < mapped.size(); i++)
+            assert(mapped[i].toString() == copied[i].toString());
+        ::unlink(path);
+    }
+
+    {
+        // Test streamed source matches the in-memory path
+        string source = "int longIdentifierName() ->\n"
+                        "  if 'a long string that crosses windows'\n"
+                        "    a = 1234.5678\n"
+                        "\n"
+                        "  else\n"
+                        "    return \"esc\\\"aped\" << b >= c\n";
+        Lexer copier(source);
+        auto expected = copier.tokenize();
+        for (size_t windowSize : { 1, 3, 7, 64 })
+        {
+            int fds[2];
+            int piped = ::pipe(fds);
+            assert(piped == 0);
+            ssize_t written = ::write(fds[1], source.data(), source.size());
+            assert(written == (ssize_t) source.size());
+            ::close(fds[1]);
+
+            Lexer lexer;
+            auto stream = lexer.lexStream(fds[0], windowSize);
+            auto tokens = stream.tokens();
+            ::close(fds[0]);
+            assert(tokens.size() == expected.size());
+            for (size_t i = 0; i < tokens.size(); i++)
+                assert(tokens[i].debug() == expected[i].debug());
+        }
+    }
+
+    {
+        // Test token streams match token vectors
+        string source = "int add(int a, int b) ->\n"
+                        "  return a + b\n"
+                        "add(1, 'two')\n";
+        Lexer lexer(source);
+        auto stream = lexer.lex();
+        auto tokens = lexer.tokenize();
+        assert(stream.size() == tokens.size());
+        for (size_t i = 0; i < tokens.size(); i++)
+            assert(stream.at(i).debug() == tokens[i].debug());
+        assert(stream.partners[stream.partners[2]] == 2);
+    }
+
+    {
+        // Test identifiers are interned
+        Lexer lexer;
+        auto tokens = lexer.tokenize("int a = b + a\nreturn a");
+        assert(tokens[0].symbol == Interner::common().find("int"));
+        assert(tokens[1].symbol == tokens[5].symbol);
+        assert(tokens[1].symbol != tokens[3].symbol);
+        assert(lexer.symbols->name(tokens[3].symbol) == "b");
+        assert(tokens[7].symbol == interner::SYMBOL_RETURN);
+        assert(tokens[2].symbol == interner::noSymbol);
+    }
+
+    {
+        // Test unterminated strings
+        Lexer lexer;
+        bool thrown = false;
+        try { lexer.tokenize("'abc\\"); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
+    }
+
+    {
+        // Test the fused rewriter matches the rewriter passes
+        const char* sources[] =
+        {
+            "int main() ->\n  return 42\n",
+            "() ->\n  if true\n    a = 1\n\n  else\n    b = 2\n\nbar()",
+            "f = (a,\n  b) -> return a\nc = 'd'\n",
+            "x = () -> y = () -> 1\n",
+            "a\n  () ->\n    b\n      c\n",
+            "return return\n",
+            "return ->\nfoo\n",
+            "a -> b ->\nc\n",
+            "  a ->\nb\n",
+            "x = () ->\n\n  y\n",
+            "return (a) + b\n",
+            "\n  a\n",
+            "a b c\nd e\n",
+            "f(a) -> g(b) -> return a\n",
+            "-> ->",
+            "s = 'x\ny'\n  z\n",
+            "a ->  \n   \n\nb\n",
+            "",
+        };
+        for (auto source : sources)
+        {
+            Lexer lexer;
+            Scanner scanner;
+            scanner.borrow(source);
+            auto scanned = lexer.scanTokens(scanner);
+            Rewriter rewriter;
+            TokenStream fused, passes;
+            string fusedError, passesError;
+            try { fused = rewriter.rewrite(scanned); }
+            catch (CreamError& e) { fusedError = e.what(); }
+            try { passes = rewriter.rewritePasses(scanned); }
+            catch (CreamError& e) { passesError = e.what(); }
+            assert(fusedError == passesError);
+            assert(fused.types == passes.types);
+            assert(fused.offsets == passes.offsets);
+            assert(fused.lengths == passes.lengths);
+            assert(fused.partners == passes.partners);
+            assert(fused.symbols == passes.symbols);
+        }
+
+        // Test errors come from the passes
+        Lexer lexer;
+        bool thrown = false;
+        try { lexer.tokenize("a\n  b\n      c\n"); }
+        catch (CreamError& e)
+        {
+            thrown = string(e.what()) == "Unexpected indent\n" && e.span.line == 3;
+        }
+        assert(thrown);
+    }
+
+    {
+        // Test rewriting with only some passes, timed
+        Lexer lexer;
+        lexer.passes().applyOptions({ "--passes=rewriteTypes", "--pass-stats" });
+        assert(lexer.passes().isEnabled("removeWhitespace"));
+        assert(lexer.passes().isEnabled("rewriteKeywords"));
+        assert(!lexer.passes().isEnabled("rewriteIndents"));
+        assert(!lexer.passes().isEnabled("rewriteLambdaExpressions"));
+
+        auto tokens = lexer.tokenize("int main() ->\n  return 1\n");
+        assert(tokens.size() == 9);
+        assert(tokens[0].type == token::TYPE);
+        assert(tokens[1].type == token::IDENTIFIER);
+        assert(tokens[2].type == token::EXPRESSION_START);
+        assert(tokens[6].type == token::KEYWORD);
+
+        auto const& stats = lexer.passes().getStats();
+        for (auto const& stat : stats)
+        {
+            bool enabled = lexer.passes().isEnabled(stat.name);
+            assert(stat.runs == (enabled ? 1 : 0));
+            if (stat.name == "removeWhitespace")
+                assert(stat.removed == 4 && stat.inserted == 0);
+            else
+                assert(stat.removed == 0 && stat.inserted == 0);
+        }
+
+        // Test enabling every pass again gives the full rewrite
+        lexer.passes().enableAll();
+        lexer.passes().timing = false;
+        Lexer full;
+        auto expected = full.tokenize("int main() ->\n  return 1\n");
+        tokens = lexer.tokenize("int main() ->\n  return 1\n");
+        assert(tokens.size() == expected.size());
+        for (size_t i = 0; i < tokens.size(); i++)
+            assert(tokens[i].toString() == expected[i].toString());
+    }
 }
 
 } // end cream::lexer
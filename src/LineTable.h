@@ -0,0 +1,202 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "CompilationContext.h"
+#include "Simd.h"
+
+namespace cream {
+namespace token {
+
+using namespace std;
+
+/**
+ * The LineTable class.
+ *
+ * Indexes the start offset of every line in a source, found in one pass
+ * with memchr. Line text and indentation are computed on demand from the
+ * source, so tokens only need their offset. Lines are numbered from 0.
+ */
+
+class LineTable
+{
+public:
+    // Indexes `source`, measuring indentation with the indent size of
+    // `context`, or the default size without one.
+    LineTable(string_view source="", shared_ptr<const CompilationContext> context=nullptr)
+        : context(context ? context : make_shared<CompilationContext>())
+    {
+        build(source);
+    }
+
+    // Indexes the lines of `source`, which must outlive the table.
+    void build(string_view source)
+    {
+        this->source = source;
+        starts.assign(1, 0);
+
+        const char* data = source.data();
+        const char* end = data + source.size();
+        const char* p = data;
+        while (p < end && (p = (const char*) memchr(p, '\n', end - p)))
+        {
+            p++;
+            starts.push_back((uint32_t) (p - data));
+        }
+    }
+
+    // Re-indexes lines after the text from `start` to `oldEnd` was replaced
+    // by the text from `start` to `newEnd` of `source`. Only the new text is
+    // scanned; later line starts are shifted.
+    void splice(string_view source, uint32_t start, uint32_t oldEnd, uint32_t newEnd)
+    {
+        this->source = source;
+        auto first = upper_bound(starts.begin(), starts.end(), start) - starts.begin();
+        auto last = upper_bound(starts.begin(), starts.end(), oldEnd) - starts.begin();
+        for (auto i = (size_t) last; i < starts.size(); i++)
+            starts[i] = starts[i] - oldEnd + newEnd;
+
+        vector<uint32_t> inserted;
+        const char* data = source.data();
+        const char* end = data + newEnd;
+        const char* p = data + start;
+        while (p < end && (p = (const char*) memchr(p, '\n', end - p)))
+        {
+            p++;
+            inserted.push_back((uint32_t) (p - data));
+        }
+        starts.erase(starts.begin() + first, starts.begin() + last);
+        starts.insert(starts.begin() + first, inserted.begin(), inserted.end());
+    }
+
+    // Gets the number of lines.
+    size_t size() const
+    {
+        return starts.size();
+    }
+
+    // Gets the offset of the first character of `line`.
+    uint32_t start(size_t line) const
+    {
+        return starts[line];
+    }
+
+    // Gets the offset just past the last character of `line`, excluding
+    // its newline.
+    uint32_t end(size_t line) const
+    {
+        if (line + 1 < starts.size())
+            return starts[line + 1] - 1;
+        return (uint32_t) source.size();
+    }
+
+    // Gets the line holding `offset`.
+    size_t lineOf(uint32_t offset) const
+    {
+        auto next = upper_bound(starts.begin(), starts.end(), offset);
+        return (next - starts.begin()) - 1;
+    }
+
+    // Gets the 1-based column of `offset`.
+    int64_t columnOf(uint32_t offset) const
+    {
+        return offset - starts[lineOf(offset)] + 1;
+    }
+
+    // Gets the text of `line`, without its newline.
+    string_view text(size_t line) const
+    {
+        return source.substr(start(line), end(line) - start(line));
+    }
+
+    // Gets the leading blanks of `line`.
+    string_view indent(size_t line) const
+    {
+        auto text = this->text(line);
+        auto blank = simd::skipBlank(text.data(), text.data() + text.size());
+        return text.substr(0, blank - text.data());
+    }
+
+    // Checks whether `line` has no characters.
+    bool isEmpty(size_t line) const
+    {
+        return start(line) == end(line);
+    }
+
+    // Gets the indentation level of `line`.
+    int indentLevel(size_t line) const
+    {
+        return indent(line).size() / baseIndentSize();
+    }
+
+    // Gets the indent size of one level.
+    int baseIndentSize() const
+    {
+        return context->indentSize();
+    }
+
+private:
+    string_view source;
+    vector<uint32_t> starts;
+    shared_ptr<const CompilationContext> context;
+};
+
+void testLineTable()
+{
+    cout << "Testing LineTable" << endl;
+
+    {
+        // Test line starts
+        LineTable lines("a\n\n  bc\n");
+        assert(lines.size() == 4);
+        assert(lines.start(2) == 3);
+        assert(lines.end(2) == 7);
+        assert(lines.text(0) == "a");
+        assert(lines.text(2) == "  bc");
+        assert(lines.isEmpty(1));
+        assert(lines.isEmpty(3));
+        assert(lines.indent(2) == "  ");
+        assert(lines.indent(0) == "");
+        assert(lines.lineOf(0) == 0);
+        assert(lines.lineOf(2) == 1);
+        assert(lines.lineOf(6) == 2);
+        assert(lines.columnOf(5) == 3);
+    }
+
+    {
+        // Test empty and unterminated sources
+        LineTable empty;
+        assert(empty.size() == 1);
+        assert(empty.isEmpty(0));
+        LineTable single("\tx");
+        assert(single.size() == 1);
+        assert(single.indent(0) == "\t");
+    }
+
+    {
+        // Test splicing matches a rebuild
+        string source = "a\nbc\nd\n\ne";
+        LineTable lines(source);
+        source.replace(3, 4, "x\ny\nz\n");
+        lines.splice(source, 3, 7, 9);
+        LineTable rebuilt(source);
+        assert(lines.size() == rebuilt.size());
+        for (size_t i = 0; i < lines.size(); i++)
+            assert(lines.start(i) == rebuilt.start(i));
+        assert(lines.text(4) == "");
+        assert(lines.text(5) == "e");
+    }
+}
+
+} // end cream::token
+
+using LineTable = cream::token::LineTable;
+
+} // end cream
@@ -0,0 +1,455 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Common.h"
+#include "Grammar.h"
+#include "Interner.h"
+#include "Lexer.h"
+#include "LineTable.h"
+#include "Simd.h"
+#include "Symbol.h"
+#include "ThreadPool.h"
+#include "Token.h"
+#include "TokenStream.h"
+
+namespace cream {
+namespace lexer {
+
+using namespace std;
+
+/**
+ * Classes of characters seen by the split pre-pass.
+ *
+ * Ignored characters are blanks and characters that start no token, so
+ * the last token characters of a line tell whether it ends with an arrow.
+ */
+
+enum SplitClass : uint8_t
+{
+    SPLIT_IGNORED,
+    SPLIT_TOKEN,
+    SPLIT_NEWLINE,
+    SPLIT_QUOTE,
+    SPLIT_OPEN,
+    SPLIT_CLOSE
+};
+
+struct SplitTable
+{
+    SplitClass classes[256];
+};
+
+constexpr SplitTable makeSplitTable()
+{
+    SplitTable table {};
+    for (int c = 0; c < 256; c++)
+    {
+        auto type = symbol::characters.type((char) c);
+        auto& split = table.classes[c];
+        if (c == '\n')
+            split = SPLIT_NEWLINE;
+        else if (c == '"' || c == '\'')
+            split = SPLIT_QUOTE;
+        else if (c == '(')
+            split = SPLIT_OPEN;
+        else if (c == ')')
+            split = SPLIT_CLOSE;
+        else if (type == symbol::SPACE || type == symbol::TAB)
+            split = SPLIT_IGNORED;
+        else if (type == symbol::ALPHA || type == symbol::DIGIT || grammar::dfa.next[0][c])
+            split = SPLIT_TOKEN;
+        else
+            split = SPLIT_IGNORED;
+    }
+    return table;
+}
+
+constexpr SplitTable splitTable = makeSplitTable();
+
+static_assert(splitTable.classes['-'] == SPLIT_TOKEN, "Arrows are tokens");
+static_assert(splitTable.classes[';'] == SPLIT_IGNORED, "Unknown characters are skipped");
+
+/**
+ * The ParallelLexer class.
+ *
+ * Lexes a large source in chunks on a thread pool, producing the same
+ * TokenStream as `Lexer::lex`. A quick pre-pass splits the source before
+ * top-level lines, outside strings and parentheses and not after a line
+ * ending with an arrow, so the rewriter never needs context from another
+ * chunk: every block is closed at the end of its chunk, exactly where the
+ * next chunk's first line would close it.
+ *
+ * Each chunk is lexed with its own symbol table. The chunks are then
+ * stitched in order: offsets are shifted to the whole source, partners
+ * to the whole stream, and symbols are interned into the lexer's table in
+ * order of first use, so IDs match a single-threaded run. Line numbers
+ * come from one line table over the whole source.
+ *
+ * The rewriter measures indentation against the line of the previous
+ * token, so a string spanning lines can leave blocks open past a split.
+ * Each chunk is checked to close as many blocks as the whole source would
+ * at its end. When one does not, or a chunk fails to lex, the source is
+ * lexed again on one thread, to give the same tokens or error.
+ */
+
+class ParallelLexer
+{
+public:
+    static constexpr size_t defaultChunkSize = 1 << 20;
+
+    // Number of chunks stitched by the last call, or 1 when it lexed on
+    // one thread.
+    size_t chunkCount = 0;
+
+    // Lexes with the symbols of `lexer` on `pool`, in chunks of about
+    // `chunkSize` bytes.
+    ParallelLexer(Lexer & lexer, ThreadPool & pool, size_t chunkSize=defaultChunkSize)
+        : lexer(lexer),
+          pool(pool),
+          chunkSize(max<size_t>(chunkSize, 1))
+    {}
+
+    /**
+     * Chunk start offsets, and the indent size of the first indented line.
+     */
+
+    struct Plan
+    {
+        vector<size_t> starts;
+        int firstIndent = 0;
+    };
+
+    // Converts a borrowed source to a TokenStream.
+    TokenStream lex(SourceText borrowed)
+    {
+        auto source = borrowed.view();
+        chunkCount = 1;
+        auto plan = split(source, chunkSize);
+        if (plan.starts.size() < 2 || source.size() >= TokenStream::implicit)
+            return lexer.lex(borrowed);
+
+        // Fix the indent size before chunks copy it
+        lexer.context->noteIndent(plan.firstIndent);
+
+        vector<future<TokenStream>> chunks;
+        for (size_t i = 0; i < plan.starts.size(); i++)
+        {
+            auto start = plan.starts[i];
+            auto end = i + 1 < plan.starts.size() ? plan.starts[i + 1] : source.size();
+            string text(source.substr(start, end - start));
+            auto context = make_shared<CompilationContext>(*lexer.context);
+            chunks.push_back(pool.submit([text, context]
+            {
+                Lexer chunkLexer(text, context);
+                return chunkLexer.lex();
+            }));
+        }
+        auto lines = make_shared<LineTable>(source, lexer.context);
+
+        vector<TokenStream> streams;
+        try
+        {
+            for (auto& chunk : chunks)
+                streams.push_back(chunk.get());
+        }
+        catch (CreamError& e)
+        {
+            for (auto& chunk : chunks)
+            {
+                if (chunk.valid())
+                    chunk.wait();
+            }
+            return lexer.lex(borrowed);
+        }
+
+        for (size_t i = 0; i + 1 < streams.size(); i++)
+        {
+            if (!closesBlocks(streams[i], plan.starts[i], *lines))
+                return lexer.lex(borrowed);
+        }
+        chunkCount = streams.size();
+        return stitch(source, lines, plan.starts, streams);
+    }
+
+    // Converts a borrowed source to Tokens.
+    vector<Token> tokenize(SourceText source)
+    {
+        return lex(source).tokens();
+    }
+
+    // Finds chunk starts at least `chunkSize` bytes apart, in one pass.
+    static Plan split(string_view source, size_t chunkSize)
+    {
+        Plan plan;
+        plan.starts.push_back(0);
+
+        const char* data = source.data();
+        const char* end = data + source.size();
+        size_t target = max<size_t>(chunkSize, 1);
+        int depth = 0;
+        char last = 0;
+        char beforeLast = 0;
+        bool lineStart = true;
+
+        for (const char* p = data; p < end; p++)
+        {
+            char c = *p;
+            if (lineStart)
+            {
+                lineStart = false;
+                size_t offset = p - data;
+                if (c == ' ' || c == '\t')
+                {
+                    if (!plan.firstIndent)
+                        plan.firstIndent = simd::skipBlank(p, end) - p;
+                }
+                else if (offset >= target && depth == 0 &&
+                         !(beforeLast == '-' && last == '>') &&
+                         symbol::characters.type(c) == symbol::ALPHA)
+                {
+                    plan.starts.push_back(offset);
+                    target = offset + chunkSize;
+                }
+            }
+
+            switch (splitTable.classes[(uint8_t) c])
+            {
+                case SPLIT_IGNORED:
+                    continue;
+                case SPLIT_NEWLINE:
+                    lineStart = true;
+                    continue;
+                case SPLIT_QUOTE:
+                    p = skipString(p, end);
+                    break;
+                case SPLIT_OPEN:
+                    depth++;
+                    break;
+                case SPLIT_CLOSE:
+                    depth--;
+                    break;
+                case SPLIT_TOKEN:
+                    break;
+            }
+            beforeLast = last;
+            last = c;
+        }
+        return plan;
+    }
+
+    // Checks whether `chunk`, starting at `offset`, ends with one block end
+    // per indent level of its last line, as the next chunk would close them.
+    static bool closesBlocks(const TokenStream & chunk, size_t offset, const LineTable & lines)
+    {
+        size_t closers = 0;
+        size_t last = chunk.size();
+        while (last > 0 && chunk.types[last - 1] == token::BLOCK_END)
+        {
+            closers++;
+            last--;
+        }
+        if (last == 0 || chunk.types[last - 1] != token::NEWLINE || chunk.isImplicit(last - 1))
+            return false;
+
+        auto line = lines.lineOf(chunk.offsets[last - 1] + offset);
+        return (int) closers == lines.indentLevel(line);
+    }
+
+private:
+    // Gets the closing quote of the string starting at `p`, or the last
+    // character of an unterminated string.
+    static const char* skipString(const char* p, const char* end)
+    {
+        char delimiter = *p;
+        p++;
+        while (true)
+        {
+            p = simd::skipString(p, end, delimiter);
+            if (p >= end)
+                return end - 1;
+            if (*p == delimiter)
+                return p;
+            p += (*p == '\\') ? 2 : 1;
+        }
+    }
+
+    // Joins chunk streams into one stream over `source`.
+    TokenStream stitch(string_view source, shared_ptr<const LineTable> lines,
+                       const vector<size_t> & starts, const vector<TokenStream> & streams)
+    {
+        TokenStream stream;
+        stream.interner = lexer.symbols;
+        stream.source = source;
+        stream.lines = lines;
+
+        size_t count = 0;
+        for (auto const& chunk : streams)
+            count += chunk.size();
+        stream.reserve(count);
+
+        auto firstLocal = Interner::common().end();
+        vector<SymbolId> remap;
+        for (size_t c = 0; c < streams.size(); c++)
+        {
+            auto const& chunk = streams[c];
+            auto shift = (uint32_t) starts[c];
+            auto tokenBase = (uint32_t) stream.size();
+
+            // Intern new names in order of first use
+            remap.clear();
+            for (auto id = firstLocal; id < chunk.interner->end(); id++)
+                remap.push_back(lexer.symbols->intern(chunk.interner->name(id)));
+
+            for (size_t i = 0; i < chunk.size(); i++)
+            {
+                auto symbol = chunk.symbols[i];
+                if (symbol != interner::noSymbol && symbol >= firstLocal)
+                    symbol = remap[symbol - firstLocal];
+
+                if (chunk.isImplicit(i))
+                    stream.push(chunk.types[i], TokenStream::implicit, 0, symbol);
+                else
+                    stream.push(chunk.types[i], chunk.offsets[i] + shift, chunk.lengths[i], symbol);
+
+                if (chunk.partners[i] != TokenStream::unpaired)
+                    stream.partners.back() = chunk.partners[i] + tokenBase;
+            }
+        }
+        return stream;
+    }
+
+    Lexer & lexer;
+    ThreadPool & pool;
+    size_t chunkSize;
+};
+
+// Gets the names of every symbol in `table`, in ID order.
+vector<string_view> symbolNames(const Interner & table)
+{
+    vector<string_view> names;
+    for (SymbolId id = 0; id < table.end(); id++)
+        names.push_back(table.name(id));
+    return names;
+}
+
+void testParallelLexer()
+{
+    cout << "Testing ParallelLexer" << endl;
+
+    {
+        // Test split points
+        string source =
+            "a\n"
+            "    b\n"
+            "c = (1,\n"
+            "d)\n"
+            "e ->\n"
+            "\n"
+            "f\n"
+            "'x\n"
+            "g'\n"
+            "h -> ;\n"
+            "i\n"
+            "j\n";
+        auto plan = ParallelLexer::split(source, 1);
+        vector<size_t> expected =
+        {
+            0, source.find("c ="), source.find("e ->"), source.find("h ->"), source.find("j")
+        };
+        assert(plan.starts == expected);
+        assert(plan.firstIndent == 4);
+        assert(ParallelLexer::split(source, source.size()).starts.size() == 1);
+    }
+
+    {
+        // Test chunks stitch into the single-threaded stream
+        string source;
+        for (int i = 0; i < 200; i++)
+        {
+            auto n = to_string(i);
+            source +=
+                "int f" + n + "(int a, double b) ->\n"
+                "    if a\n"
+                "        return a * b" + n + "\n"
+                "\n"
+                "    c = (a +\n"
+                "b)\n"
+                "s = 'x\\'" + n + "\n(' ; d\n"
+                "g" + n + " = () -> return f" + n + "(1, 2)\n"
+                "h = () ->\n"
+                "\n"
+                "k" + n + "\n";
+        }
+        ThreadPool pool(4);
+        for (size_t chunkSize : { (size_t) 1, (size_t) 100, (size_t) 4096, source.size() })
+        {
+            Lexer single;
+            auto expected = single.lex(source);
+
+            Lexer lexer;
+            ParallelLexer parallel(lexer, pool, chunkSize);
+            auto stream = parallel.lex(source);
+            assert(parallel.chunkCount > 1 || chunkSize == source.size());
+
+            assert(stream.types == expected.types);
+            assert(stream.offsets == expected.offsets);
+            assert(stream.lengths == expected.lengths);
+            assert(stream.partners == expected.partners);
+            assert(stream.symbols == expected.symbols);
+            assert(symbolNames(*stream.interner) == symbolNames(*expected.interner));
+
+            auto tokens = stream.tokens();
+            auto expectedTokens = expected.tokens();
+            for (size_t i = 0; i < tokens.size(); i++)
+            {
+                assert(tokens[i].toString() == expectedTokens[i].toString());
+                assert(tokens[i].meta.line == expectedTokens[i].meta.line);
+                assert(tokens[i].meta.column == expectedTokens[i].meta.column);
+                assert(tokens[i].meta.position == expectedTokens[i].meta.position);
+                assert(tokens[i].partner == expectedTokens[i].partner);
+            }
+        }
+    }
+
+    {
+        // Test blocks left open by a string spanning lines
+        string source = "a\n  s = 'x\ny'\nb\nc\n";
+        ThreadPool pool(2);
+        Lexer single;
+        auto expected = single.lex(source);
+        Lexer lexer;
+        ParallelLexer parallel(lexer, pool, 1);
+        auto stream = parallel.lex(source);
+        assert(parallel.chunkCount == 1);
+        assert(stream.types == expected.types);
+        assert(stream.partners == expected.partners);
+    }
+
+    {
+        // Test errors are reported as on one thread
+        string source = "a\nb\n  c\n      d\ne\n";
+        ThreadPool pool(2);
+        string expected, actual;
+        try { Lexer().lex(source); }
+        catch (CreamError& e) { expected = e.what(); }
+        try { Lexer lexer; ParallelLexer(lexer, pool, 1).lex(source); }
+        catch (CreamError& e) { actual = e.what(); }
+        assert(!expected.empty());
+        assert(actual == expected);
+    }
+}
+
+} // end cream::lexer
+
+using ParallelLexer = cream::lexer::ParallelLexer;
+
+} // end cream
@@ -1,12 +1,20 @@
 
 #pragma once
 
-#include <list>
+#include <cassert>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "Arena.h"
 #include "Common.h"
+#include "Diagnostics.h"
+#include "Interner.h"
 #include "Lexer.h"
 #include "Token.h"
+#include "TokenSource.h"
+#include "TokenStream.h"
 
 namespace cream {
 namespace parser {
@@ -23,523 +31,697 @@ struct ParamList;
 struct Function;
 struct Lambda;
 
-struct Node
+/**
+ * Kinds of AST node, one for each node struct.
+ */
+
+enum class NodeKind : uint8_t
 {
-    Node()
-    {
-        this->type = "Node";
-    }
-    virtual ~Node() {}
-    virtual vector<Node> children() {}
-    virtual string toString()
-    {
-        return type + " " + value;
-    }
-    Token token;
-    string type;
-    string value;
+    Node,
+    Expression,
+    Variable,
+    VariableDeclaration,
+    Number,
+    String,
+    Identifier,
+    Operation,
+    UnaryOperation,
+    Return,
+    BinaryOperation,
+    Addition,
+    Subtraction,
+    Multiplication,
+    Division,
+    BitwiseAnd,
+    BitwiseOr,
+    BitwiseLeft,
+    BitwiseRight,
+    CompareLT,
+    CompareLTE,
+    CompareGT,
+    CompareGTE,
+    CompareEQ,
+    LogicalAnd,
+    LogicalOr,
+    Assignment,
+    ExpressionGroup,
+    Block,
+    ParamList,
+    Lambda,
+    Function,
+    FunctionDefinition
 };
 
-struct Expression : Node
+/**
+ * Display names, indexed by NodeKind.
+ */
+
+constexpr const char* nodeNames[] =
 {
-    Expression(string value="")
+    "Node",
+    "Expression",
+    "Variable",
+    "Variable Declaration",
+    "Number",
+    "String",
+    "Identifier",
+    "Operation",
+    "Unary Operation",
+    "Return",
+    "Binary Operation",
+    "Addition",
+    "Subtraction",
+    "Multiplication",
+    "Division",
+    "Bitwise And",
+    "Bitwise Or",
+    "Bitwise Left",
+    "Bitwise Right",
+    "Compare LT",
+    "Compare LTE",
+    "Compare GT",
+    "Compare GTE",
+    "Compare EQ",
+    "Logical And",
+    "Logical Or",
+    "Assignment",
+    "Expression Group",
+    "Block",
+    "Parameter List",
+    "Lambda",
+    "Function",
+    "Function Definition"
+};
+
+static_assert(sizeof(nodeNames) / sizeof(nodeNames[0]) == size_t(NodeKind::FunctionDefinition) + 1,
+              "Missing node names");
+
+/**
+ * Gets the display name of a node kind.
+ */
+
+constexpr const char* nodeName(NodeKind kind)
+{
+    return nodeNames[size_t(kind)];
+}
+
+/**
+ * Checks whether nodes of `kind` are BinaryOperations.
+ */
+
+constexpr bool isBinaryOperation(NodeKind kind)
+{
+    return kind >= NodeKind::BinaryOperation && kind <= NodeKind::Assignment;
+}
+
+/**
+ * AST nodes.
+ *
+ * Each kind of node holds only its own members. Nodes are allocated in
+ * the arena of their AST and never destroyed one by one, so they hold no
+ * owning members: text is a view of the source or of the arena, and
+ * children are pointers or arena lists. Nodes have no virtual functions:
+ * passes switch on `kind`, or use a Visitor.
+ *
+ * Once parsed, each node knows its parent and its slot among the children
+ * of its parent, so the tree can be walked without a stack. Top-level
+ * statements have no parent.
+ */
+
+struct Children;
+
+struct Node
+{
+    Node(NodeKind kind=NodeKind::Node, string_view value="")
+        : kind(kind),
+          value(value)
+    {}
+    string toString() const
     {
-        this->type = "Expression";
-        this->value = value;
+        return string(nodeName(kind)) + " " + string(value);
     }
-    virtual ~Expression() {}
-    virtual bool isOperation() { return false; }
 
-    // Block members
-    vector<Statement> statements;
+    // Gets this node as kind `T`.
+    template <typename T>
+    T* as()
+    {
+        return static_cast<T*>(this);
+    }
 
-    // Lambda members
-    ParamList* paramList = NULL;
-    Block* block = NULL;
+    // Gets the child slots of this node.
+    Children children();
 
-    // ParamList members
-    vector<Parameter> params;
+    NodeKind kind;
+    uint32_t slot = 0;
+    Node* parent = nullptr;
+    string_view value;
+};
 
-    // Statement members
-    Expression* inner = NULL;
+/**
+ * The child slots of a node, in source order, read from the members of
+ * the node. A slot is NULL for an empty statement.
+ */
 
-    // Variable Declaration members
-    Expression* variable = NULL;
+struct Children
+{
+    // Iterates over the child slots.
+    struct Iterator
+    {
+        Node* operator*() const { return children->at(index); }
+        Iterator& operator++() { index++; return *this; }
+        bool operator==(const Iterator & other) const { return index == other.index; }
+        bool operator!=(const Iterator & other) const { return index != other.index; }
 
-    // Function Definition members
-    Expression* function = NULL;
+        const Children* children;
+        uint32_t index;
+    };
 
-    // Function members
-    string returnType;
-    string functionName;
-    Lambda* lambda;
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Iterator begin() const { return { this, 0 }; }
+    Iterator end() const { return { this, count }; }
+    Node* operator[](uint32_t i) const { return at(i); }
 
-    // Variable members
-    string varType;
-    string varName;
+    // Gets child slot `i`.
+    Node* at(uint32_t i) const;
 
-    // Binary operation members
-    Expression* left = NULL;
-    Expression* right = NULL;
+    Node* node;
+    uint32_t count;
+};
 
-    // Unary operation members
-    Expression* operand = NULL;
+struct Expression : Node
+{
+    Expression(NodeKind kind=NodeKind::Expression, string_view value="")
+        : Node(kind, value)
+    {}
 };
 
 struct Variable : Expression
 {
-    Variable(Token typeToken, Token nameToken)
+    Variable(SymbolId varType, SymbolId varName)
+        : Expression(NodeKind::Variable)
     {
-        this->type = "Variable";
-        this->typeToken = typeToken;
-        this->nameToken = nameToken;
-        this->varType = typeToken.value;
-        this->varName = nameToken.value;
+        this->varType = varType;
+        this->varName = varName;
     }
-    virtual ~Variable() {}
-    Token typeToken;
-    Token nameToken;
+    SymbolId varType;
+    SymbolId varName;
 };
 
 struct VariableDeclaration : Expression
 {
-    VariableDeclaration(Variable* variable)
+    VariableDeclaration(Variable* variable, string_view value)
+        : Expression(NodeKind::VariableDeclaration, value)
     {
-        this->type = "Variable Declaration";
         this->variable = variable;
-        this->value = this->variable->varType + " " + this->variable->varName;
     }
-    virtual ~VariableDeclaration() {}
+    Variable* variable;
 };
 
 struct Number : Expression
 {
-    Number(string value="")
-    {
-        this->type = "Number";
-        this->value = value;
-    }
-    virtual ~Number() {}
+    Number(string_view value="")
+        : Expression(NodeKind::Number, value)
+    {}
 };
 
 struct String : Expression
 {
-    String(Token token)
-    {
-        this->type = "String";
-        this->token = token;
-        this->value = token.value;
-    }
-    virtual ~String() {}
+    String(string_view value="")
+        : Expression(NodeKind::String, value)
+    {}
 };
 
 struct Identifier : Expression
 {
-    Identifier(string value="")
+    Identifier(string_view value="", SymbolId symbol=interner::noSymbol)
+        : Expression(NodeKind::Identifier, value)
     {
-        this->type = "Identifier";
-        this->value = value;
+        this->symbol = symbol;
     }
-    virtual ~Identifier() {}
+    SymbolId symbol;
 };
 
 struct Operation : Expression
 {
-    Operation(Token token)
+    Operation(const Token & token)
+        : Expression(NodeKind::Operation, token.value)
+    {
+        this->op = token.type;
+    }
+    Operation(NodeKind kind, int op, string_view value)
+        : Expression(kind, value)
     {
-        this->type = "Operation";
-        this->token = token;
+        this->op = op;
     }
-    virtual ~Operation() {}
-    virtual bool isOperation() { return true; }
+    int op;
 };
 
 struct UnaryOperation : Operation
 {
-    UnaryOperation(Token token, Expression* operand=0)
-        : Operation(token)
+    UnaryOperation(int op, string_view value, Expression* operand=0, NodeKind kind=NodeKind::UnaryOperation)
+        : Operation(kind, op, value)
     {
-        this->type = "Unary Operation";
-        this->token = token;
         this->operand = operand;
     }
-    virtual ~UnaryOperation() {}
+    Expression* operand;
 };
 
 struct Return : UnaryOperation
 {
-    Return(Token token, Expression* operand)
-        : UnaryOperation(token, operand)
-    {
-        this->type = "Return";
-        this->token = token;
-        this->operand = operand;
-    }
-    virtual ~Return() {}
+    Return(int op, string_view value, Expression* operand)
+        : UnaryOperation(op, value, operand, NodeKind::Return)
+    {}
 };
 
 struct BinaryOperation : Operation
 {
-    BinaryOperation(Token token, Expression* left=0, Expression* right=0)
-        : Operation(token)
+    BinaryOperation(const Operation & op, Expression* left=0, Expression* right=0,
+                    NodeKind kind=NodeKind::BinaryOperation)
+        : Operation(kind, op.op, op.value)
     {
-        this->type = "Binary Operation";
-        this->token = token;
         this->left = left;
         this->right = right;
     }
-    virtual ~BinaryOperation() {}
+    Expression* left;
+    Expression* right;
 };
 
 struct Addition : BinaryOperation
 {
-    Addition(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Addition";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~Addition() {}
+    Addition(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::Addition)
+    {}
 };
 
 struct Subtraction : BinaryOperation
 {
-    Subtraction(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Subtraction";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~Subtraction() {}
+    Subtraction(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::Subtraction)
+    {}
 };
 
 struct Multiplication : BinaryOperation
 {
-    Multiplication(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Multiplication";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~Multiplication() {}
+    Multiplication(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::Multiplication)
+    {}
 };
 
 struct Division : BinaryOperation
 {
-    Division(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Division";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~Division() {}
+    Division(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::Division)
+    {}
 };
 
 struct BitwiseAnd : BinaryOperation
 {
-    BitwiseAnd(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Bitwise And";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~BitwiseAnd() {}
+    BitwiseAnd(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::BitwiseAnd)
+    {}
 };
 
 struct BitwiseOr : BinaryOperation
 {
-    BitwiseOr(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Bitwise Or";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~BitwiseOr() {}
+    BitwiseOr(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::BitwiseOr)
+    {}
 };
 
 struct BitwiseLeft : BinaryOperation
 {
-    BitwiseLeft(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Bitwise Left";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~BitwiseLeft() {}
+    BitwiseLeft(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::BitwiseLeft)
+    {}
 };
 
 struct BitwiseRight : BinaryOperation
 {
-    BitwiseRight(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Bitwise Right";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~BitwiseRight() {}
+    BitwiseRight(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::BitwiseRight)
+    {}
 };
 
 struct CompareLT : BinaryOperation
 {
-    CompareLT(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Compare LT";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~CompareLT() {}
+    CompareLT(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::CompareLT)
+    {}
 };
 
 struct CompareLTE : BinaryOperation
 {
-    CompareLTE(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Compare LTE";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~CompareLTE() {}
+    CompareLTE(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::CompareLTE)
+    {}
 };
 
 struct CompareGT : BinaryOperation
 {
-    CompareGT(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Compare GT";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~CompareGT() {}
+    CompareGT(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::CompareGT)
+    {}
 };
 
 struct CompareGTE : BinaryOperation
 {
-    CompareGTE(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Compare GTE";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~CompareGTE() {}
+    CompareGTE(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::CompareGTE)
+    {}
+};
+
+struct CompareEQ : BinaryOperation
+{
+    CompareEQ(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::CompareEQ)
+    {}
+};
+
+struct LogicalAnd : BinaryOperation
+{
+    LogicalAnd(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::LogicalAnd)
+    {}
+};
+
+struct LogicalOr : BinaryOperation
+{
+    LogicalOr(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::LogicalOr)
+    {}
 };
 
 struct Assignment : BinaryOperation
 {
-    Assignment(Token token, Expression* left=0, Expression* right=0)
-        : BinaryOperation(token, left, right)
-    {
-        this->type = "Assignment";
-        this->token = token;
-        this->left = left;
-        this->right = right;
-    }
-    virtual ~Assignment() {}
+    Assignment(const Operation & op, Expression* left=0, Expression* right=0)
+        : BinaryOperation(op, left, right, NodeKind::Assignment)
+    {}
 };
 
 struct ExpressionGroup : Expression
 {
-    ExpressionGroup(Token start, Token end, Expression* inner)
-        :Expression()
+    ExpressionGroup(Expression* inner)
+        : Expression(NodeKind::ExpressionGroup)
     {
-        this->type = "Expression Group";
-        this->start = start;
-        this->end = end;
         this->inner = inner;
     }
-    virtual ~ExpressionGroup() {}
-    Token start;
-    Token end;
+    Expression* inner;
 };
 
-struct Statement : Node
+struct Statement
 {
-    Statement() {}
-    virtual ~Statement() {}
-    bool isEmpty() { return outer == NULL; }
+    bool isEmpty() const { return outer == NULL; }
     Expression* outer = NULL;
 };
 
 struct Block : Expression
 {
-    Block(vector<Statement> statements={})
+    Block(ArenaList<Statement> statements={})
+        : Expression(NodeKind::Block)
     {
-        this->type = "Block";
         this->statements = statements;
     }
-    virtual ~Block() {}
+    ArenaList<Statement> statements;
 };
 
-struct Parameter : Node
+struct Parameter
 {
-    Parameter(string paramType, string paramName, string defaultValue="")
-        : Node()
-    {
-        this->type = "Parameter";
-        this->token = token;
-        this->paramType = paramType;
-        this->paramName = paramName;
-        this->defaultValue = defaultValue;
-    }
-    virtual ~Parameter() {}
-    string paramType;
-    string paramName;
-    string defaultValue;
+    SymbolId paramType;
+    SymbolId paramName;
 };
 
 struct ParamList : Expression
 {
-    ParamList(Token start, Token end, vector<Parameter> params)
+    ParamList(ArenaList<Parameter> params)
+        : Expression(NodeKind::ParamList)
     {
-        this->type = "Parameter List";
-        this->start = start;
-        this->end = end;
         this->params = params;
     }
-    virtual ~ParamList() {}
-    Token start;
-    Token end;
+    ArenaList<Parameter> params;
 };
 
 struct Lambda : Expression
 {
-    Lambda(Token token, ParamList* paramList, Block* block)
-        : Expression()
+    Lambda(ParamList* paramList, Block* block)
+        : Expression(NodeKind::Lambda)
     {
-        this->type = "Lambda";
-        this->token = token;
         this->paramList = paramList;
         this->block = block;
     }
-    virtual ~Lambda()
-    {
-        delete block;
-        delete paramList;
-    }
+    ParamList* paramList;
+    Block* block;
 };
 
 struct Function : Expression
 {
-    Function(Token typeToken, Token nameToken, Lambda* lambda) : Expression()
+    Function(SymbolId returnType, SymbolId functionName, Lambda* lambda)
+        : Expression(NodeKind::Function)
     {
-        this->type = "Function";
-        this->typeToken = typeToken;
-        this->nameToken = nameToken;
+        this->returnType = returnType;
+        this->functionName = functionName;
         this->lambda = lambda;
-        this->returnType = typeToken.value;
-        this->functionName = nameToken.value;
         this->block = lambda->block;
     }
-    virtual ~Function()
-    {
-        delete lambda;
-    }
-    Token typeToken;
-    Token nameToken;
+    SymbolId returnType;
+    SymbolId functionName;
+    Lambda* lambda;
+    Block* block;
 };
 
 struct FunctionDefinition : Expression
 {
-    FunctionDefinition(Function* function) : Expression()
+    FunctionDefinition(Function* function)
+        : Expression(NodeKind::FunctionDefinition)
     {
-        this->type = "Function Definition";
-        this->function = (Expression*) function;
+        this->function = function;
+    }
+    Function* function;
+};
+
+Children Node::children()
+{
+    switch (kind)
+    {
+        case NodeKind::VariableDeclaration:
+        case NodeKind::UnaryOperation:
+        case NodeKind::Return:
+        case NodeKind::ExpressionGroup:
+        case NodeKind::Function:
+        case NodeKind::FunctionDefinition:
+            return { this, 1 };
+        case NodeKind::Lambda:
+            return { this, 2 };
+        case NodeKind::Block:
+            return { this, as<Block>()->statements.count };
+        default:
+            return { this, isBinaryOperation(kind) ? 2u : 0u };
     }
-    virtual ~FunctionDefinition()
+}
+
+Node* Children::at(uint32_t i) const
+{
+    assert(i < count);
+    switch (node->kind)
+    {
+        case NodeKind::VariableDeclaration: return node->as<VariableDeclaration>()->variable;
+        case NodeKind::UnaryOperation:
+        case NodeKind::Return: return node->as<UnaryOperation>()->operand;
+        case NodeKind::ExpressionGroup: return node->as<ExpressionGroup>()->inner;
+        case NodeKind::Function: return node->as<Function>()->lambda;
+        case NodeKind::FunctionDefinition: return node->as<FunctionDefinition>()->function;
+        case NodeKind::Block: return node->as<Block>()->statements[i].outer;
+        case NodeKind::Lambda:
+        {
+            auto lambda = node->as<Lambda>();
+            return i == 0 ? (Node*) lambda->paramList : (Node*) lambda->block;
+        }
+        default:
+        {
+            auto operation = node->as<BinaryOperation>();
+            return i == 0 ? operation->left : operation->right;
+        }
+    }
+}
+
+// Gets the first non-empty child of `node` from slot `slot`, or NULL.
+Node* childFrom(Node* node, uint32_t slot)
+{
+    auto children = node->children();
+    for (uint32_t i = slot; i < children.size(); i++)
     {
-        delete function;
+        if (auto child = children[i])
+            return child;
     }
-};
+    return nullptr;
+}
+
+/**
+ * A parsed source: the root block, the symbols it names, and the arena
+ * owning every node, freed with the AST. An AST can be moved but not
+ * copied; node text may view the source, which must outlive it.
+ */
 
 struct AST
 {
-    AST() {}
-    virtual ~AST() {}
+    AST()
+        : arena(make_unique<Arena>())
+    {}
+
+    // Drops the tree, keeping the first block of the arena to parse the
+    // next one into.
+    void reset()
+    {
+        root = Block();
+        arena->reset();
+    }
+
     Block root;
+    shared_ptr<const Interner> symbols;
+    unique_ptr<Arena> arena;
 };
 
-class Parser
+/**
+ * How a binary operator binds: operators of higher precedence bind
+ * tighter, and right associative ones group to the right. Tokens that
+ * are not binary operators have precedence 0.
+ */
+
+struct Binding
+{
+    int precedence;
+    bool rightAssociative;
+    NodeKind kind;
+};
+
+// Gets the binding of a token of `type`, following C.
+constexpr Binding makeBinding(int type)
+{
+    switch (type)
+    {
+        case cream::token::ASSIGN:        return { 1, true, NodeKind::Assignment };
+        case cream::token::LOGICAL_OR:    return { 2, false, NodeKind::LogicalOr };
+        case cream::token::LOGICAL_AND:   return { 3, false, NodeKind::LogicalAnd };
+        case cream::token::BITWISE_OR:    return { 4, false, NodeKind::BitwiseOr };
+        case cream::token::BITWISE_AND:   return { 5, false, NodeKind::BitwiseAnd };
+        case cream::token::COMPARE_EQ:    return { 6, false, NodeKind::CompareEQ };
+        case cream::token::COMPARE_LT:    return { 7, false, NodeKind::CompareLT };
+        case cream::token::COMPARE_LTE:   return { 7, false, NodeKind::CompareLTE };
+        case cream::token::COMPARE_GT:    return { 7, false, NodeKind::CompareGT };
+        case cream::token::COMPARE_GTE:   return { 7, false, NodeKind::CompareGTE };
+        case cream::token::BITWISE_LEFT:  return { 8, false, NodeKind::BitwiseLeft };
+        case cream::token::BITWISE_RIGHT: return { 8, false, NodeKind::BitwiseRight };
+        case cream::token::OP_ADD:        return { 9, false, NodeKind::Addition };
+        case cream::token::OP_SUBTRACT:   return { 9, false, NodeKind::Subtraction };
+        case cream::token::OP_MULTIPLY:   return { 10, false, NodeKind::Multiplication };
+        case cream::token::OP_DIVIDE:     return { 10, false, NodeKind::Division };
+        default:                          return { 0, false, NodeKind::BinaryOperation };
+    }
+}
+
+/**
+ * Bindings of every token type, built at compile time.
+ */
+
+struct BindingTable
+{
+    Binding bindings[cream::token::UNKNOWN + 1] {};
+};
+
+constexpr BindingTable makeBindingTable()
+{
+    BindingTable table;
+    for (int type = 0; type <= cream::token::UNKNOWN; type++)
+        table.bindings[type] = makeBinding(type);
+    return table;
+}
+
+constexpr BindingTable bindings = makeBindingTable();
+
+// Gets the binding of a token of `type`.
+constexpr Binding bindingFor(int type)
+{
+    return (type >= 0 && type <= cream::token::UNKNOWN)
+        ? bindings.bindings[type] : Binding { 0, false, NodeKind::BinaryOperation };
+}
+
+static_assert(bindingFor(cream::token::OP_MULTIPLY).precedence > bindingFor(cream::token::OP_ADD).precedence,
+              "Multiplication binds tighter than addition");
+static_assert(bindingFor(cream::token::ASSIGN).rightAssociative, "Assignment groups to the right");
+
+// Gets the position of the token at `token`, or none when implicit.
+SourceSpan spanAt(const Token* token)
+{
+    return { token->meta.line, token->meta.column };
+}
+
+SourceSpan spanAt(StreamCursor cursor)
+{
+    return cursor.span();
+}
+
+/**
+ * Parses the tokens read through `TokenIter` into statements: pointers
+ * into a buffer of Token views, or cursors into the columns of a
+ * TokenStream. The pairs of the tokens must be linked.
+ */
+
+template <typename TokenIter>
+class TokenParser
 {
 public:
-    Parser()
-    {}
+    /**
+     * A range of tokens, viewed without copying them.
+     */
 
-    AST parse(vector<Token> tokens)
+    struct Tokens
     {
-        AST ast;
-        ast.root = parseBlock(tokens);
-        return ast;
+        TokenIter first;
+        TokenIter last;
+
+        TokenIter begin() const { return first; }
+        TokenIter end() const { return last; }
+    };
+
+    // Parses with an explicit stack instead of recursion.
+    bool iterative = false;
+
+    // Where errors are reported when recovering from them, or NULL to
+    // throw the first.
+    Diagnostics* diagnostics = nullptr;
+
+    // Arena of the AST being parsed
+    Arena* arena = nullptr;
+
+    // Parses top-level statements, in the mode selected.
+    vector<Statement> parseTopLevel(Tokens tokens)
+    {
+        return iterative ? parseIteratively(tokens) : parseStatements(tokens);
     }
 
-    Block parseBlock(vector<Token> tokens)
+    Block parseBlock(Tokens tokens)
     {
-        Block block;
-        block.statements = parseStatements(tokens);
-        return block;
+        return Block(arena->copy(parseStatements(tokens)));
     }
 
-    vector<Statement> parseStatements(vector<Token> tokens)
+    vector<Statement> parseStatements(Tokens tokens)
     {
         vector<Statement> statements;
         for (auto iter = tokens.begin(); iter != tokens.end(); iter++)
         {
-            // Process statement tokens
-            vector<Token> statementTokens;
-            while (iter->type != cream::token::NEWLINE && iter != tokens.end())
+            auto start = iter;
+            iter = statementEnd(iter, tokens.end());
+            try
             {
-                Token token = *iter;
-                if (token.type == cream::token::BLOCK_START)
-                {
-                    // Add block start
-                    auto blockStart = iter;
-                    statementTokens.push_back(*blockStart);
-                    iter++;
-
-                    // Add inner tokens
-                    while (iter->meta.position != blockStart->pair.end)
-                    {
-                        auto inner = iter;
-                        statementTokens.push_back(*inner);
-                        iter++;
-                    }
-
-                    // Add block end
-                    auto blockEnd = iter;
-                    statementTokens.push_back(*blockEnd);
-                    iter++;
-                }
-                else
-                {
-                    // Add token
-                    statementTokens.push_back(token);
-                    iter++;
-                }
+                Statement statement = parseStatement({ start, iter });
+                statements.push_back(statement);
+            }
+            catch (CreamError& e)
+            {
+                if (!diagnostics)
+                    throw;
+                diagnostics->error(spanOf(e, { start, iter }), e.what());
             }
-            Statement statement = parseStatement(statementTokens);
-            statements.push_back(statement);
 
             // Break after last token
             if (iter == tokens.end())
@@ -548,7 +730,7 @@ public:
         return statements;
     }
 
-    Statement parseStatement(vector<Token> tokens)
+    Statement parseStatement(Tokens tokens)
     {
         Statement statement;
         auto expression = parseExpression(tokens);
@@ -556,24 +738,23 @@ public:
         return statement;
     }
 
-    Expression* parseExpression(vector<Token> tokens)
+    Expression* parseExpression(Tokens tokens)
     {
-        auto expressions = parseTokens(tokens);
-        processOperations(expressions);
-        processFunctions(expressions);
-
-        if (expressions.size() > 1)
-            throw CreamError("Expect only one top level expression");
-
-        if (expressions.size() == 0)
+        auto iter = tokens.begin();
+        auto end = tokens.end();
+        skipIgnored(iter, end);
+        if (iter == end)
             return NULL;
 
-        auto topExpression = expressions.front();
-        return topExpression;
+        auto expression = parseOperations(iter, end, 1);
+        skipIgnored(iter, end);
+        if (iter != end)
+            throw errorAt(iter, "Expect only one top level expression");
+        return expression;
     }
 
     // Parses parameter list given the inner tokens.
-    vector<Parameter> parseParams(vector<Token> paramTokens)
+    vector<Parameter> parseParams(Tokens paramTokens)
     {
         vector<Parameter> params;
         for (auto iter = paramTokens.begin(); iter != paramTokens.end(); iter++)
@@ -581,8 +762,12 @@ public:
             auto type = iter;
             auto name = iter + 1;
             auto comma = iter + 2;
+            if (type->symbol == interner::noSymbol)
+                throw errorAt(type, "Expect a parameter type before '" + string(type->value) + "'");
+            if (name == paramTokens.end() || name->symbol == interner::noSymbol)
+                throw errorAt(type, "Expect a name for parameter '" + string(type->value) + "'");
 
-            Parameter param(type->value, name->value);
+            Parameter param { type->symbol, name->symbol };
             params.push_back(param);
 
             if (comma == paramTokens.end())
@@ -593,274 +778,770 @@ public:
         return params;
     }
 
-    // Creates list of expression objects for given tokens.
-    list<Expression*> parseTokens(vector<Token> tokens)
+    // Parses operations binding at least as tightly as `minPrecedence`,
+    // by precedence climbing.
+    Expression* parseOperations(TokenIter & iter, TokenIter end, int minPrecedence)
     {
-        list<Expression*> expressions;
-        for (auto iter = tokens.begin(); iter != tokens.end(); iter++)
+        auto left = parsePrimary(iter, end);
+        while (true)
         {
-            Token token = *iter;
-            Expression* expression = NULL;
+            skipIgnored(iter, end);
+            if (iter == end)
+                break;
+            auto binding = bindingFor(iter->type);
+            if (binding.precedence == 0 || binding.precedence < minPrecedence)
+                break;
 
-            if (token.type == cream::token::BLOCK_START)
-            {
-                auto start = iter;
-                auto blockTokens = Pair::innerTokens(start);
-                auto block = parseBlock(blockTokens);
-                expression = new Block(block);
-                Pair::seekToEnd(iter);
-            }
-            else if (token.type == cream::token::EXPRESSION_START)
+            auto operatorToken = iter;
+            Operation operation(NodeKind::Operation, iter->type, iter->value);
+            iter++;
+            skipIgnored(iter, end);
+            if (iter == end)
+                throw errorAt(operatorToken, "Expect an expression after '" + string(operation.value) + "'");
+
+            auto next = binding.rightAssociative ? binding.precedence : binding.precedence + 1;
+            auto right = parseOperations(iter, end, next);
+            left = makeOperation(binding.kind, operation, left, right);
+        }
+        return left;
+    }
+
+    // Parses the expression at `iter`, leaving `iter` after it.
+    Expression* parsePrimary(TokenIter & iter, TokenIter end)
+    {
+        auto token = *iter;
+        Expression* expression = NULL;
+
+        if (token.type == cream::token::BLOCK_START)
+        {
+            auto close = closing(iter, end);
+            auto block = parseBlock({ iter + 1, close });
+            expression = arena->make<Block>(block);
+            iter = close + 1;
+        }
+        else if (token.type == cream::token::EXPRESSION_START)
+        {
+            auto close = closing(iter, end);
+            auto innerExpression = parseExpression({ iter + 1, close });
+            expression = arena->make<ExpressionGroup>(innerExpression);
+            iter = close + 1;
+        }
+        else if (token.type == cream::token::PARAMS_START)
+        {
+            expression = parseLambda(iter, end);
+        }
+        else if (token.type == cream::token::NUMBER)
+        {
+            expression = arena->make<Number>(token.value);
+            iter++;
+        }
+        else if (token.type == cream::token::STRING)
+        {
+            expression = arena->make<String>(token.value);
+            iter++;
+        }
+        else if (token.type == cream::token::TYPE)
+        {
+            auto next = iter + 1;
+            if (next == end)
+                throw errorAt(iter, "Expect a name after type '" + string(token.value) + "'");
+
+            // Variable Declaration
+            auto typeToken = *iter;
+            auto nameToken = *next;
+            auto variable = arena->make<Variable>(typeToken.symbol, nameToken.symbol);
+            auto text = string(typeToken.value) + " " + string(nameToken.value);
+            expression = arena->make<VariableDeclaration>(variable, arena->save(text));
+            iter = next + 1;
+
+            // Function Definition
+            if (iter != end && iter->type == cream::token::PARAMS_START)
             {
-                auto start = iter;
-                auto end = Pair::endFor(start);
-                auto innerTokens = Pair::innerTokens(start);
-                auto innerExpression = parseExpression(innerTokens);
-                expression = new ExpressionGroup(*start, *end, innerExpression);
-                Pair::seekToEnd(iter);
+                auto lambda = parseLambda(iter, end);
+                auto function = arena->make<Function>(variable->varType, variable->varName, lambda);
+                expression = arena->make<FunctionDefinition>(function);
             }
-            else if (token.type == cream::token::PARAMS_START)
+        }
+        else if (token.type == cream::token::IDENTIFIER)
+        {
+            expression = arena->make<Identifier>(token.value, token.symbol);
+            iter++;
+        }
+        else if (token.type == cream::token::KEYWORD && token.symbol == interner::SYMBOL_RETURN)
+        {
+            auto start = iter + 1;
+            if (start == end || start->type != cream::token::EXPRESSION_START)
+                throw errorAt(iter, "Expect an expression after 'return'");
+            auto close = closing(start, end);
+            auto operand = parseExpression({ start + 1, close });
+            if (!operand)
+                throw errorAt(iter, "Expect an expression after 'return'");
+            expression = arena->make<Return>(token.type, token.value, operand);
+            iter = close + 1;
+        }
+        else
+        {
+            throw errorAt(iter, "Expect an expression before '" + string(token.value) + "'");
+        }
+        return expression;
+    }
+
+    // Parses a parameter list, an arrow and a block into a lambda.
+    Lambda* parseLambda(TokenIter & iter, TokenIter end)
+    {
+        auto close = closing(iter, end);
+        auto params = parseParams({ iter + 1, close });
+        auto paramList = arena->make<ParamList>(arena->copy(params));
+        iter = close + 1;
+
+        skipIgnored(iter, end);
+        if (iter == end || iter->type != cream::token::ARROW)
+            throw errorAt(close, "Expect '->' after parameters");
+        auto arrow = iter++;
+        skipIgnored(iter, end);
+        if (iter == end || iter->type != cream::token::BLOCK_START)
+            throw errorAt(arrow, "Expect a block after '->'");
+        auto block = (Block*) parsePrimary(iter, end);
+        return arena->make<Lambda>(paramList, block);
+    }
+
+    // Creates the operation of `kind` on `left` and `right`.
+    Expression* makeOperation(NodeKind kind, const Operation & operation, Expression* left, Expression* right)
+    {
+        switch (kind)
+        {
+            case NodeKind::Addition: return arena->make<Addition>(operation, left, right);
+            case NodeKind::Subtraction: return arena->make<Subtraction>(operation, left, right);
+            case NodeKind::Multiplication: return arena->make<Multiplication>(operation, left, right);
+            case NodeKind::Division: return arena->make<Division>(operation, left, right);
+            case NodeKind::BitwiseAnd: return arena->make<BitwiseAnd>(operation, left, right);
+            case NodeKind::BitwiseOr: return arena->make<BitwiseOr>(operation, left, right);
+            case NodeKind::BitwiseLeft: return arena->make<BitwiseLeft>(operation, left, right);
+            case NodeKind::BitwiseRight: return arena->make<BitwiseRight>(operation, left, right);
+            case NodeKind::CompareEQ: return arena->make<CompareEQ>(operation, left, right);
+            case NodeKind::CompareLT: return arena->make<CompareLT>(operation, left, right);
+            case NodeKind::CompareLTE: return arena->make<CompareLTE>(operation, left, right);
+            case NodeKind::CompareGT: return arena->make<CompareGT>(operation, left, right);
+            case NodeKind::CompareGTE: return arena->make<CompareGTE>(operation, left, right);
+            case NodeKind::LogicalAnd: return arena->make<LogicalAnd>(operation, left, right);
+            case NodeKind::LogicalOr: return arena->make<LogicalOr>(operation, left, right);
+            case NodeKind::Assignment: return arena->make<Assignment>(operation, left, right);
+            default: return arena->make<BinaryOperation>(operation, left, right);
+        }
+    }
+
+    // Skips whitespace, keywords with no expression, and unknown tokens.
+    void skipIgnored(TokenIter & iter, TokenIter end)
+    {
+        for (; iter != end; iter++)
+        {
+            auto type = iter->type;
+            if (type == cream::token::WHITESPACE)
+                continue;
+            if (type == cream::token::KEYWORD && iter->symbol != interner::SYMBOL_RETURN)
+                continue;
+            if (isExpressionStart(type) || bindingFor(type).precedence)
+                break;
+            if (diagnostics)
             {
-                auto start = iter;
-                auto end = Pair::endFor(start);
-                auto innerTokens = Pair::innerTokens(start);
-                auto params = parseParams(innerTokens);
-                expression = new ParamList(*start, *end, params);
-                Pair::seekToEnd(iter);
+                diagnostics->warning(spanAt(iter),
+                                     "Skipping unknown token during parse: '" + string(iter->value) + "'");
             }
-            else if (token.type == cream::token::ARROW)
+            else
             {
-                expression = new Operation(token);
+                cerr << "Skipping unknown token during parse: '"
+                     << iter->value << "'" << endl;
             }
-            else if (token.type == cream::token::NUMBER)
+        }
+    }
+
+    // Gets the position of the first source token in `tokens`.
+    static SourceSpan spanOf(Tokens tokens)
+    {
+        for (auto iter = tokens.begin(); iter != tokens.end(); iter++)
+        {
+            auto span = spanAt(iter);
+            if (span.line)
+                return span;
+        }
+        return {};
+    }
+
+    // Gets the position of `error`, or of the statement `tokens` holding
+    // it when the error has none.
+    static SourceSpan spanOf(const CreamError & error, Tokens tokens)
+    {
+        return error.span.line ? error.span : spanOf(tokens);
+    }
+
+    // Makes an error at `token`, which has no position when implicit.
+    static CreamError errorAt(TokenIter token, const string & message)
+    {
+        return CreamError(message, spanAt(token));
+    }
+
+    // Gets the end of the statement at `iter`: the next newline past any
+    // blocks, or `end` when a block is not closed before it.
+    static TokenIter statementEnd(TokenIter iter, TokenIter end)
+    {
+        while (iter != end && iter->type != cream::token::NEWLINE)
+        {
+            if (iter->type == cream::token::BLOCK_START)
             {
-                expression = new Number(token.value);
+                if (!closesWithin(iter, end))
+                    return end;
+                iter += iter->partner;
             }
-            else if (token.type == cream::token::STRING)
+            iter++;
+        }
+        return iter;
+    }
+
+    // Gets the token closing the pair at `start`.
+    static TokenIter closing(TokenIter start, TokenIter end)
+    {
+        if (!closesWithin(start, end))
+            throw errorAt(start, "Unclosed '" + string(start->value) + "'");
+        return start + start->partner;
+    }
+
+    // Checks whether the pair at `start` is linked and closes before
+    // `end`. Pairs of an unbalanced source may be unlinked, or cross.
+    static bool closesWithin(TokenIter start, TokenIter end)
+    {
+        return start->partner > 0 && start->partner < end - start;
+    }
+
+    // Checks whether a token of `type` can start an expression.
+    static bool isExpressionStart(int type)
+    {
+        switch (type)
+        {
+            case cream::token::BLOCK_START:
+            case cream::token::EXPRESSION_START:
+            case cream::token::PARAMS_START:
+            case cream::token::NUMBER:
+            case cream::token::STRING:
+            case cream::token::TYPE:
+            case cream::token::IDENTIFIER:
+            case cream::token::KEYWORD:
+            case cream::token::ARROW:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Parses statements as `parseStatements` does, with a stack of frames
+    // on the heap in place of recursion. Operations are built with operand
+    // and operator stacks, giving the trees precedence climbing gives.
+    vector<Statement> parseIteratively(Tokens tokens)
+    {
+        frames.clear();
+        statements.clear();
+        operands.clear();
+        operators.clear();
+        pushStatements(tokens, Then::Done);
+
+        while (true)
+        {
+            try
             {
-                expression = new String(token);
+                return parseFrames();
             }
-            else if (token.type == cream::token::TYPE)
+            catch (CreamError& e)
             {
-                auto next = iter; next++;
-
-                // Variable Declaration
-                auto typeToken = *iter;
-                auto nameToken = *next;
-                auto variable = new Variable(typeToken, nameToken);
-                expression = new VariableDeclaration(variable);
-                iter = next;
+                if (!diagnostics)
+                    throw;
+                skipStatement(e);
             }
-            else if (token.type == cream::token::IDENTIFIER)
+        }
+    }
+
+    // Parses the frames on the stack until the top-level statements are
+    // done.
+    vector<Statement> parseFrames()
+    {
+        while (true)
+        {
+            auto& frame = frames.back();
+            if (frame.kind == FrameKind::Statements)
             {
-                expression = new Identifier(token.value);
+                if (frame.iter != frame.end)
+                {
+                    // Parse the next statement
+                    auto start = frame.iter;
+                    auto iter = statementEnd(start, frame.end);
+                    frame.iter = iter == frame.end ? iter : iter + 1;
+                    pushExpression({ start, iter }, Then::Statement);
+                    continue;
+                }
+
+                // Finish the block
+                vector<Statement> list(statements.begin() + frame.statementBase, statements.end());
+                if (frame.then == Then::Done)
+                {
+                    frames.pop_back();
+                    return list;
+                }
+                auto block = arena->make<Block>(arena->copy(list));
+                auto done = frame;
+                statements.resize(done.statementBase);
+                frames.pop_back();
+                finishBlock(done, block);
+                continue;
             }
-            else if (token.type == cream::token::KEYWORD)
+
+            skipIgnored(frame.iter, frame.end);
+            if (frame.expectOperand)
             {
-                if (token.name == "Return")
+                if (frame.iter == frame.end)
                 {
-                    auto next = iter; next++;
-                    auto start = next;
-                    auto operandTokens = Pair::innerTokens(start);
-                    auto operand = parseExpression(operandTokens);
-                    expression = new Return(token, operand);
-                    Pair::seekToEnd(iter, &start->pair);
+                    // Only an empty expression ends before an operand
+                    auto done = frame;
+                    frames.pop_back();
+                    finishExpression(done, NULL);
                 }
+                else
+                {
+                    stepOperand(frame);
+                }
+                continue;
             }
-            else if (token.type == cream::token::ASSIGN ||
-                     token.type == cream::token::OP_ADD ||
-                     token.type == cream::token::OP_SUBTRACT ||
-                     token.type == cream::token::OP_MULTIPLY ||
-                     token.type == cream::token::OP_DIVIDE ||
-                     token.type == cream::token::BITWISE_AND ||
-                     token.type == cream::token::BITWISE_OR ||
-                     token.type == cream::token::BITWISE_LEFT ||
-                     token.type == cream::token::BITWISE_RIGHT ||
-                     token.type == cream::token::COMPARE_LT ||
-                     token.type == cream::token::COMPARE_LTE ||
-                     token.type == cream::token::COMPARE_GT ||
-                     token.type == cream::token::COMPARE_GTE
-                     )
+
+            auto binding = frame.iter == frame.end ? Binding { 0 } : bindingFor(frame.iter->type);
+            if (binding.precedence == 0)
             {
-                expression = new Operation(token);
+                if (frame.iter != frame.end)
+                    throw errorAt(frame.iter, "Expect only one top level expression");
+
+                // Finish the expression
+                while (operators.size() > frame.operatorBase)
+                    reduceOperation();
+                auto expression = operands.back();
+                operands.pop_back();
+                auto done = frame;
+                frames.pop_back();
+                finishExpression(done, expression);
+                continue;
             }
-            else if (token.type == cream::token::WHITESPACE)
+
+            // Build operations binding tighter, or as tight and grouping left
+            while (operators.size() > frame.operatorBase)
             {
-                continue;
+                auto top = bindingFor(operators.back()->type);
+                if (top.precedence < binding.precedence ||
+                    (top.precedence == binding.precedence && binding.rightAssociative))
+                    break;
+                reduceOperation();
             }
-            else
+            operators.push_back(frame.iter);
+            frame.iter++;
+            skipIgnored(frame.iter, frame.end);
+            if (frame.iter == frame.end)
+                throw errorAt(operators.back(), "Expect an expression after '" + string(operators.back()->value) + "'");
+            frame.expectOperand = true;
+        }
+    }
+
+private:
+    /**
+     * What a finished frame's result is for.
+     */
+
+    enum class Then : uint8_t
+    {
+        Done,       // the top-level statements
+        Statement,  // a statement of the block below
+        Operand,    // an operand of the expression below
+        Group,      // the inner expression of a group
+        Return,     // the operand of a return
+        Lambda,     // the block of a lambda
+    };
+
+    enum class FrameKind : uint8_t
+    {
+        Statements,
+        Expression,
+    };
+
+    /**
+     * A block or expression being parsed iteratively. Statements, operands
+     * and operators are kept on stacks shared by every frame, from the
+     * bases recorded when the frame was pushed.
+     */
+
+    struct Frame
+    {
+        FrameKind kind;
+        Then then;
+        bool expectOperand = true;
+        TokenIter iter;
+        TokenIter end;
+        size_t statementBase = 0;
+        size_t operandBase = 0;
+        size_t operatorBase = 0;
+
+        // The first token, to report errors in the frame
+        TokenIter start {};
+
+        // The return token, or the lambda's params and any function variable
+        TokenIter token {};
+        ParamList* paramList = nullptr;
+        Variable* variable = nullptr;
+    };
+
+    // Pushes a frame parsing the statements of `tokens`.
+    Frame& pushStatements(Tokens tokens, Then then)
+    {
+        Frame frame;
+        frame.kind = FrameKind::Statements;
+        frame.then = then;
+        frame.iter = tokens.begin();
+        frame.end = tokens.end();
+        frame.statementBase = statements.size();
+        frames.push_back(frame);
+        return frames.back();
+    }
+
+    // Pushes a frame parsing the expression of `tokens`.
+    Frame& pushExpression(Tokens tokens, Then then)
+    {
+        Frame frame;
+        frame.kind = FrameKind::Expression;
+        frame.then = then;
+        frame.start = tokens.begin();
+        frame.iter = tokens.begin();
+        frame.end = tokens.end();
+        frame.operandBase = operands.size();
+        frame.operatorBase = operators.size();
+        frames.push_back(frame);
+        return frames.back();
+    }
+
+    // Reads the operand at the frame's position, pushing a frame for it
+    // when it nests.
+    void stepOperand(Frame & frame)
+    {
+        auto iter = frame.iter;
+        auto token = *iter;
+        frame.expectOperand = false;
+
+        if (token.type == cream::token::BLOCK_START)
+        {
+            auto close = closing(iter, frame.end);
+            frame.iter = close + 1;
+            pushStatements({ iter + 1, close }, Then::Operand);
+        }
+        else if (token.type == cream::token::EXPRESSION_START)
+        {
+            auto close = closing(iter, frame.end);
+            frame.iter = close + 1;
+            pushExpression({ iter + 1, close }, Then::Group);
+        }
+        else if (token.type == cream::token::PARAMS_START)
+        {
+            pushLambda(frame, nullptr);
+        }
+        else if (token.type == cream::token::NUMBER)
+        {
+            operands.push_back(arena->make<Number>(token.value));
+            frame.iter++;
+        }
+        else if (token.type == cream::token::STRING)
+        {
+            operands.push_back(arena->make<String>(token.value));
+            frame.iter++;
+        }
+        else if (token.type == cream::token::TYPE)
+        {
+            auto next = iter + 1;
+            if (next == frame.end)
+                throw errorAt(iter, "Expect a name after type '" + string(token.value) + "'");
+
+            // Variable Declaration, or a Function Definition with a lambda
+            auto variable = arena->make<Variable>(token.symbol, next->symbol);
+            frame.iter = next + 1;
+            if (frame.iter != frame.end && frame.iter->type == cream::token::PARAMS_START)
             {
-                cerr << "Skipping unknown token during parse: '"
-                     << token.value << "'" << endl;
-                continue;
+                pushLambda(frame, variable);
+                return;
             }
+            auto text = string(token.value) + " " + string(next->value);
+            operands.push_back(arena->make<VariableDeclaration>(variable, arena->save(text)));
+        }
+        else if (token.type == cream::token::IDENTIFIER)
+        {
+            operands.push_back(arena->make<Identifier>(token.value, token.symbol));
+            frame.iter++;
+        }
+        else if (token.type == cream::token::KEYWORD && token.symbol == interner::SYMBOL_RETURN)
+        {
+            auto start = iter + 1;
+            if (start == frame.end || start->type != cream::token::EXPRESSION_START)
+                throw errorAt(iter, "Expect an expression after 'return'");
+            auto close = closing(start, frame.end);
+            frame.iter = close + 1;
+            pushExpression({ start + 1, close }, Then::Return).token = iter;
+        }
+        else
+        {
+            throw errorAt(iter, "Expect an expression before '" + string(token.value) + "'");
+        }
+    }
+
+    // Reads the params and arrow of a lambda at the frame's position, and
+    // pushes a frame for its block.
+    void pushLambda(Frame & frame, Variable* variable)
+    {
+        auto start = frame.iter;
+        auto close = closing(start, frame.end);
+        auto params = parseParams({ start + 1, close });
+        auto paramList = arena->make<ParamList>(arena->copy(params));
+        auto iter = close + 1;
+
+        skipIgnored(iter, frame.end);
+        if (iter == frame.end || iter->type != cream::token::ARROW)
+            throw errorAt(close, "Expect '->' after parameters");
+        auto arrow = iter++;
+        skipIgnored(iter, frame.end);
+        if (iter == frame.end || iter->type != cream::token::BLOCK_START)
+            throw errorAt(arrow, "Expect a block after '->'");
+        auto blockEnd = closing(iter, frame.end);
+        frame.iter = blockEnd + 1;
+
+        auto& block = pushStatements({ iter + 1, blockEnd }, Then::Lambda);
+        block.paramList = paramList;
+        block.variable = variable;
+    }
+
+    // Reports `error` in the statement being parsed, and drops the frames
+    // above the block holding it, to go on from the next statement.
+    void skipStatement(const CreamError & error)
+    {
+        // Errors are only thrown with the expression of a statement on top
+        size_t block = frames.size() - 1;
+        while (frames[block].kind != FrameKind::Statements)
+            block--;
+        auto const& statement = frames[block + 1];
+        diagnostics->error(spanOf(error, { statement.start, statement.end }), error.what());
+        operands.resize(statement.operandBase);
+        operators.resize(statement.operatorBase);
+        frames.resize(block + 1);
+    }
 
-            if (expression != NULL)
-                expressions.push_back(expression);
+    // Hands a finished block to the frame below.
+    void finishBlock(const Frame & done, Block* block)
+    {
+        if (done.then == Then::Operand)
+        {
+            operands.push_back(block);
+            return;
+        }
+
+        Expression* expression = arena->make<Lambda>(done.paramList, block);
+        if (done.variable)
+        {
+            auto function = arena->make<Function>(done.variable->varType, done.variable->varName, (Lambda*) expression);
+            expression = arena->make<FunctionDefinition>(function);
         }
-        return expressions;
+        operands.push_back(expression);
     }
 
-    // Converts operations to their specific types.
-    void processOperations(list<Expression*> &expressions)
+    // Hands a finished expression to the frame below.
+    void finishExpression(const Frame & done, Expression* expression)
     {
-        for (auto iter = expressions.begin(); iter != expressions.end(); iter++)
+        switch (done.then)
         {
-            Expression* expression = *iter;
-            if (expression->type == "Operation")
-            {
-                Operation* operation = (Operation*) expression;
-                auto left = iter; left--;
-                auto right = iter; right++;
+            case Then::Statement:
+                statements.push_back(Statement { expression });
+                break;
+            case Then::Group:
+                operands.push_back(arena->make<ExpressionGroup>(expression));
+                break;
+            case Then::Return:
+                if (!expression)
+                    throw errorAt(done.token, "Expect an expression after 'return'");
+                operands.push_back(arena->make<Return>(done.token->type, done.token->value, expression));
+                break;
+            default:
+                break;
+        }
+    }
 
-                if (operation->token.type == cream::token::ARROW)
-                {
-                    auto paramList = (ParamList*) *left;
-                    auto block = (Block*) *right;
-                    auto lambda = new Lambda(operation->token, paramList, block);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, lambda);
-                }
-                else if (operation->token.type == cream::token::ASSIGN)
-                {
-                    auto assignment = new Assignment(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, assignment);
-                }
-                else if (operation->token.type == cream::token::OP_ADD)
-                {
-                    auto addition = new Addition(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, addition);
-                }
-                else if (operation->token.type == cream::token::OP_SUBTRACT)
-                {
-                    auto subtraction = new Subtraction(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, subtraction);
-                }
-                else if (operation->token.type == cream::token::OP_MULTIPLY)
-                {
-                    auto multiplication = new Multiplication(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, multiplication);
-                }
-                else if (operation->token.type == cream::token::OP_DIVIDE)
-                {
-                    auto division = new Division(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, division);
-                }
-                else if (operation->token.type == cream::token::BITWISE_AND)
-                {
-                    auto bitAnd = new BitwiseAnd(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, bitAnd);
-                }
-                else if (operation->token.type == cream::token::BITWISE_OR)
-                {
-                    auto bitOr = new BitwiseOr(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, bitOr);
-                }
-                else if (operation->token.type == cream::token::BITWISE_LEFT)
-                {
-                    auto bitLeft = new BitwiseLeft(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, bitLeft);
-                }
-                else if (operation->token.type == cream::token::BITWISE_RIGHT)
-                {
-                    auto bitRight = new BitwiseRight(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, bitRight);
-                }
-                else if (operation->token.type == cream::token::COMPARE_LT)
-                {
-                    auto compareLT = new CompareLT(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, compareLT);
-                }
-                else if (operation->token.type == cream::token::COMPARE_LTE)
-                {
-                    auto compareLTE = new CompareLTE(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, compareLTE);
-                }
-                else if (operation->token.type == cream::token::COMPARE_GT)
-                {
-                    auto compareGT = new CompareGT(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, compareGT);
-                }
-                else if (operation->token.type == cream::token::COMPARE_GTE)
-                {
-                    auto compareGTE = new CompareGTE(operation->token, *left, *right);
-                    expressions.erase(left);
-                    expressions.erase(right);
-                    iter = expressions.erase(iter);
-                    expressions.insert(iter, compareGTE);
-                }
+    // Builds the operation on top of the operator stack from the top two
+    // operands.
+    void reduceOperation()
+    {
+        auto token = operators.back();
+        operators.pop_back();
+        auto right = operands.back();
+        operands.pop_back();
+        auto left = operands.back();
+        operands.pop_back();
+        Operation operation(NodeKind::Operation, token->type, token->value);
+        operands.push_back(makeOperation(bindingFor(token->type).kind, operation, left, right));
+    }
+
+    // Stacks of the iterative parser, kept to reuse their memory
+    vector<Frame> frames;
+    vector<Statement> statements;
+    vector<Expression*> operands;
+    vector<TokenIter> operators;
+};
+
+class Parser
+{
+public:
+    // Parses with an explicit stack instead of recursion, so nesting is
+    // limited by memory rather than by the call stack.
+    bool iterative = false;
+
+    // Where errors are reported when recovering from them, or NULL to
+    // throw the first. A statement with an error is reported and left out
+    // of its block, and parsing goes on from the next statement.
+    Diagnostics* diagnostics = nullptr;
+
+    Parser()
+    {}
+
+    AST parse(vector<Token> tokens)
+    {
+        Pair::link(tokens);
+        AST ast;
+        auto& parser = use(tokenParser, ast.arena.get());
+        ast.root = Block(ast.arena->copy(parser.parseTopLevel({ tokens.data(), tokens.data() + tokens.size() })));
+        linkParents(ast.root);
+        return ast;
+    }
+
+    // Parses a stream straight from its columns, by the partners linked
+    // there, building no Token views.
+    AST parse(const TokenStream & stream)
+    {
+        AST ast;
+        ast.symbols = stream.interner;
+        auto& parser = use(streamParser, ast.arena.get());
+        ast.root = Block(ast.arena->copy(parser.parseTopLevel({ stream.begin(), stream.end() })));
+        linkParents(ast.root);
+        return ast;
+    }
+
+    // Parses each top-level statement as soon as it is pulled.
+    AST parse(TokenSource & source)
+    {
+        AST ast;
+        ast.symbols = source.symbols();
+        use(tokenParser, ast.arena.get());
+
+        vector<Statement> statements;
+        vector<Token> statementTokens;
+        while (source.nextStatement(statementTokens))
+        {
+            parseInto(statements, statementTokens.data(), statementTokens.data() + statementTokens.size());
+            statementTokens.clear();
+        }
+        ast.root = Block(ast.arena->copy(statements));
+        linkParents(ast.root);
+        return ast;
+    }
+
+    // Parses the top-level statements of `tokens`, pulled from a source
+    // one at a time with `TokenSource::nextStatement`, where statement
+    // `i` ends at `ends[i]`. Gives the tree `parse(TokenSource&)` gives
+    // for those statements.
+    AST parse(vector<Token> & tokens, const vector<size_t> & ends)
+    {
+        AST ast;
+        parse(tokens, ends, ast);
+        return ast;
+    }
+
+    // Parses statements as above into `ast`, new or reset, so one arena
+    // is reused from one statement of a stream to the next.
+    void parse(vector<Token> & tokens, const vector<size_t> & ends, AST & ast)
+    {
+        use(tokenParser, ast.arena.get());
+
+        vector<Statement> statements;
+        size_t start = 0;
+        for (auto end : ends)
+        {
+            parseInto(statements, tokens.data() + start, tokens.data() + end);
+            start = end;
+        }
+        ast.root = Block(ast.arena->copy(statements));
+        linkParents(ast.root);
+    }
+
+    // Parses tokens into statements appended to `statements`.
+    void parseInto(vector<Statement> & statements, Token* first, Token* last)
+    {
+        Pair::link(first, last);
+        for (auto& statement : tokenParser.parseTopLevel({ first, last }))
+            statements.push_back(statement);
+    }
+
+    // Links the nodes under `root` to their parents. Children of `root`
+    // are left without one, as `root` may move with its AST.
+    void linkParents(Block & root)
+    {
+        auto children = root.children();
+        for (uint32_t i = 0; i < children.size(); i++)
+        {
+            if (auto child = children[i])
+            {
+                child->parent = nullptr;
+                child->slot = i;
+                linkChildren(child);
             }
         }
     }
 
-    // Creates functions for sequences of variable declaration + lambda.
-    void processFunctions(list<Expression*> &expressions)
+    // Links the nodes under `top` to their parents, stepping down through
+    // each node's children once they are linked, and back up through the
+    // links made, so deep trees need no stack.
+    void linkChildren(Node* top)
     {
-        for (auto iter = expressions.begin(); iter != expressions.end(); iter++)
+        auto node = top;
+        while (node)
         {
-            auto next = iter; next++;
-            Expression* expression = *iter;
-            Expression* second = *next;
-            if (expression->type == "Variable Declaration" &&
-                second->type == "Lambda")
+            auto children = node->children();
+            for (uint32_t i = 0; i < children.size(); i++)
+            {
+                if (auto child = children[i])
+                {
+                    child->parent = node;
+                    child->slot = i;
+                }
+            }
+
+            auto next = childFrom(node, 0);
+            while (!next && node != top)
             {
-                auto declaration = (VariableDeclaration*) expression;
-                auto variable = (Variable*) declaration->variable;
-
-                // Build function
-                Token type = variable->typeToken;
-                Token name = variable->nameToken;
-                Lambda* lambda = (Lambda*) second;
-                Function* function = new Function(type, name, lambda);
-
-                // Build definition
-                auto functionDefinition = new FunctionDefinition(function);
-
-                // Replace with function definition
-                expressions.erase(next);
-                iter = expressions.erase(iter);
-                expressions.insert(iter, functionDefinition);
+                next = childFrom(node->parent, node->slot + 1);
+                if (!next)
+                    node = node->parent;
             }
+            node = next;
         }
     }
+
+private:
+    // Readies `parser` to parse into `arena` in the mode selected.
+    template <typename TokenIter>
+    TokenParser<TokenIter>& use(TokenParser<TokenIter> & parser, Arena* arena)
+    {
+        parser.iterative = iterative;
+        parser.diagnostics = diagnostics;
+        parser.arena = arena;
+        return parser;
+    }
+
+    // Parsers of Token buffers and of TokenStreams, kept to reuse the
+    // memory of their stacks
+    TokenParser<const Token*> tokenParser;
+    TokenParser<StreamCursor> streamParser;
 };
 
 void testParser()
@@ -885,7 +1566,7 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Number");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Number);
         assert(ast.root.statements[0].outer->value == "123");
     }
 
@@ -895,7 +1576,7 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Identifier");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Identifier);
         assert(ast.root.statements[0].outer->value == "abc");
     }
 
@@ -905,11 +1586,11 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Assignment");
-        assert(ast.root.statements[0].outer->left->type == "Identifier");
-        assert(ast.root.statements[0].outer->left->value == "abc");
-        assert(ast.root.statements[0].outer->right->type == "Number");
-        assert(ast.root.statements[0].outer->right->value == "123");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Assignment);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->value == "abc");
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->right->kind == NodeKind::Number);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->right->value == "123");
     }
 
     {
@@ -920,15 +1601,15 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 3);
-        assert(ast.root.statements[0].outer->token.value == "=");
-        assert(ast.root.statements[0].outer->left->value == "a");
-        assert(ast.root.statements[0].outer->right->value == "1");
-        assert(ast.root.statements[1].outer->token.value == "=");
-        assert(ast.root.statements[1].outer->left->value == "b");
-        assert(ast.root.statements[1].outer->right->value == "2");
-        assert(ast.root.statements[2].outer->token.value == "=");
-        assert(ast.root.statements[2].outer->left->value == "c");
-        assert(ast.root.statements[2].outer->right->value == "3");
+        assert(ast.root.statements[0].outer->value == "=");
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->value == "a");
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->right->value == "1");
+        assert(ast.root.statements[1].outer->value == "=");
+        assert(ast.root.statements[1].outer->as<BinaryOperation>()->left->value == "b");
+        assert(ast.root.statements[1].outer->as<BinaryOperation>()->right->value == "2");
+        assert(ast.root.statements[2].outer->value == "=");
+        assert(ast.root.statements[2].outer->as<BinaryOperation>()->left->value == "c");
+        assert(ast.root.statements[2].outer->as<BinaryOperation>()->right->value == "3");
     }
 
     {
@@ -937,12 +1618,12 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Expression Group");
-        assert(ast.root.statements[0].outer->inner->type == "Addition");
-        assert(ast.root.statements[0].outer->inner->left->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->right->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->left->value == "a");
-        assert(ast.root.statements[0].outer->inner->right->value == "b");
+        assert(ast.root.statements[0].outer->kind == NodeKind::ExpressionGroup);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->kind == NodeKind::Addition);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->value == "a");
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->value == "b");
     }
 
     {
@@ -951,19 +1632,73 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Expression Group");
-        assert(ast.root.statements[0].outer->inner->type == "Division");
-        assert(ast.root.statements[0].outer->inner->left->type == "Expression Group");
-        assert(ast.root.statements[0].outer->inner->left->inner->type == "Addition");
-        assert(ast.root.statements[0].outer->inner->left->inner->left->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->left->inner->right->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->left->inner->left->value == "a");
-        assert(ast.root.statements[0].outer->inner->left->inner->right->value == "b");
-        assert(ast.root.statements[0].outer->inner->right->inner->type == "Multiplication");
-        assert(ast.root.statements[0].outer->inner->right->inner->right->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->right->inner->right->type == "Identifier");
-        assert(ast.root.statements[0].outer->inner->right->inner->left->value == "c");
-        assert(ast.root.statements[0].outer->inner->right->inner->right->value == "d");
+        assert(ast.root.statements[0].outer->kind == NodeKind::ExpressionGroup);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->kind == NodeKind::Division);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->kind == NodeKind::ExpressionGroup);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->as<ExpressionGroup>()->inner->kind == NodeKind::Addition);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->value == "a");
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->value == "b");
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->kind == NodeKind::Multiplication);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->kind == NodeKind::Identifier);
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->as<BinaryOperation>()->left->value == "c");
+        assert(ast.root.statements[0].outer->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->as<BinaryOperation>()->right->value == "d");
+    }
+
+    {
+        // Test operator precedence
+        auto source = "a + b * c - d";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto subtraction = ast.root.statements[0].outer->as<BinaryOperation>();
+        assert(subtraction->kind == NodeKind::Subtraction);
+        assert(subtraction->right->value == "d");
+        auto addition = subtraction->left->as<BinaryOperation>();
+        assert(addition->kind == NodeKind::Addition);
+        assert(addition->left->value == "a");
+        assert(addition->right->kind == NodeKind::Multiplication);
+    }
+
+    {
+        // Test operator associativity
+        auto source = "a = b = c - d - e";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto outer = ast.root.statements[0].outer->as<BinaryOperation>();
+        assert(outer->kind == NodeKind::Assignment);
+        assert(outer->left->value == "a");
+        auto inner = outer->right->as<BinaryOperation>();
+        assert(inner->kind == NodeKind::Assignment);
+        assert(inner->left->value == "b");
+        auto subtraction = inner->right->as<BinaryOperation>();
+        assert(subtraction->right->value == "e");
+        assert(subtraction->left->kind == NodeKind::Subtraction);
+        assert(subtraction->left->as<BinaryOperation>()->left->value == "c");
+    }
+
+    {
+        // Test comparison and logical operators
+        auto source = "a < b and c == d || e";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto logicalOr = ast.root.statements[0].outer->as<BinaryOperation>();
+        assert(logicalOr->kind == NodeKind::LogicalOr);
+        auto logicalAnd = logicalOr->left->as<BinaryOperation>();
+        assert(logicalAnd->kind == NodeKind::LogicalAnd);
+        assert(logicalAnd->left->kind == NodeKind::CompareLT);
+        assert(logicalAnd->right->kind == NodeKind::CompareEQ);
+    }
+
+    {
+        // Test missing operands are errors
+        auto source = "a +";
+        auto tokens = lexer.tokenize(source);
+        bool thrown = false;
+        try { parser.parse(tokens); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
     }
 
     {
@@ -972,9 +1707,9 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Return");
-        assert(ast.root.statements[0].outer->operand->type == "Number");
-        assert(ast.root.statements[0].outer->operand->value == "42");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Return);
+        assert(ast.root.statements[0].outer->as<UnaryOperation>()->operand->kind == NodeKind::Number);
+        assert(ast.root.statements[0].outer->as<UnaryOperation>()->operand->value == "42");
     }
 
     {
@@ -985,10 +1720,10 @@ void testParser()
         vector<Token> blockTokens({ tokens[3], tokens[4], tokens[5], tokens[6], tokens[7], tokens[8] });
         auto ast = parser.parse(blockTokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Block");
-        assert(ast.root.statements[0].outer->statements[0].outer->type == "Return");
-        assert(ast.root.statements[0].outer->statements[0].outer->operand->type == "Number");
-        assert(ast.root.statements[0].outer->statements[0].outer->operand->value == "42");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Block);
+        assert(ast.root.statements[0].outer->as<Block>()->statements[0].outer->kind == NodeKind::Return);
+        assert(ast.root.statements[0].outer->as<Block>()->statements[0].outer->as<UnaryOperation>()->operand->kind == NodeKind::Number);
+        assert(ast.root.statements[0].outer->as<Block>()->statements[0].outer->as<UnaryOperation>()->operand->value == "42");
     }
 
     {
@@ -997,14 +1732,14 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Lambda");
-        assert(ast.root.statements[0].outer->paramList->type == "Parameter List");
-        assert(ast.root.statements[0].outer->paramList->params.size() == 0);
-        assert(ast.root.statements[0].outer->block->type == "Block");
-        assert(ast.root.statements[0].outer->block->statements.size() == 1);
-        assert(ast.root.statements[0].outer->block->statements[0].outer->type == "Return");
-        assert(ast.root.statements[0].outer->block->statements[0].outer->operand->type == "Number");
-        assert(ast.root.statements[0].outer->block->statements[0].outer->operand->value == "42");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Lambda);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->kind == NodeKind::ParamList);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params.size() == 0);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->kind == NodeKind::Block);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements.size() == 1);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements[0].outer->kind == NodeKind::Return);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements[0].outer->as<UnaryOperation>()->operand->kind == NodeKind::Number);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements[0].outer->as<UnaryOperation>()->operand->value == "42");
     }
 
     {
@@ -1013,13 +1748,13 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Lambda");
-        assert(ast.root.statements[0].outer->paramList->type == "Parameter List");
-        assert(ast.root.statements[0].outer->paramList->params.size() == 2);
-        assert(ast.root.statements[0].outer->paramList->params[0].paramType == "double");
-        assert(ast.root.statements[0].outer->paramList->params[0].paramName == "a");
-        assert(ast.root.statements[0].outer->paramList->params[1].paramType == "double");
-        assert(ast.root.statements[0].outer->paramList->params[1].paramName == "b");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Lambda);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->kind == NodeKind::ParamList);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params.size() == 2);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params[0].paramType == lexer.symbols->find("double"));
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params[0].paramName == lexer.symbols->find("a"));
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params[1].paramType == lexer.symbols->find("double"));
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params[1].paramName == lexer.symbols->find("b"));
     }
 
     {
@@ -1030,13 +1765,13 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Lambda");
-        assert(ast.root.statements[0].outer->paramList->type == "Parameter List");
-        assert(ast.root.statements[0].outer->paramList->params.size() == 0);
-        assert(ast.root.statements[0].outer->block->type == "Block");
-        assert(ast.root.statements[0].outer->block->statements.size() == 2);
-        assert(ast.root.statements[0].outer->block->statements[0].outer->type == "Assignment");
-        assert(ast.root.statements[0].outer->block->statements[1].outer->type == "Assignment");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Lambda);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->kind == NodeKind::ParamList);
+        assert(ast.root.statements[0].outer->as<Lambda>()->paramList->params.size() == 0);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->kind == NodeKind::Block);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements.size() == 2);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements[0].outer->kind == NodeKind::Assignment);
+        assert(ast.root.statements[0].outer->as<Lambda>()->block->statements[1].outer->kind == NodeKind::Assignment);
     }
 
     {
@@ -1044,10 +1779,10 @@ void testParser()
         auto source = "int abc";
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
-        assert(ast.root.statements[0].outer->type == "Variable Declaration");
+        assert(ast.root.statements[0].outer->kind == NodeKind::VariableDeclaration);
         assert(ast.root.statements[0].outer->value == "int abc");
-        assert(ast.root.statements[0].outer->variable->varType == "int");
-        assert(ast.root.statements[0].outer->variable->varName == "abc");
+        assert(ast.root.statements[0].outer->as<VariableDeclaration>()->variable->varType == lexer.symbols->find("int"));
+        assert(ast.root.statements[0].outer->as<VariableDeclaration>()->variable->varName == lexer.symbols->find("abc"));
     }
 
     {
@@ -1056,13 +1791,13 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Assignment");
-        assert(ast.root.statements[0].outer->left->type == "Variable Declaration");
-        assert(ast.root.statements[0].outer->left->value == "int abc");
-        assert(ast.root.statements[0].outer->left->variable->varType == "int");
-        assert(ast.root.statements[0].outer->left->variable->varName == "abc");
-        assert(ast.root.statements[0].outer->right->type == "Number");
-        assert(ast.root.statements[0].outer->right->value == "123");
+        assert(ast.root.statements[0].outer->kind == NodeKind::Assignment);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->kind == NodeKind::VariableDeclaration);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->value == "int abc");
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->as<VariableDeclaration>()->variable->varType == lexer.symbols->find("int"));
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->left->as<VariableDeclaration>()->variable->varName == lexer.symbols->find("abc"));
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->right->kind == NodeKind::Number);
+        assert(ast.root.statements[0].outer->as<BinaryOperation>()->right->value == "123");
     }
 
     {
@@ -1071,11 +1806,187 @@ void testParser()
         auto tokens = lexer.tokenize(source);
         auto ast = parser.parse(tokens);
         assert(ast.root.statements.size() == 1);
-        assert(ast.root.statements[0].outer->type == "Function Definition");
-        assert(ast.root.statements[0].outer->function->type == "Function");
-        assert(ast.root.statements[0].outer->function->functionName == "main");
-        assert(ast.root.statements[0].outer->function->block->statements.size() == 1);
-        assert(ast.root.statements[0].outer->function->block->statements[0].outer->type == "Return");
+        assert(ast.root.statements[0].outer->kind == NodeKind::FunctionDefinition);
+        assert(ast.root.statements[0].outer->as<FunctionDefinition>()->function->kind == NodeKind::Function);
+        assert(ast.root.statements[0].outer->as<FunctionDefinition>()->function->functionName == lexer.symbols->find("main"));
+        assert(ast.root.statements[0].outer->as<FunctionDefinition>()->function->block->statements.size() == 1);
+        assert(ast.root.statements[0].outer->as<FunctionDefinition>()->function->block->statements[0].outer->kind == NodeKind::Return);
+    }
+
+    {
+        // Test nodes are compact and owned by the arena of their AST
+        static_assert(sizeof(Number) == sizeof(Node), "Number holds nothing but text");
+        static_assert(sizeof(Addition) <= sizeof(Node) + 3 * sizeof(void*), "Addition holds its operator and operands");
+        auto source = "a = (1 + 2)";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto used = ast.arena->bytesUsed();
+        assert(used > 0 && used < 1024);
+        AST moved = std::move(ast);
+        assert(moved.arena->bytesUsed() == used);
+        assert(moved.root.statements[0].outer->kind == NodeKind::Assignment);
+        assert(moved.root.statements[0].outer->as<BinaryOperation>()->right->as<ExpressionGroup>()->inner->kind == NodeKind::Addition);
+    }
+
+    {
+        // Test iterative parsing gives the same trees and errors
+        auto sameTree = [](Node* a, Node* b)
+        {
+            vector<pair<Node*, Node*>> pending { { a, b } };
+            while (!pending.empty())
+            {
+                auto nodes = pending.back();
+                pending.pop_back();
+                auto left = nodes.first;
+                auto right = nodes.second;
+                if (!left || !right)
+                {
+                    if (left != right)
+                        return false;
+                    continue;
+                }
+                if (left->kind != right->kind || left->value != right->value ||
+                    left->slot != right->slot || left->children().size() != right->children().size())
+                    return false;
+                if (left->kind == NodeKind::Identifier &&
+                    left->as<Identifier>()->symbol != right->as<Identifier>()->symbol)
+                    return false;
+                if (left->kind == NodeKind::ParamList &&
+                    left->as<ParamList>()->params.size() != right->as<ParamList>()->params.size())
+                    return false;
+                if (left->kind == NodeKind::Function &&
+                    left->as<Function>()->functionName != right->as<Function>()->functionName)
+                    return false;
+                for (uint32_t i = 0; i < left->children().size(); i++)
+                    pending.push_back({ left->children()[i], right->children()[i] });
+            }
+            return true;
+        };
+
+        const char* sources[] =
+        {
+            "",
+            "a = b = c - d * e / f << 1 < 2 == g and h or i | j & k",
+            "int square(int a) -> return a * (a + 1)\nb = 'c'\n",
+            "int main() ->\n  x = 1\n  return x\n",
+            "(double a, double b) -> return a * b\n",
+            "((a + b) / (c * d))",
+            "() ->\n  a = 1\n  b = 2\n",
+            "a +",
+            "a b",
+            "-> return 1",
+            "x = () -> y = () -> 1\n",
+        };
+        Parser iterative;
+        iterative.iterative = true;
+        for (auto source : sources)
+        {
+            auto tokens = lexer.tokenize(source);
+            string error;
+            string iterativeError;
+            AST ast;
+            AST iterativeAst;
+            try { ast = parser.parse(tokens); }
+            catch (CreamError& e) { error = e.what(); }
+            try { iterativeAst = iterative.parse(tokens); }
+            catch (CreamError& e) { iterativeError = e.what(); }
+            assert(error == iterativeError);
+            assert(sameTree(&ast.root, &iterativeAst.root));
+
+            // Parsing the stream in place gives the same in both modes
+            auto stream = lexer.lex(source);
+            for (auto mode : { &parser, &iterative })
+            {
+                string streamError;
+                AST streamAst;
+                try { streamAst = mode->parse(stream); }
+                catch (CreamError& e) { streamError = e.what(); }
+                assert(streamError == error);
+                assert(sameTree(&ast.root, &streamAst.root));
+            }
+        }
+
+        // Test both modes recover from the same errors, leaving out the
+        // statements holding them
+        const char* broken[] =
+        {
+            "a = 1 +\nb = 2\nc 2\ne = 3\n",
+            "int main() ->\n  x = (1 +)\n  return x\ny = 'z'\n",
+            "f = (a +\n  b)\n",
+            "int main() ->\n  return\nx = 1\n",
+        };
+        for (auto source : broken)
+        {
+            auto tokens = lexer.tokenize(source);
+            Diagnostics diagnostics;
+            Diagnostics iterativeDiagnostics;
+            parser.diagnostics = &diagnostics;
+            iterative.diagnostics = &iterativeDiagnostics;
+            auto ast = parser.parse(tokens);
+            auto iterativeAst = iterative.parse(tokens);
+            assert(diagnostics.hasErrors());
+            assert(diagnostics.list().size() == iterativeDiagnostics.list().size());
+            for (size_t i = 0; i < diagnostics.list().size(); i++)
+                assert(diagnostics.list()[i].toString() == iterativeDiagnostics.list()[i].toString());
+            assert(sameTree(&ast.root, &iterativeAst.root));
+
+            Diagnostics streamDiagnostics;
+            parser.diagnostics = &streamDiagnostics;
+            auto streamAst = parser.parse(lexer.lex(source));
+            assert(streamDiagnostics.list().size() == diagnostics.list().size());
+            for (size_t i = 0; i < diagnostics.list().size(); i++)
+                assert(streamDiagnostics.list()[i].toString() == diagnostics.list()[i].toString());
+            assert(sameTree(&ast.root, &streamAst.root));
+        }
+        parser.diagnostics = nullptr;
+        iterative.diagnostics = nullptr;
+        {
+            auto tokens = lexer.tokenize("a = 1 +\nb = 2\nc 2\ne = 3\n");
+            Diagnostics diagnostics;
+            parser.diagnostics = &diagnostics;
+            auto ast = parser.parse(tokens);
+            parser.diagnostics = nullptr;
+            assert(diagnostics.errorCount() == 2);
+            assert(diagnostics.list()[0].toString() == "1:7: error: Expect an expression after '+'");
+            assert(diagnostics.list()[1].toString() == "3:3: error: Expect only one top level expression");
+            assert(ast.root.statements.size() == 2);
+            assert(ast.root.statements[1].outer->as<BinaryOperation>()->right->value == "3");
+        }
+
+        {
+            // Test statements parsed one at a time into one tree, reset
+            // after each, match fresh trees and stay in the first block of
+            // the arena
+            TokenSource statements(lexer, "a = 1\nint f(int b) -> return b * 2\nc = (d + e) * f\n");
+            vector<Token> tokens;
+            AST ast;
+            size_t count = 0;
+            while (statements.nextStatement(tokens))
+            {
+                vector<size_t> ends { tokens.size() };
+                auto fresh = parser.parse(tokens, ends);
+                parser.parse(tokens, ends, ast);
+                assert(sameTree(&fresh.root, &ast.root));
+                assert(ast.arena->blockCount() == 1);
+                ast.reset();
+                tokens.clear();
+                count++;
+            }
+            assert(count == 3);
+        }
+
+        // Test deep nesting
+        int depth = 100000;
+        string deep = "x = " + string(depth, '(') + "a" + string(depth, ')');
+        auto tokens = lexer.tokenize(deep);
+        auto ast = iterative.parse(tokens);
+        Node* node = ast.root.statements[0].outer->as<BinaryOperation>()->right;
+        for (int i = 0; i < depth; i++)
+        {
+            assert(node->kind == NodeKind::ExpressionGroup && node->parent);
+            node = node->as<ExpressionGroup>()->inner;
+        }
+        assert(node->kind == NodeKind::Identifier && node->value == "a");
     }
 
     /*
@@ -1140,19 +2051,38 @@ void testParser()
 
 using Parser = parser::Parser;
 using AST = parser::AST;
+using NodeKind = parser::NodeKind;
+using Node = parser::Node;
 using Function = parser::Function;
 using FunctionDefinition = parser::FunctionDefinition;
 using Block = parser::Block;
 using Statement = parser::Statement;
 using Expression = parser::Expression;
+using ExpressionGroup = parser::ExpressionGroup;
+using Variable = parser::Variable;
+using VariableDeclaration = parser::VariableDeclaration;
 using Number = parser::Number;
 using String = parser::String;
+using Identifier = parser::Identifier;
+using Operation = parser::Operation;
 using BinaryOperation = parser::BinaryOperation;
 using UnaryOperation = parser::UnaryOperation;
 using Addition = parser::Addition;
 using Subtraction = parser::Subtraction;
 using Division = parser::Division;
 using Multiplication = parser::Multiplication;
+using BitwiseAnd = parser::BitwiseAnd;
+using BitwiseOr = parser::BitwiseOr;
+using BitwiseLeft = parser::BitwiseLeft;
+using BitwiseRight = parser::BitwiseRight;
+using CompareLT = parser::CompareLT;
+using CompareLTE = parser::CompareLTE;
+using CompareGT = parser::CompareGT;
+using CompareGTE = parser::CompareGTE;
+using CompareEQ = parser::CompareEQ;
+using LogicalAnd = parser::LogicalAnd;
+using LogicalOr = parser::LogicalOr;
+using Assignment = parser::Assignment;
 using Lambda = parser::Lambda;
 using Parameter = parser::Parameter;
 using ParamList = parser::ParamList;
@@ -0,0 +1,404 @@
+
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Common.h"
+#include "Token.h"
+
+namespace cream {
+namespace rewriter {
+
+using namespace std;
+
+/**
+ * Work done by one pass over all its runs.
+ */
+
+struct PassStats
+{
+    string name;
+    size_t runs = 0;
+    double milliseconds = 0;
+    size_t inserted = 0;
+    size_t removed = 0;
+};
+
+/**
+ * The PassManager class.
+ *
+ * Runs named passes over a token list, each a member function of `Target`.
+ * Passes run in the order they were added, and a pass may only require
+ * passes added before it. Enabling a pass enables what it requires, and
+ * disabling one disables the passes requiring it, so the enabled set is
+ * always complete.
+ *
+ * With `timing` set, each run records the wall time of every pass and the
+ * tokens it inserted and removed. Tokens are told apart by the text they
+ * point to, so a token replaced in place by one with other text counts as
+ * one removed and one inserted.
+ */
+
+template <typename Target>
+class PassManager
+{
+public:
+    typedef void (Target::*Run)(list<Token> &);
+
+    // Collects stats while running.
+    bool timing = false;
+
+    // Adds pass `name`, requiring the passes named in `dependencies`.
+    void add(const string & name, Run run, vector<string> dependencies={})
+    {
+        if (find(name) != npos)
+            throw CreamError("Duplicate rewriter pass '" + name + "'\n");
+        if (passes.size() == 64)
+            throw CreamError("Too many rewriter passes\n");
+
+        Pass pass { name, run, {}, true };
+        for (auto const& dependency : dependencies)
+            pass.dependencies.push_back(indexOf(dependency));
+        passes.push_back(pass);
+        stats.push_back({ name });
+    }
+
+    // Gets the names of all passes, in order.
+    vector<string> names() const
+    {
+        vector<string> names;
+        for (auto const& pass : passes)
+            names.push_back(pass.name);
+        return names;
+    }
+
+    // Checks whether pass `name` is enabled.
+    bool isEnabled(const string & name) const
+    {
+        return passes[indexOf(name)].enabled;
+    }
+
+    // Checks whether every pass is enabled.
+    bool allEnabled() const
+    {
+        for (auto const& pass : passes)
+        {
+            if (!pass.enabled)
+                return false;
+        }
+        return true;
+    }
+
+    // Enables pass `name` and the passes it requires.
+    void enable(const string & name)
+    {
+        enable(indexOf(name));
+    }
+
+    // Disables pass `name` and the passes requiring it.
+    void disable(const string & name)
+    {
+        auto index = indexOf(name);
+        passes[index].enabled = false;
+        for (size_t i = index + 1; i < passes.size(); i++)
+        {
+            for (auto required : passes[i].dependencies)
+            {
+                if (!passes[required].enabled)
+                    passes[i].enabled = false;
+            }
+        }
+    }
+
+    // Enables only the passes `names` and the passes they require.
+    void only(const vector<string> & names)
+    {
+        vector<size_t> indexes;
+        for (auto const& name : names)
+            indexes.push_back(indexOf(name));
+        for (auto& pass : passes)
+            pass.enabled = false;
+        for (auto index : indexes)
+            enable(index);
+    }
+
+    // Enables every pass.
+    void enableAll()
+    {
+        for (auto& pass : passes)
+            pass.enabled = true;
+    }
+
+    // Gets a mask selecting the passes `names`, for `run`.
+    uint64_t mask(const vector<string> & names) const
+    {
+        uint64_t mask = 0;
+        for (auto const& name : names)
+            mask |= uint64_t(1) << indexOf(name);
+        return mask;
+    }
+
+    // Runs the enabled passes selected by `mask` over `tokens`.
+    void run(Target & target, list<Token> & tokens, uint64_t mask=~uint64_t(0))
+    {
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            auto const& pass = passes[i];
+            if (!pass.enabled || !(mask & (uint64_t(1) << i)))
+                continue;
+            if (!timing)
+            {
+                (target.*pass.run)(tokens);
+                continue;
+            }
+
+            auto before = countTexts(tokens);
+            auto start = chrono::steady_clock::now();
+            (target.*pass.run)(tokens);
+            chrono::duration<double, milli> time = chrono::steady_clock::now() - start;
+
+            auto& stat = stats[i];
+            stat.runs++;
+            stat.milliseconds += time.count();
+            for (auto const& count : countTexts(tokens))
+            {
+                auto old = before.find(count.first);
+                auto was = old == before.end() ? 0 : old->second;
+                if (count.second > was)
+                    stat.inserted += count.second - was;
+                else
+                    stat.removed += was - count.second;
+                if (old != before.end())
+                    before.erase(old);
+            }
+            for (auto const& count : before)
+                stat.removed += count.second;
+        }
+    }
+
+    // Gets the stats of each pass, in order.
+    const vector<PassStats> & getStats() const
+    {
+        return stats;
+    }
+
+    // Clears the stats of each pass.
+    void resetStats()
+    {
+        for (auto& stat : stats)
+            stat = { stat.name };
+    }
+
+    // Prints the stats of the passes that ran.
+    void report(ostream & out) const
+    {
+        out << left << setw(28) << "Pass" << right
+            << setw(12) << "ms" << setw(12) << "inserted" << setw(12) << "removed" << endl;
+        for (auto const& stat : stats)
+        {
+            if (!stat.runs)
+                continue;
+            out << left << setw(28) << stat.name << right
+                << setw(12) << fixed << setprecision(3) << stat.milliseconds
+                << setw(12) << stat.inserted << setw(12) << stat.removed << endl;
+        }
+    }
+
+    // Applies pass options from `args`, returning the other arguments:
+    //   --passes=a,b       enable only passes a and b
+    //   --enable-pass=a    enable pass a
+    //   --disable-pass=a   disable pass a
+    //   --pass-stats       collect pass stats
+    vector<string> applyOptions(const vector<string> & args)
+    {
+        vector<string> rest;
+        for (auto const& arg : args)
+        {
+            if (startsWith(arg, "--passes="))
+                only(split(arg.substr(9)));
+            else if (startsWith(arg, "--enable-pass="))
+                enable(arg.substr(14));
+            else if (startsWith(arg, "--disable-pass="))
+                disable(arg.substr(15));
+            else if (arg == "--pass-stats")
+                timing = true;
+            else
+                rest.push_back(arg);
+        }
+        return rest;
+    }
+
+private:
+    static constexpr size_t npos = SIZE_MAX;
+
+    /**
+     * A pass, with the indexes of the passes it requires.
+     */
+
+    struct Pass
+    {
+        string name;
+        Run run;
+        vector<size_t> dependencies;
+        bool enabled;
+    };
+
+    // Enables pass `index` and the passes it requires.
+    void enable(size_t index)
+    {
+        passes[index].enabled = true;
+        for (auto required : passes[index].dependencies)
+            enable(required);
+    }
+
+    // Finds pass `name`, or returns npos.
+    size_t find(const string & name) const
+    {
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            if (passes[i].name == name)
+                return i;
+        }
+        return npos;
+    }
+
+    // Finds pass `name`, which must exist.
+    size_t indexOf(const string & name) const
+    {
+        auto index = find(name);
+        if (index == npos)
+            throw CreamError("Unknown rewriter pass '" + name + "'\n");
+        return index;
+    }
+
+    // Counts the tokens pointing to each text.
+    static unordered_map<const char*, size_t> countTexts(const list<Token> & tokens)
+    {
+        unordered_map<const char*, size_t> counts;
+        for (auto const& token : tokens)
+            counts[token.value.data()]++;
+        return counts;
+    }
+
+    static bool startsWith(const string & text, const string & prefix)
+    {
+        return text.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    // Splits a comma separated list.
+    static vector<string> split(const string & text)
+    {
+        vector<string> parts;
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            auto end = text.find(',', start);
+            if (end == string::npos)
+                end = text.size();
+            if (end > start)
+                parts.push_back(text.substr(start, end - start));
+            start = end + 1;
+        }
+        return parts;
+    }
+
+    vector<Pass> passes;
+    vector<PassStats> stats;
+};
+
+void testPassManager()
+{
+    cout << "Testing PassManager" << endl;
+
+    /**
+     * Passes that drop, add or keep tokens.
+     */
+
+    struct Target
+    {
+        void drop(list<Token> & tokens) { tokens.pop_front(); }
+        void add(list<Token> & tokens) { tokens.push_back({ token::BLOCK_END, "Block End", "}" }); }
+        void keep(list<Token> & tokens) {}
+    };
+
+    PassManager<Target> passes;
+    passes.add("drop", &Target::drop);
+    passes.add("add", &Target::add, { "drop" });
+    passes.add("keep", &Target::keep, { "add" });
+    assert((passes.names() == vector<string> { "drop", "add", "keep" }));
+
+    {
+        // Test dependencies are enabled and disabled together
+        passes.disable("add");
+        assert(passes.isEnabled("drop"));
+        assert(!passes.isEnabled("add"));
+        assert(!passes.isEnabled("keep"));
+        passes.enable("keep");
+        assert(passes.allEnabled());
+        passes.only({ "drop" });
+        assert(passes.isEnabled("drop"));
+        assert(!passes.isEnabled("add"));
+        passes.enableAll();
+    }
+
+    {
+        // Test unknown and out of order passes are errors
+        bool thrown = false;
+        try { passes.disable("missing"); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
+        thrown = false;
+        try { passes.add("late", &Target::keep, { "later" }); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
+    }
+
+    {
+        // Test options select passes and stats
+        auto rest = passes.applyOptions({ "--passes=add", "file.cream", "--pass-stats", "--disable-pass=drop" });
+        assert((rest == vector<string> { "file.cream" }));
+        assert(passes.timing);
+        assert(!passes.isEnabled("drop"));
+        assert(!passes.isEnabled("add"));
+        passes.enableAll();
+    }
+
+    {
+        // Test stats count the tokens of each pass
+        Target target;
+        list<Token> tokens;
+        string source = "a b";
+        tokens.push_back({ token::IDENTIFIER, "Identifier", string_view(source).substr(0, 1) });
+        tokens.push_back({ token::IDENTIFIER, "Identifier", string_view(source).substr(2, 1) });
+        passes.run(target, tokens);
+        passes.run(target, tokens, passes.mask({ "add" }));
+        assert(tokens.size() == 3);
+
+        auto const& stats = passes.getStats();
+        assert(stats[0].runs == 1 && stats[0].removed == 1 && stats[0].inserted == 0);
+        assert(stats[1].runs == 2 && stats[1].inserted == 2 && stats[1].removed == 0);
+        assert(stats[2].runs == 1 && stats[2].inserted == 0 && stats[2].removed == 0);
+
+        stringstream report;
+        passes.report(report);
+        assert(report.str().find("add") != string::npos);
+        passes.resetStats();
+        assert(passes.getStats()[1].runs == 0);
+    }
+}
+
+} // end cream::rewriter
+
+template <typename Target>
+using PassManager = cream::rewriter::PassManager<Target>;
+using PassStats = cream::rewriter::PassStats;
+
+} // end cream
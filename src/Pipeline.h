@@ -0,0 +1,554 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "CompilationContext.h"
+#include "Compiler.h"
+#include "Diagnostics.h"
+#include "Interner.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Rewriter.h"
+#include "SpscQueue.h"
+#include "TokenSource.h"
+
+namespace cream {
+namespace compiler {
+
+using namespace std;
+
+/**
+ * Work done by one stage of a pipeline: the batches it passed on, how
+ * often and how long it waited for input or for room in its output, and
+ * how full its output queue ran. The stage waiting least is the
+ * bottleneck.
+ */
+
+struct StageStats
+{
+    string name;
+    size_t batches = 0;
+    size_t starved = 0;
+    double starvedMilliseconds = 0;
+    size_t blocked = 0;
+    double blockedMilliseconds = 0;
+    double meanQueued = 0;
+    size_t peakQueued = 0;
+};
+
+/**
+ * The Pipeline class.
+ *
+ * Compiles one source with the stages of a compiler all running at once:
+ * the lexer, rewriter and parser each on a thread of its own and the
+ * backend on the calling thread. Stages pass batches of whole top-level
+ * statements through bounded SpscQueues, so a single large source keeps
+ * every stage busy, and memory is bounded by the batches in flight.
+ * Output, errors and diagnostics are those of Compiler::compile.
+ *
+ * Only the lexer thread touches the symbol table. Each batch carries the
+ * names the lexer added before it was sent, and the backend enters them
+ * in a table of its own in the same order, so the IDs agree. The rewriter
+ * gives implicit tokens positions from a context of its own, counting
+ * down from far below those the lexer gives, so positions stay unique.
+ *
+ * Errors travel in the batches. A stage that fails passes on the whole
+ * statements before the error and then the error, so the first error in
+ * source order reaches the caller, and stops. A stage whose output is
+ * cancelled cancels its input, so the stages before it stop too.
+ */
+
+class Pipeline
+{
+public:
+    static constexpr size_t defaultBatchSize = 1 << 12;
+    static constexpr size_t defaultQueueCapacity = 4;
+
+    // Number of tokens of whole statements the lexer puts in each batch
+    size_t batchSize = defaultBatchSize;
+
+    // Number of batches each queue holds before its producer waits
+    size_t queueCapacity = defaultQueueCapacity;
+
+    // Compiles with the lexer passes, parser mode and backend of `compiler`.
+    explicit Pipeline(Compiler & compiler)
+        : compiler(compiler)
+    {}
+
+    // Compiles a borrowed source in a new context.
+    string compile(SourceText source)
+    {
+        return compile(source, nullptr);
+    }
+
+    // Compiles a source as above, recovering from errors to report all of
+    // them to `diagnostics` in one run, up to its limit. Gives no output
+    // when an error is found.
+    string compile(SourceText source, Diagnostics & diagnostics)
+    {
+        try
+        {
+            return compile(source, &diagnostics);
+        }
+        catch (TooManyErrors& e)
+        {
+            return "";
+        }
+    }
+
+    // Gets the work of each stage in the last compile, in stage order.
+    const vector<StageStats>& stats() const
+    {
+        return stageStats;
+    }
+
+    // Prints the stats of each stage.
+    void report(ostream & out) const
+    {
+        out << left << setw(12) << "Stage" << right
+            << setw(10) << "batches" << setw(10) << "starved" << setw(12) << "ms"
+            << setw(10) << "blocked" << setw(12) << "ms"
+            << setw(12) << "queued" << setw(8) << "peak" << endl;
+        for (auto const& stat : stageStats)
+        {
+            out << left << setw(12) << stat.name << right
+                << setw(10) << stat.batches
+                << setw(10) << stat.starved
+                << setw(12) << fixed << setprecision(3) << stat.starvedMilliseconds
+                << setw(10) << stat.blocked
+                << setw(12) << stat.blockedMilliseconds
+                << setw(12) << setprecision(2) << stat.meanQueued
+                << setw(8) << stat.peakQueued << endl;
+        }
+    }
+
+private:
+    /**
+     * What every batch carries past the stage that made it: the names the
+     * lexer added, what the stages before reported, and the error that
+     * stopped one, after which nothing follows.
+     */
+
+    struct Batch
+    {
+        vector<string_view> names;
+        vector<Diagnostic> diagnostics;
+        exception_ptr error;
+
+        // Takes what `batch` carries.
+        void carry(Batch & batch)
+        {
+            names = std::move(batch.names);
+            diagnostics = std::move(batch.diagnostics);
+            error = batch.error;
+        }
+
+        // Adds what a stage reported.
+        void add(vector<Diagnostic> reported)
+        {
+            for (auto& diagnostic : reported)
+                diagnostics.push_back(std::move(diagnostic));
+        }
+    };
+
+    struct LexedBatch : Batch
+    {
+        vector<TokenSource::Window> windows;
+
+        // Whether an error cut the last statement short, so it is dropped
+        // once rewritten
+        bool partial = false;
+    };
+
+    struct RewrittenBatch : Batch
+    {
+        vector<Token> tokens;
+        vector<size_t> ends;
+    };
+
+    struct ParsedBatch : Batch
+    {
+        AST ast;
+    };
+
+    string compile(SourceText source, Diagnostics* diagnostics)
+    {
+        auto& lexer = *compiler.lexer;
+        lexer.resetSymbols();
+        lexer.resetContext();
+        TokenSource tokens(lexer, source);
+
+        // Errors the stages recover from are collected per stage, and
+        // reported in source order by the backend
+        bool recovering = diagnostics != nullptr;
+        Diagnostics lexed(0), rewritten(0), parsed(0);
+        lexer.context->diagnostics = recovering ? &lexed : nullptr;
+        auto context = make_shared<CompilationContext>(*lexer.context);
+        context->lastImplicitPos = numeric_limits<int64_t>::min() / 2;
+        context->diagnostics = recovering ? &rewritten : nullptr;
+
+        SpscQueue<LexedBatch> lexedQueue(queueCapacity);
+        SpscQueue<RewrittenBatch> rewrittenQueue(queueCapacity);
+        SpscQueue<ParsedBatch> parsedQueue(queueCapacity);
+        thread lexing([&] { lex(tokens, lexed, lexedQueue); });
+        thread rewriting([&] { rewrite(tokens, context, lexedQueue, rewrittenQueue); });
+        thread parsing([&] { parse(recovering ? &parsed : nullptr, rewrittenQueue, parsedQueue); });
+
+        string output;
+        size_t emitted = 0;
+        exception_ptr error;
+        try
+        {
+            output = emit(diagnostics, parsedQueue, emitted);
+        }
+        catch (...)
+        {
+            error = current_exception();
+        }
+        parsedQueue.cancel();
+        lexing.join();
+        rewriting.join();
+        parsing.join();
+        lexer.context->diagnostics = nullptr;
+
+        auto lexedStats = lexedQueue.stats();
+        auto rewrittenStats = rewrittenQueue.stats();
+        auto parsedStats = parsedQueue.stats();
+        stageStats = {
+            stage("lex", nullptr, &lexedStats),
+            stage("rewrite", &lexedStats, &rewrittenStats),
+            stage("parse", &rewrittenStats, &parsedStats),
+            stage("emit", &parsedStats, nullptr),
+        };
+        stageStats.back().batches = emitted;
+
+        if (error)
+            rethrow_exception(error);
+        return output;
+    }
+
+    // Scans windows into batches of whole statements, with the names
+    // interned and the errors reported for each.
+    void lex(TokenSource & source, Diagnostics & diagnostics, SpscQueue<LexedBatch> & output)
+    {
+        auto& symbols = *compiler.lexer->symbols;
+        auto named = symbols.end();
+        LexedBatch batch;
+        size_t tokens = 0;
+
+        // Passes on `batch`, starting the next
+        auto send = [&]
+        {
+            for (; named < symbols.end(); named++)
+                batch.names.push_back(symbols.name(named));
+            batch.add(diagnostics.take());
+            bool sent = output.push(batch);
+            batch = LexedBatch();
+            tokens = 0;
+            return sent;
+        };
+
+        try
+        {
+            TokenSource::Window window;
+            while (source.scanWindow(window))
+            {
+                tokens += window.tokens.size();
+                batch.windows.push_back(std::move(window));
+                window = TokenSource::Window();
+                if (source.openBlocks() == 0 && tokens >= batchSize && !send())
+                    break;
+            }
+            if (!batch.windows.empty())
+                send();
+        }
+        catch (...)
+        {
+            // Pass on the windows before the error, which may still hold
+            // errors of the rewriter, then the error
+            auto error = current_exception();
+            batch.partial = true;
+            if (send())
+            {
+                batch.error = error;
+                send();
+            }
+        }
+        output.close();
+    }
+
+    // Rewrites the windows of each batch, splitting the tokens into
+    // top-level statements as TokenSource::nextStatement does.
+    void rewrite(TokenSource & source, shared_ptr<CompilationContext> context,
+                 SpscQueue<LexedBatch> & input, SpscQueue<RewrittenBatch> & output)
+    {
+        Rewriter rewriter(context);
+        LexedBatch batch;
+        while (input.pop(batch))
+        {
+            RewrittenBatch rewritten;
+            rewritten.carry(batch);
+            if (batch.error)
+            {
+                output.push(rewritten);
+                break;
+            }
+
+            try
+            {
+                int depth = 0;
+                for (auto& window : batch.windows)
+                {
+                    source.rewriteWindow(window, rewriter);
+                    for (auto const& token : window.tokens)
+                    {
+                        rewritten.tokens.push_back(token);
+                        if (token.type == cream::token::BLOCK_START)
+                            depth++;
+                        else if (token.type == cream::token::BLOCK_END)
+                            depth--;
+                        else if (token.type == cream::token::NEWLINE && depth == 0)
+                            rewritten.ends.push_back(rewritten.tokens.size());
+                    }
+                }
+                size_t whole = rewritten.ends.empty() ? 0 : rewritten.ends.back();
+                if (batch.partial)
+                    rewritten.tokens.resize(whole);
+                else if (rewritten.tokens.size() > whole)
+                    rewritten.ends.push_back(rewritten.tokens.size());
+            }
+            catch (...)
+            {
+                // Pass on the whole statements before the error, then the error
+                auto error = current_exception();
+                rewritten.tokens.resize(rewritten.ends.empty() ? 0 : rewritten.ends.back());
+                if (rewritten.ends.empty() || output.push(rewritten))
+                {
+                    RewrittenBatch failed;
+                    failed.error = error;
+                    output.push(failed);
+                }
+                break;
+            }
+            if (context->diagnostics)
+                rewritten.add(context->diagnostics->take());
+            if (!output.push(rewritten))
+                break;
+        }
+        output.close();
+        input.cancel();
+    }
+
+    // Parses each batch into a tree of its own.
+    void parse(Diagnostics* diagnostics, SpscQueue<RewrittenBatch> & input, SpscQueue<ParsedBatch> & output)
+    {
+        Parser parser;
+        parser.iterative = compiler.parser->iterative;
+        parser.diagnostics = diagnostics;
+        RewrittenBatch batch;
+        while (input.pop(batch))
+        {
+            ParsedBatch parsed;
+            parsed.carry(batch);
+            if (!parsed.error)
+            {
+                try
+                {
+                    parsed.ast = parser.parse(batch.tokens, batch.ends);
+                }
+                catch (...)
+                {
+                    parsed.error = current_exception();
+                }
+                if (diagnostics)
+                    parsed.add(diagnostics->take());
+            }
+            if (!output.push(parsed) || parsed.error)
+                break;
+        }
+        output.close();
+        input.cancel();
+    }
+
+    // Compiles each tree in turn, joining the outputs as one tree's
+    // statements would be. Reports what the stages found as it arrives,
+    // and rethrows the first error.
+    string emit(Diagnostics* diagnostics, SpscQueue<ParsedBatch> & input, size_t & emitted)
+    {
+        auto symbols = make_shared<Interner>();
+        string output;
+        size_t statements = 0;
+        ParsedBatch batch;
+        while (input.pop(batch))
+        {
+            emitted++;
+            for (auto name : batch.names)
+                symbols->intern(name);
+            for (auto const& diagnostic : batch.diagnostics)
+            {
+                if (diagnostics)
+                    diagnostics->report(diagnostic);
+            }
+            if (batch.error)
+                rethrow_exception(batch.error);
+            if ((diagnostics && diagnostics->hasErrors()) || batch.ast.root.statements.size() == 0)
+                continue;
+
+            batch.ast.symbols = symbols;
+            if (statements)
+                output += "\n";
+            output += compiler.backend->compile(batch.ast);
+            statements += batch.ast.root.statements.size();
+        }
+        if (diagnostics && diagnostics->hasErrors())
+            return "";
+        return output;
+    }
+
+    // Gets the stats of the stage between the queues with stats `input`
+    // and `output`, either of which may be NULL.
+    static StageStats stage(const string & name, const QueueStats* input, const QueueStats* output)
+    {
+        StageStats stats;
+        stats.name = name;
+        if (input)
+        {
+            stats.starved = input->emptyStalls;
+            stats.starvedMilliseconds = input->emptyMilliseconds;
+        }
+        if (output)
+        {
+            stats.batches = output->pushes;
+            stats.blocked = output->fullStalls;
+            stats.blockedMilliseconds = output->fullMilliseconds;
+            stats.meanQueued = output->meanOccupancy;
+            stats.peakQueued = output->peak;
+        }
+        return stats;
+    }
+
+    Compiler & compiler;
+    vector<StageStats> stageStats;
+};
+
+void testPipeline()
+{
+    cout << "Testing Pipeline" << endl;
+
+    {
+        // Test a pipelined compile gives the output of a sequential one,
+        // for batches of one statement and of many, in both parser modes
+        const char* sources[] =
+        {
+            "",
+            "a = 1",
+            "a = 1\nb = 2",
+            "int main() ->\n  return 42",
+            "int main() ->\n  a = 1\n  return a\n",
+            "f = (double a, double b) -> return a\nc = 'd'\n",
+            "x = () -> y = () -> 1\n",
+            "a\n  () ->\n    b\n",
+        };
+        Compiler compiler;
+        Pipeline pipeline(compiler);
+        for (size_t batchSize : { (size_t) 1, Pipeline::defaultBatchSize })
+        {
+            for (bool iterative : { false, true })
+            {
+                pipeline.batchSize = batchSize;
+                compiler.parser->iterative = iterative;
+                for (auto source : sources)
+                    assert(pipeline.compile(source) == Compiler().compile(source));
+            }
+        }
+        compiler.parser->iterative = false;
+    }
+
+    {
+        // Test a large module streams through every stage in many batches,
+        // with queues that fill up
+        string module;
+        for (int i = 0; i < 2000; i++)
+        {
+            auto n = to_string(i);
+            module += "int f" + n + "(int a, int b) -> return a * " + n + " + b << 1\n"
+                      "g" + n + " = (double x) -> return (x / " + n + ")\n"
+                      "h" + n + " = 'h' == i && j\n";
+        }
+        Compiler compiler;
+        auto expected = compiler.compile(module);
+        Pipeline pipeline(compiler);
+        pipeline.batchSize = 64;
+        pipeline.queueCapacity = 2;
+        assert(pipeline.compile(module) == expected);
+
+        auto const& stats = pipeline.stats();
+        assert(stats.size() == 4);
+        assert(stats[0].name == "lex" && stats[3].name == "emit");
+        assert(stats[0].batches > 100);
+        for (auto const& stat : stats)
+            assert(stat.batches == stats[0].batches);
+        for (size_t i = 0; i < 3; i++)
+            assert(stats[i].peakQueued >= 1 && stats[i].peakQueued <= 2);
+        assert(stats[0].starved == 0 && stats[3].blocked == 0);
+    }
+
+    {
+        // Test errors and diagnostics match a sequential compile
+        const char* broken[] =
+        {
+            "a = 1\nb = 2 *\nc = )\nd = 'e\n",
+            "a = 1\nb = (2\n",
+            "a\n  b\n      c\nd = )\ne\n",
+            "g = () ->\n  h = 1\nb = )\nc = 2 *\nd = 3 ,\n      e = 5\nf = 'g\n",
+        };
+        Compiler compiler;
+        Pipeline pipeline(compiler);
+        for (size_t batchSize : { (size_t) 1, Pipeline::defaultBatchSize })
+        {
+            pipeline.batchSize = batchSize;
+            for (auto source : broken)
+            {
+                string expectedError, error;
+                try { compiler.compile(source); }
+                catch (CreamError& e) { expectedError = e.what(); }
+                try { pipeline.compile(source); }
+                catch (CreamError& e) { error = e.what(); }
+                assert(!error.empty() && error == expectedError);
+
+                Diagnostics expected, diagnostics;
+                compiler.compile(source, expected);
+                assert(pipeline.compile(source, diagnostics) == "");
+                assert(diagnostics.errorCount() == expected.errorCount());
+                assert(diagnostics.list().size() == expected.list().size());
+            }
+        }
+
+        // Test the limit of errors stops every stage
+        string source;
+        for (int i = 0; i < 1000; i++)
+            source += "a" + to_string(i) + " = \n";
+        Diagnostics diagnostics(10);
+        pipeline.batchSize = 4;
+        assert(pipeline.compile(source, diagnostics) == "");
+        assert(diagnostics.errorCount() == 10);
+        assert(pipeline.compile("a = 1") == "a = 1;");
+    }
+}
+
+} // end cream::compiler
+
+using Pipeline = cream::compiler::Pipeline;
+using StageStats = cream::compiler::StageStats;
+
+} // end cream
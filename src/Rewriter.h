@@ -2,11 +2,18 @@
 #pragma once
 
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
+#include "CompilationContext.h"
 #include "Common.h"
+#include "FusedRewriter.h"
+#include "Grammar.h"
+#include "LineTable.h"
 #include "Lexer.h"
+#include "PassManager.h"
 #include "Token.h"
+#include "TokenStream.h"
 #include "Util.h"
 
 namespace cream {
@@ -17,32 +24,64 @@ using namespace std;
 class Rewriter
 {
 public:
-    Rewriter() {}
-    virtual ~Rewriter() {}
-
-    vector<Token> rewrite(vector<Token> tokens)
+    // Constructs a Rewriter giving implicit tokens positions from `context`.
+    Rewriter(shared_ptr<CompilationContext> context=make_shared<CompilationContext>())
+        : context(context)
     {
-        auto tokenList = Util::vec2list(tokens);
-
         // Whitespace
-        removeEmptyLines(tokenList);
-        addIndents(tokenList);
-        removeWhitespace(tokenList);
-        rewriteIndents(tokenList);
+        passes.add("removeEmptyLines", &Rewriter::removeEmptyLines);
+        passes.add("addIndents", &Rewriter::addIndents, { "removeEmptyLines" });
+        passes.add("removeWhitespace", &Rewriter::removeWhitespace);
+        passes.add("rewriteIndents", &Rewriter::rewriteIndents, { "addIndents" });
 
         // Metadata
-        addExpressionMetadata(tokenList);
-        addBlockMetadata(tokenList);
+        passes.add("addExpressionMetadata", &Rewriter::addExpressionMetadata);
+        passes.add("addBlockMetadata", &Rewriter::addBlockMetadata, { "rewriteIndents" });
 
         // Words
-        rewriteKeywords(tokenList);
-        rewriteTypes(tokenList);
+        passes.add("rewriteKeywords", &Rewriter::rewriteKeywords);
+        passes.add("rewriteTypes", &Rewriter::rewriteTypes, { "removeWhitespace", "rewriteKeywords" });
 
         // Expressions
-        rewriteReturnExpressions(tokenList);
-        rewriteLambdaExpressions(tokenList);
+        passes.add("rewriteReturnExpressions", &Rewriter::rewriteReturnExpressions,
+                   { "removeWhitespace", "rewriteKeywords" });
+        passes.add("rewriteLambdaExpressions", &Rewriter::rewriteLambdaExpressions,
+                   { "removeWhitespace", "addExpressionMetadata" });
+    }
+    virtual ~Rewriter() {}
+
+    // Context of the current compilation
+    shared_ptr<CompilationContext> context;
+
+    // The passes, in the order they run
+    PassManager<Rewriter> passes;
+
+    vector<Token> rewrite(vector<Token> tokens, const LineTable & lines)
+    {
+        this->lines = &lines;
+        auto tokenList = Util::vec2list(tokens);
+        passes.run(*this, tokenList);
+
+        auto rewritten = Util::list2vec(tokenList);
+        Pair::link(rewritten);
+        return rewritten;
+    }
+
+    // Rewrites a scanned TokenStream in one fused pass, running the passes
+    // to report an error. The passes also run when some are disabled or
+    // being timed, since the fused pass does the work of them all.
+    TokenStream rewrite(const TokenStream & stream)
+    {
+        TokenStream output;
+        if (passes.allEnabled() && !passes.timing && fused.rewrite(stream, output))
+            return output;
+        return rewritePasses(stream);
+    }
 
-        return Util::list2vec(tokenList);
+    // Rewrites a scanned TokenStream with each pass over a token list.
+    TokenStream rewritePasses(const TokenStream & stream)
+    {
+        return TokenStream::fromTokens(stream, rewrite(stream.tokens(), *stream.lines));
     }
 
     void addIndents(list<Token> &tokenList)
@@ -52,22 +91,19 @@ public:
             auto const& token = *iter;
             auto prev = iter; prev--;
 
-            if (token.meta.line == 1)
+            if (token.meta.line == 1 || iter == tokenList.begin())
                 continue;
 
             if (token.meta.column == 1)
             {
-                int thisLevel = token.line->indentLevel();
-                int prevLevel = prev->line->indentLevel();
+                int thisLevel = lines->indentLevel(token.meta.line - 1);
+                int prevLevel = lines->indentLevel(prev->meta.line - 1);
                 int shift = thisLevel - prevLevel;
                 if (shift > 0)
                 {
                     if (shift > 1)
                     {
-                        throw CreamError(
-                            "Unexpected indent on line " +
-                             to_string(token.meta.line) + "\n"
-                        );
+                        throw CreamError("Unexpected indent\n", { token.meta.line, 1 });
                     }
                     else
                     {
@@ -94,7 +130,7 @@ public:
         for (auto iter = tokenList.begin(); iter != tokenList.end(); iter++)
         {
             auto const& token = *iter;
-            if (token.name == "Newline" && token.line->isEmpty())
+            if (token.name == "Newline" && lines->isEmpty(token.meta.line - 1))
             {
                 iter = tokenList.erase(iter);
                 iter--;
@@ -122,10 +158,11 @@ public:
             auto & token = *iter;
             if (token.type == cream::token::IDENTIFIER)
             {
-                if (token.value == "return")
+                auto word = grammar::keywordFor(token.symbol);
+                if (word && word->type == cream::token::KEYWORD)
                 {
-                    token.type = cream::token::KEYWORD;
-                    token.name = "Return";
+                    token.type = word->type;
+                    token.name = word->name;
                 }
             }
         }
@@ -193,24 +230,24 @@ public:
             auto next = iter; next++;
             if (token.type == cream::token::KEYWORD)
             {
-                if (token.value != "return")
+                if (token.symbol != interner::SYMBOL_RETURN)
                     continue;
-                if (next->type == cream::token::EXPRESSION_START)
+                if (next != listEnd && next->type == cream::token::EXPRESSION_START)
                     continue;
 
                 // Create implicit pair
-                auto expressionStart = new Token { cream::token::EXPRESSION_START, "Expression Start", "(" };
-                auto expressionEnd = new Token { cream::token::EXPRESSION_END, "Expression End", ")" };
-                Token::makeImplicitPair(*expressionStart, *expressionEnd);
+                Token expressionStart { cream::token::EXPRESSION_START, "Expression Start", "(" };
+                Token expressionEnd { cream::token::EXPRESSION_END, "Expression End", ")" };
+                Token::makeImplicitPair(expressionStart, expressionEnd, *context);
 
                 // Find statement end (TODO: Rewrite newlines)
-                auto newline = Token::nextNewline(iter, listEnd);
+                auto newline = lineEnd(iter, listEnd);
 
                 // Insert implicit start before next
-                tokenList.insert(next, *expressionStart);
+                tokenList.insert(next, expressionStart);
 
                 // Insert implicit end before statement end
-                tokenList.insert(newline, *expressionEnd);
+                tokenList.insert(newline, expressionEnd);
             }
         }
     }
@@ -232,19 +269,16 @@ public:
             }
             else if (token.name == "Block End")
             {
-                end = &token;
-                start = startTokens.back();
-                Token::makeImplicitPair(*start, *end);
-
                 if (depth == 0)
                 {
-                    throw CreamError(
-                        "Extra block end found at "
-                        "line " + to_string(token.meta.line) + ", "
-                        "column " + to_string(token.meta.column) + "\n"
-                    );
+                    throw CreamError("Extra block end found\n",
+                                     { token.meta.line, token.meta.column });
                 }
 
+                end = &token;
+                start = startTokens.back();
+                Token::makeImplicitPair(*start, *end, *context);
+
                 startTokens.pop_back();
                 depth--;
             }
@@ -253,35 +287,22 @@ public:
 
     void addExpressionMetadata(list<Token> &tokenList)
     {
-        list<Token*> startTokens;
+        // Pairs are found by nesting, so only check each end has a start
         int depth = 0;
         for (auto iter = tokenList.begin(); iter != tokenList.end(); iter++)
         {
             auto & token = *iter;
-            Token* start;
-            Token* end;
             if (token.name == "Expression Start")
             {
-                start = &token;
-                startTokens.push_back(start);
                 depth++;
             }
             else if (token.name == "Expression End")
             {
-                end = &token;
-                start = startTokens.back();
-                Token::makePair(*start, *end);
-
                 if (depth == 0)
                 {
-                    throw CreamError(
-                        "Extra closing parenthesis found at "
-                        "line " + to_string(token.meta.line) + ", "
-                        "column " + to_string(token.meta.column) + "\n"
-                    );
+                    throw CreamError("Extra closing parenthesis found\n",
+                                     { token.meta.line, token.meta.column });
                 }
-
-                startTokens.pop_back();
                 depth--;
             }
         }
@@ -298,13 +319,14 @@ public:
                 auto prev = iter; prev--;
 
                 // Replace left side with param list
-                if (prev->type != cream::token::EXPRESSION_END)
+                if (iter == tokenList.begin() || prev->type != cream::token::EXPRESSION_END)
                 {
                     // Insert empty param list
-                    auto paramsStart = new Token { cream::token::PARAMS_START, "Params Start", "(" };
-                    auto paramsEnd = new Token { cream::token::PARAMS_END, "Params End", ")" };
-                    tokenList.insert(iter, *paramsStart);
-                    tokenList.insert(iter, *paramsEnd);
+                    Token paramsStart { cream::token::PARAMS_START, "Params Start", "(" };
+                    Token paramsEnd { cream::token::PARAMS_END, "Params End", ")" };
+                    Token::makeImplicitPair(paramsStart, paramsEnd, *context);
+                    tokenList.insert(iter, paramsStart);
+                    tokenList.insert(iter, paramsEnd);
                 }
                 else
                 {
@@ -321,28 +343,24 @@ public:
                 }
 
                 // Skip newlines
-                while (next->type == cream::token::NEWLINE ||
-                       next->type == cream::token::WHITESPACE)
+                while (next != tokenList.end() &&
+                       (next->type == cream::token::NEWLINE ||
+                        next->type == cream::token::WHITESPACE))
                     next = tokenList.erase(next);
 
                 // Replace right side with block
-                if (next->type != cream::token::BLOCK_START)
+                if (next == tokenList.end() || next->type != cream::token::BLOCK_START)
                 {
                     // Create tokens to insert
-                    auto blockIter = next;
-                    auto blockStart = new Token { cream::token::BLOCK_START, "Block Start", "{" };
-                    auto blockEnd = new Token { cream::token::BLOCK_END, "Block End", "}" };
-                    Token::makeImplicitPair(*blockStart, *blockEnd);
+                    Token blockStart { cream::token::BLOCK_START, "Block Start", "{" };
+                    Token blockEnd { cream::token::BLOCK_END, "Block End", "}" };
+                    Token::makeImplicitPair(blockStart, blockEnd, *context);
 
                     // Insert block start after arrow
-                    auto start = tokenList.insert(next, *blockStart);
+                    auto start = tokenList.insert(next, blockStart);
 
                     // Insert block end before newline
-                    while (blockIter->type != cream::token::NEWLINE && blockIter != tokenList.end())
-                    {
-                        blockIter++;
-                    }
-                    auto end = tokenList.insert(blockIter, *blockEnd);
+                    tokenList.insert(lineEnd(next, tokenList.end()), blockEnd);
 
                     // Advance main iterator to block start
                     iter = start;
@@ -356,6 +374,22 @@ public:
             }
         }
     }
+
+    // Gets the end of the line holding `iter`: the next newline, or the
+    // blocks closed at the end of the source.
+    template <typename Iterator>
+    static Iterator lineEnd(Iterator iter, Iterator end)
+    {
+        while (iter != end &&
+               iter->type != cream::token::NEWLINE &&
+               iter->type != cream::token::BLOCK_END)
+            iter++;
+        return iter;
+    }
+
+private:
+    const LineTable* lines = NULL;
+    FusedRewriter fused;
 };
 
 } // end cream::rewriter
@@ -1,33 +1,161 @@
 
 #pragma once
 
-#include <string>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Common.h"
 
 namespace cream {
 namespace scanner {
 
 using namespace std;
 
+/**
+ * A read-only memory mapping of a source file.
+ *
+ * The mapping is padded so the byte after the last character is always a
+ * readable NUL sentinel, even when the file size is a multiple of the page
+ * size or the file is empty.
+ */
+
+class MappedFile
+{
+public:
+    MappedFile(const string& path)
+        : data(NULL),
+          size(0),
+          mapped(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw CreamError("Could not open '" + path + "'");
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+        {
+            ::close(fd);
+            throw CreamError("Could not map '" + path + "'");
+        }
+
+        // Reserve room for the file plus at least one zeroed byte
+        size_t page = (size_t) ::sysconf(_SC_PAGESIZE);
+        size = (size_t) info.st_size;
+        mapped = (size / page + 1) * page;
+        void* base = ::mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        // Map the file over the start of the reservation
+        if (base != MAP_FAILED && size > 0 &&
+            ::mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            ::munmap(base, mapped);
+            base = MAP_FAILED;
+        }
+        ::close(fd);
+
+        if (base == MAP_FAILED)
+            throw CreamError("Could not map '" + path + "'");
+
+        data = (const char*) base;
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+            ::munmap((void*) data, mapped);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Gets the mapped file contents, not including the sentinel.
+    string_view view() const
+    {
+        return string_view(data, size);
+    }
+
+    const char* data;
+    size_t size;
+    size_t mapped;
+};
+
+/**
+ * A view of a source that is followed by a NUL sentinel, so it can be
+ * scanned in place. A string or a C string always is, so either converts
+ * to one; a bare string_view need not be, so it must be copied into a
+ * string first.
+ */
+
+class SourceText
+{
+public:
+    SourceText(const string & text)
+        : text(text)
+    {}
+
+    SourceText(const char* text)
+        : text(text)
+    {}
+
+    // Gets the text, without the sentinel.
+    string_view view() const
+    {
+        return text;
+    }
+
+    // Gets the length of the text in bytes.
+    size_t size() const
+    {
+        return text.size();
+    }
+
+private:
+    string_view text;
+};
+
+/**
+ * The Scanner class.
+ *
+ * Scans a view of the source, which is either owned by the scanner, borrowed
+ * from the caller or memory mapped from a file. In every mode the character
+ * at `length()` is a NUL sentinel, so `peek`, `next` and `seek` read
+ * directly from the buffer for any position in [0, length()].
+ */
+
 class Scanner
 {
 public:
     Scanner(string source="")
-        : source(source),
-          position(0)
-    {}
+        : position(0)
+    {
+        load(std::move(source));
+    }
+
+    Scanner(const Scanner&) = delete;
+    Scanner& operator=(const Scanner&) = delete;
 
     // Seeks `n` characters from current position.
-    char seek(int n)
+    char seek(int64_t n)
     {
         position += n;
-        return at(position);
+        return source.data()[position];
     }
 
     // Peeks at `offset` from current position.
-    char peek(int offset = 0)
+    char peek(int64_t offset = 0)
     {
-        return at(position + offset);
+        return source.data()[position + offset];
     }
 
     // Gets next character, seeking forward.
@@ -48,37 +176,78 @@ public:
         return peek(0);
     }
 
-    // Gets character from the source at `pos`.
-    char at(int pos)
+    // Gets character from the source at `pos`, or 0 when out of range.
+    char at(int64_t pos)
     {
-        if (pos >= 0 && pos < source.length())
-            return source.at(pos);
+        if (pos >= 0 && pos < length())
+            return source[pos];
         else
             return 0;
     }
 
     // Moves to position `pos` in the source.
-    void to(int pos)
+    void to(int64_t pos)
     {
         this->position = pos;
     }
 
+    // Checks whether `pos` is past the last character.
+    bool atEnd(int64_t pos)
+    {
+        return pos >= length();
+    }
+
+    // Gets the first position from `pos` that `kernel` does not skip.
+    template <typename Kernel>
+    int64_t skip(int64_t pos, Kernel kernel)
+    {
+        const char* data = source.data();
+        return kernel(data + pos, data + source.size()) - data;
+    }
+
+    // Gets the source between positions `start` and `end`.
+    string_view slice(int64_t start, int64_t end)
+    {
+        return source.substr(start, end - start);
+    }
+
     // Gets the number of remaining characters.
-    int remaining()
+    int64_t remaining()
     {
         return length() - (position + 1);
     }
 
     // Gets the length of the source in bytes.
-    int length()
+    int64_t length()
     {
-        return (int) source.length();
+        return (int64_t) source.length();
     }
 
-    // Loads a new source to scan.
+    // Loads a new source to scan, taking ownership of it.
     void load(string source)
     {
-        this->source = source;
+        mapping.reset();
+        storage = make_shared<string>(std::move(source));
+        this->source = *storage;
+        rewind();
+    }
+
+    // Borrows a source without copying it.
+    // The caller keeps `source` alive while scanning.
+    void borrow(SourceText source)
+    {
+        mapping.reset();
+        storage.reset();
+        this->source = source.view();
+        rewind();
+    }
+
+    // Maps the file at `path` and scans it in place.
+    void map(const string& path)
+    {
+        storage.reset();
+        mapping = make_shared<MappedFile>(path);
+        this->source = mapping->view();
         rewind();
     }
 
@@ -88,34 +257,283 @@ public:
         position = 0;
     }
 
-    string source;
-    int position;
+    // Gets the object keeping an owned or mapped source alive, or NULL
+    // for a borrowed source.
+    shared_ptr<const void> owner()
+    {
+        if (mapping)
+            return mapping;
+        return storage;
+    }
+
+    // Slices stay valid while the source is alive.
+    static constexpr bool stable = true;
+
+    string_view source;
+    int64_t position;
+
+private:
+    shared_ptr<string> storage;
+    shared_ptr<MappedFile> mapping;
+};
+
+/**
+ * The StreamScanner class.
+ *
+ * Scans a file descriptor through a fixed-size window, refilling it as
+ * positions past its end are read. Positions are absolute 64-bit offsets
+ * into the stream. The window keeps every byte from the current position
+ * onward, so lookahead across a refill sees the same characters as the
+ * in-memory Scanner, and a NUL sentinel follows the last byte read.
+ */
+
+class StreamScanner
+{
+public:
+    StreamScanner(int fd, size_t windowSize=1 << 16)
+        : position(0),
+          fd(fd),
+          base(0),
+          count(0),
+          eof(false),
+          window(windowSize + 1, '\0')
+    {}
+
+    StreamScanner(const StreamScanner&) = delete;
+    StreamScanner& operator=(const StreamScanner&) = delete;
+
+    // Seeks `n` characters from current position.
+    char seek(int64_t n)
+    {
+        position += n;
+        return fetch(position);
+    }
+
+    // Peeks at `offset` from current position.
+    char peek(int64_t offset = 0)
+    {
+        return fetch(position + offset);
+    }
+
+    // Gets next character, seeking forward.
+    char next()
+    {
+        return seek(1);
+    }
+
+    // Gets current character, without moving.
+    char current()
+    {
+        return peek(0);
+    }
+
+    // Moves to position `pos` in the stream.
+    void to(int64_t pos)
+    {
+        this->position = pos;
+    }
+
+    // Checks whether `pos` is past the last character of the stream.
+    bool atEnd(int64_t pos)
+    {
+        fetch(pos);
+        return eof && pos >= base + (int64_t) count;
+    }
+
+    // Gets the first position from `pos` that `kernel` does not skip,
+    // refilling the window while the run reaches its end.
+    template <typename Kernel>
+    int64_t skip(int64_t pos, Kernel kernel)
+    {
+        while (true)
+        {
+            int64_t offset = pos - base;
+            if (offset < (int64_t) count)
+            {
+                const char* start = &window[offset];
+                const char* end = &window[count];
+                const char* stop = kernel(start, end);
+                pos += stop - start;
+                if (stop != end)
+                    return pos;
+            }
+            if (eof)
+                return pos;
+            refill(pos);
+        }
+    }
+
+    // Gets the window between positions `start` and `end`, which must not
+    // be before the current position. Valid until the next refill.
+    string_view slice(int64_t start, int64_t end)
+    {
+        return string_view(&window[start - base], end - start);
+    }
+
+    // Slices are only valid until the next refill.
+    static constexpr bool stable = false;
+
+    // Gets the size of the window in bytes.
+    size_t windowSize()
+    {
+        return window.size() - 1;
+    }
+
+    int64_t position;
+
+private:
+    // Gets the character at `pos`, refilling the window when needed.
+    char fetch(int64_t pos)
+    {
+        int64_t offset = pos - base;
+        if (offset >= 0 && offset < (int64_t) count)
+            return window[offset];
+        if (offset >= (int64_t) count && !eof)
+        {
+            refill(pos);
+            offset = pos - base;
+            if (offset < (int64_t) count)
+                return window[offset];
+        }
+        return 0;
+    }
+
+    // Slides the window forward to the current position and reads
+    // until `pos` is inside it or the stream ends.
+    void refill(int64_t pos)
+    {
+        // Drop bytes before the current position
+        int64_t keep = max(base, min(position, pos));
+        size_t dropped = (size_t) min<int64_t>(keep - base, count);
+        memmove(&window[0], &window[dropped], count - dropped);
+        base += dropped;
+        count -= dropped;
+
+        while (!eof && pos >= base + (int64_t) count)
+        {
+            // Grow only when a single lookahead spans the whole window
+            if (count == windowSize())
+                window.resize(window.size() * 2);
+
+            ssize_t bytes = ::read(fd, &window[count], windowSize() - count);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes < 0)
+                throw CreamError("Could not read source stream");
+            if (bytes == 0)
+                eof = true;
+            count += (size_t) bytes;
+        }
+        window[count] = '\0';
+    }
+
+    int fd;
+    int64_t base;
+    size_t count;
+    bool eof;
+    vector<char> window;
 };
 
 void testScanner()
 {
     cout << "Testing Scanner" << endl;
-    string source = "123 abc";
-    Scanner scanner(source);
-    assert(scanner.length() == 7);
-    assert(scanner.peek() == '1');
-    assert(scanner.next() == '2');
-    assert(scanner.peek(1) == '3');
-    assert(scanner.peek(-1) == '1');
-    assert(scanner.at(3) == ' ');
-
-    scanner.to(4);
-    assert(scanner.remaining() == 2);
-    assert(scanner.peek() == 'a');
-    assert(scanner.next() == 'b');
-    assert(scanner.current() == 'b');
-    assert(scanner.prev() == 'a');
-    assert(scanner.seek(2) == 'c');
-    assert(scanner.seek(-1) == 'b');
+
+    {
+        // Test owned source
+        string source = "123 abc";
+        Scanner scanner(source);
+        assert(scanner.length() == 7);
+        assert(scanner.peek() == '1');
+        assert(scanner.next() == '2');
+        assert(scanner.peek(1) == '3');
+        assert(scanner.peek(-1) == '1');
+        assert(scanner.at(3) == ' ');
+
+        scanner.to(4);
+        assert(scanner.remaining() == 2);
+        assert(scanner.peek() == 'a');
+        assert(scanner.next() == 'b');
+        assert(scanner.current() == 'b');
+        assert(scanner.prev() == 'a');
+        assert(scanner.seek(2) == 'c');
+        assert(scanner.seek(-1) == 'b');
+    }
+
+    {
+        // Test borrowed source and sentinel
+        string source = "abc";
+        Scanner scanner;
+        scanner.borrow(source);
+        assert(scanner.source.data() == source.data());
+        assert(scanner.length() == 3);
+        assert(scanner.seek(2) == 'c');
+        assert(scanner.next() == '\0');
+        assert(scanner.atEnd(scanner.position));
+        assert(scanner.at(-1) == 0);
+        assert(scanner.at(3) == 0);
+    }
+
+    {
+        // Test only sources known to be terminated are borrowed, so a view
+        // into the middle of a buffer must be copied first
+        static_assert(is_convertible<const string&, SourceText>::value, "");
+        static_assert(is_convertible<const char*, SourceText>::value, "");
+        static_assert(!is_convertible<string_view, SourceText>::value, "");
+        string buffer = "abcdef";
+        string middle(string_view(buffer).substr(1, 2));
+        Scanner scanner;
+        scanner.borrow(middle);
+        assert(scanner.source == "bc");
+        assert(scanner.peek(2) == '\0');
+    }
+
+    {
+        // Test mapped source and sentinel
+        char path[] = "/tmp/cream-scanner-XXXXXX";
+        int fd = ::mkstemp(path);
+        assert(fd >= 0);
+        string source(::sysconf(_SC_PAGESIZE), 'x');
+        ssize_t written = ::write(fd, source.data(), source.size());
+        assert(written == (ssize_t) source.size());
+        ::close(fd);
+
+        Scanner scanner;
+        scanner.map(path);
+        assert(scanner.length() == (int64_t) source.size());
+        assert(scanner.source == source);
+        assert(scanner.peek(scanner.length()) == '\0');
+        ::unlink(path);
+    }
+
+    {
+        // Test streamed source across window refills
+        int fds[2];
+        int piped = ::pipe(fds);
+        assert(piped == 0);
+        string source = "abcdefghij";
+        ssize_t written = ::write(fds[1], source.data(), source.size());
+        assert(written == (ssize_t) source.size());
+        ::close(fds[1]);
+
+        StreamScanner scanner(fds[0], 4);
+        scanner.position = -1;
+        string scanned;
+        while (!scanner.atEnd(scanner.position + 1))
+        {
+            assert(scanner.peek(1) == source[scanner.position + 1]);
+            scanned += scanner.next();
+        }
+        assert(scanned == source);
+        assert(scanner.windowSize() == 4);
+        assert(scanner.next() == '\0');
+        ::close(fds[0]);
+    }
 }
 
 } // end cream::scanner
 
+using SourceText = cream::scanner::SourceText;
 using Scanner = cream::scanner::Scanner;
+using StreamScanner = cream::scanner::StreamScanner;
 
 } // end cream
@@ -0,0 +1,361 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "Symbol.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CREAM_SIMD_X86 1
+#endif
+
+namespace cream {
+namespace simd {
+
+using namespace std;
+using symbol::characters;
+
+/**
+ * Kernels for skipping runs of characters.
+ *
+ * Each kernel returns the first pointer in [p, end) that does not belong to
+ * the run, or `end`. Vector kernels only load whole blocks inside the range
+ * and finish the tail with the scalar kernel.
+ */
+
+enum Level
+{
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+struct Kernels
+{
+    Level level;
+    const char* (*identifier)(const char* p, const char* end);
+    const char* (*number)(const char* p, const char* end);
+    const char* (*blank)(const char* p, const char* end);
+    const char* (*string)(const char* p, const char* end, char delimiter);
+};
+
+// Scalar kernels
+
+template <uint8_t flags>
+inline const char* skipClassScalar(const char* p, const char* end)
+{
+    while (p < end && characters.is(*p, flags))
+        p++;
+    return p;
+}
+
+inline const char* skipStringScalar(const char* p, const char* end, char delimiter)
+{
+    while (p < end && *p != delimiter && *p != '\\' && *p != '\0')
+        p++;
+    return p;
+}
+
+#ifdef CREAM_SIMD_X86
+
+// SSE2 kernels
+
+inline __m128i inRange128(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), v));
+}
+
+inline __m128i identifierMask128(__m128i v)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = inRange128(lower, 'a', 'z');
+    __m128i digit = inRange128(v, '0', '9');
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), under);
+}
+
+inline __m128i numberMask128(__m128i v)
+{
+    return _mm_or_si128(inRange128(v, '0', '9'),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+}
+
+inline __m128i blankMask128(__m128i v)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+}
+
+inline __m128i stringMask128(__m128i v, __m128i delimiter)
+{
+    __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, delimiter),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return _mm_xor_si128(stop, _mm_set1_epi8(-1));
+}
+
+// Finds the first byte outside `mask`, or returns false for a full block.
+inline bool firstOutside128(__m128i mask, const char*& p)
+{
+    unsigned outside = ~(unsigned) _mm_movemask_epi8(mask) & 0xFFFF;
+    if (!outside)
+        return false;
+    p += __builtin_ctz(outside);
+    return true;
+}
+
+template <__m128i (*mask)(__m128i), uint8_t flags>
+inline const char* skipClassSse2(const char* p, const char* end)
+{
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        if (firstOutside128(mask(v), p))
+            return p;
+    }
+    return skipClassScalar<flags>(p, end);
+}
+
+inline const char* skipStringSse2(const char* p, const char* end, char delimiter)
+{
+    __m128i quote = _mm_set1_epi8(delimiter);
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        if (firstOutside128(stringMask128(v, quote), p))
+            return p;
+    }
+    return skipStringScalar(p, end, delimiter);
+}
+
+// AVX2 kernels
+
+#define CREAM_AVX2 __attribute__((target("avx2")))
+
+CREAM_AVX2 inline __m256i inRange256(__m256i v, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+CREAM_AVX2 inline __m256i identifierMask256(__m256i v)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = inRange256(lower, 'a', 'z');
+    __m256i digit = inRange256(v, '0', '9');
+    __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), under);
+}
+
+CREAM_AVX2 inline __m256i numberMask256(__m256i v)
+{
+    return _mm256_or_si256(inRange256(v, '0', '9'),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+}
+
+CREAM_AVX2 inline __m256i blankMask256(__m256i v)
+{
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+}
+
+CREAM_AVX2 inline __m256i stringMask256(__m256i v, __m256i delimiter)
+{
+    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, delimiter),
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    return _mm256_xor_si256(stop, _mm256_set1_epi8(-1));
+}
+
+CREAM_AVX2 inline bool firstOutside256(__m256i mask, const char*& p)
+{
+    unsigned outside = ~(unsigned) _mm256_movemask_epi8(mask);
+    if (!outside)
+        return false;
+    p += __builtin_ctz(outside);
+    return true;
+}
+
+CREAM_AVX2 inline const char* skipIdentifierAvx2(const char* p, const char* end)
+{
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        if (firstOutside256(identifierMask256(v), p))
+            return p;
+    }
+    return skipClassSse2<identifierMask128, symbol::CLASS_IDENTIFIER>(p, end);
+}
+
+CREAM_AVX2 inline const char* skipNumberAvx2(const char* p, const char* end)
+{
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        if (firstOutside256(numberMask256(v), p))
+            return p;
+    }
+    return skipClassSse2<numberMask128, symbol::CLASS_NUMBER>(p, end);
+}
+
+CREAM_AVX2 inline const char* skipBlankAvx2(const char* p, const char* end)
+{
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        if (firstOutside256(blankMask256(v), p))
+            return p;
+    }
+    return skipClassSse2<blankMask128, symbol::CLASS_BLANK>(p, end);
+}
+
+CREAM_AVX2 inline const char* skipStringAvx2(const char* p, const char* end, char delimiter)
+{
+    __m256i quote = _mm256_set1_epi8(delimiter);
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        if (firstOutside256(stringMask256(v, quote), p))
+            return p;
+    }
+    return skipStringSse2(p, end, delimiter);
+}
+
+#undef CREAM_AVX2
+
+#endif // CREAM_SIMD_X86
+
+/**
+ * Gets the kernels for an instruction set level.
+ */
+
+inline Kernels kernelsFor(Level level)
+{
+#ifdef CREAM_SIMD_X86
+    if (level == AVX2)
+    {
+        return { AVX2, skipIdentifierAvx2, skipNumberAvx2,
+                 skipBlankAvx2, skipStringAvx2 };
+    }
+    if (level == SSE2)
+    {
+        return { SSE2,
+                 skipClassSse2<identifierMask128, symbol::CLASS_IDENTIFIER>,
+                 skipClassSse2<numberMask128, symbol::CLASS_NUMBER>,
+                 skipClassSse2<blankMask128, symbol::CLASS_BLANK>,
+                 skipStringSse2 };
+    }
+#endif
+    return { SCALAR,
+             skipClassScalar<symbol::CLASS_IDENTIFIER>,
+             skipClassScalar<symbol::CLASS_NUMBER>,
+             skipClassScalar<symbol::CLASS_BLANK>,
+             skipStringScalar };
+}
+
+/**
+ * Gets the best level supported by the running CPU.
+ */
+
+inline Level supportedLevel()
+{
+#ifdef CREAM_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    return SSE2;
+#else
+    return SCALAR;
+#endif
+}
+
+/**
+ * Gets the kernels selected for this process, chosen once at first use.
+ */
+
+inline const Kernels& kernels()
+{
+    static const Kernels selected = kernelsFor(supportedLevel());
+    return selected;
+}
+
+// Skips identifier characters: A-Z a-z 0-9 _
+inline const char* skipIdentifier(const char* p, const char* end)
+{
+    return kernels().identifier(p, end);
+}
+
+// Skips number characters: 0-9 .
+inline const char* skipNumber(const char* p, const char* end)
+{
+    return kernels().number(p, end);
+}
+
+// Skips blank characters: SP HT
+inline const char* skipBlank(const char* p, const char* end)
+{
+    return kernels().blank(p, end);
+}
+
+// Skips string body characters, stopping at `delimiter`, '\\' or NUL.
+inline const char* skipString(const char* p, const char* end, char delimiter)
+{
+    return kernels().string(p, end, delimiter);
+}
+
+void testSimd()
+{
+    cout << "Testing Simd" << endl;
+
+    // Build a buffer that exercises every run type and block offset
+    string alphabet = "abcXYZ_019. \t\"'\\\n+-()";
+    alphabet += '\0';
+    alphabet += '\x80';
+    alphabet += '\xff';
+    string buffer;
+    unsigned seed = 1;
+    for (int i = 0; i < 4096; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int run = (seed >> 16) % 40;
+        char c = alphabet[(seed >> 8) % alphabet.size()];
+        buffer.append(run, c);
+    }
+
+    Level levels[] = { SCALAR, SSE2, AVX2 };
+    Kernels scalar = kernelsFor(SCALAR);
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    for (Level level : levels)
+    {
+        if (level > supportedLevel())
+            continue;
+        Kernels kernels = kernelsFor(level);
+        for (const char* p = begin; p < end; p += 7)
+        {
+            assert(kernels.identifier(p, end) == scalar.identifier(p, end));
+            assert(kernels.number(p, end) == scalar.number(p, end));
+            assert(kernels.blank(p, end) == scalar.blank(p, end));
+            assert(kernels.string(p, end, '"') == scalar.string(p, end, '"'));
+            assert(kernels.string(p, end, '\'') == scalar.string(p, end, '\''));
+        }
+    }
+
+    {
+        // Test run boundaries
+        string source = "identifier_12345678901234567890123456789 = 3.14159265358979323846";
+        const char* s = source.data();
+        const char* e = s + source.size();
+        assert(skipIdentifier(s, e) == s + 40);
+        assert(skipBlank(s + 40, e) == s + 41);
+        assert(skipNumber(s + 43, e) == e);
+        assert(skipString(s, e, '=') == s + 41);
+    }
+}
+
+} // end cream::simd
+} // end cream
@@ -0,0 +1,414 @@
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cream {
+namespace util {
+
+using namespace std;
+
+/**
+ * How a queue was used: how often each side waited on the other, and how
+ * full it ran. A producer waiting for room points at a slow consumer, and
+ * a consumer waiting for items at a slow producer. Waits that outlast
+ * the spin are counted again as parks. Occupancy is sampled by the
+ * producer on each push.
+ */
+
+struct QueueStats
+{
+    size_t pushes = 0;
+    size_t fullStalls = 0;
+    size_t emptyStalls = 0;
+    size_t fullParks = 0;
+    size_t emptyParks = 0;
+    double fullMilliseconds = 0;
+    double emptyMilliseconds = 0;
+    size_t peak = 0;
+    double meanOccupancy = 0;
+};
+
+/**
+ * The SpscQueue class.
+ *
+ * A bounded queue between one producer thread and one consumer thread,
+ * without locks. Items live in a ring of slots; the producer owns the
+ * tail and the consumer the head, each on its own cache line, and each
+ * side keeps a copy of the other's index so it only reads the shared one
+ * when the copy says the ring is full or empty.
+ *
+ * `push` and `pop` wait by yielding while the ring is full or empty, for
+ * up to `spinLimit` tries, and then sleep on a condition variable until
+ * the other side wakes them. A side only takes the lock to wake the other
+ * when it has flagged that it sleeps, so passing items stays lock-free
+ * while both keep up. Each wait is counted. The producer closes the queue
+ * when done, after which `pop` drains what is left and then fails. The
+ * consumer cancels it when it stops taking items, after which `push`
+ * fails, so a producer never waits on a consumer that is gone.
+ */
+
+template <typename T>
+class SpscQueue
+{
+public:
+    // Tries to push or pop this many times, yielding between tries, before
+    // sleeping until the other side wakes the waiting one
+    static constexpr int spinLimit = 64;
+
+    // Makes a queue holding `capacity` items, rounded up to a power of 2.
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Gets the number of items the queue holds when full.
+    size_t capacity() const
+    {
+        return slots.size();
+    }
+
+    // Gets the number of items queued. Exact only on the producer or
+    // consumer thread, when the other side is idle.
+    size_t size() const
+    {
+        return tail.load(memory_order_acquire) - head.load(memory_order_acquire);
+    }
+
+    // Moves `item` into the queue, or returns false when it is full.
+    bool tryPush(T & item)
+    {
+        if (!put(item))
+            return false;
+        wake(consumerSleeps, itemAdded);
+        return true;
+    }
+
+    // Moves the oldest item into `item`, or returns false when empty.
+    bool tryPop(T & item)
+    {
+        if (!take(item))
+            return false;
+        wake(producerSleeps, roomFreed);
+        return true;
+    }
+
+    // Moves `item` into the queue, waiting for room. Returns false when the
+    // consumer cancelled the queue.
+    bool push(T & item)
+    {
+        if (tryPush(item))
+            return !cancelled.load(memory_order_acquire);
+
+        auto start = chrono::steady_clock::now();
+        bump(fullStalls);
+        bool pushed = false;
+        wait(producerSleeps, roomFreed, fullParks, [&]
+        {
+            return cancelled.load(memory_order_acquire) || (pushed = put(item));
+        });
+        if (pushed)
+            wake(consumerSleeps, itemAdded);
+        addTime(fullNanoseconds, start);
+        return pushed && !cancelled.load(memory_order_acquire);
+    }
+
+    // Moves the oldest item into `item`, waiting for one. Returns false
+    // once the queue is closed and drained.
+    bool pop(T & item)
+    {
+        if (tryPop(item))
+            return true;
+
+        auto start = chrono::steady_clock::now();
+        bump(emptyStalls);
+        bool popped = false;
+        wait(consumerSleeps, itemAdded, emptyParks, [&]
+        {
+            return (popped = take(item)) || closed.load(memory_order_acquire);
+        });
+        if (popped)
+            wake(producerSleeps, roomFreed);
+
+        // Items pushed before closing are still to be taken
+        if (!popped)
+            popped = tryPop(item);
+        addTime(emptyNanoseconds, start);
+        return popped;
+    }
+
+    // Marks the end of the items, from the producer.
+    void close()
+    {
+        closed.store(true, memory_order_release);
+        lock_guard<mutex> lock(sleeping);
+        itemAdded.notify_one();
+    }
+
+    // Stops taking items, from the consumer.
+    void cancel()
+    {
+        cancelled.store(true, memory_order_release);
+        lock_guard<mutex> lock(sleeping);
+        roomFreed.notify_one();
+    }
+
+    // Gets how the queue was used so far.
+    QueueStats stats() const
+    {
+        QueueStats stats;
+        stats.pushes = pushes.load(memory_order_relaxed);
+        stats.fullStalls = fullStalls.load(memory_order_relaxed);
+        stats.emptyStalls = emptyStalls.load(memory_order_relaxed);
+        stats.fullParks = fullParks.load(memory_order_relaxed);
+        stats.emptyParks = emptyParks.load(memory_order_relaxed);
+        stats.fullMilliseconds = fullNanoseconds.load(memory_order_relaxed) / 1e6;
+        stats.emptyMilliseconds = emptyNanoseconds.load(memory_order_relaxed) / 1e6;
+        stats.peak = peak.load(memory_order_relaxed);
+        if (stats.pushes)
+            stats.meanOccupancy = double(occupancy.load(memory_order_relaxed)) / stats.pushes;
+        return stats;
+    }
+
+private:
+    // Moves `item` into the queue, or returns false when it is full,
+    // without waking the consumer.
+    bool put(T & item)
+    {
+        auto index = tail.load(memory_order_relaxed);
+        if (index - cachedHead == slots.size())
+        {
+            cachedHead = head.load(memory_order_acquire);
+            if (index - cachedHead == slots.size())
+                return false;
+        }
+        slots[index & mask] = std::move(item);
+        tail.store(index + 1, memory_order_release);
+
+        auto queued = index + 1 - head.load(memory_order_relaxed);
+        bump(pushes);
+        occupancy.store(occupancy.load(memory_order_relaxed) + queued, memory_order_relaxed);
+        if (queued > peak.load(memory_order_relaxed))
+            peak.store(queued, memory_order_relaxed);
+        return true;
+    }
+
+    // Moves the oldest item into `item`, or returns false when empty,
+    // without waking the producer.
+    bool take(T & item)
+    {
+        auto index = head.load(memory_order_relaxed);
+        if (index == cachedTail)
+        {
+            cachedTail = tail.load(memory_order_acquire);
+            if (index == cachedTail)
+                return false;
+        }
+        item = std::move(slots[index & mask]);
+        head.store(index + 1, memory_order_release);
+        return true;
+    }
+
+    // Waits until `ready` holds, which must not wake the other side, as it
+    // is also tried with the lock held. Tries it up to `spinLimit` times
+    // before flagging `sleeps` and sleeping on `woken`. The flag is set
+    // before `ready` is tried again, and the other side checks it after
+    // changing its index, so one of them always sees the other.
+    template <typename Ready>
+    void wait(atomic<bool> & sleeps, condition_variable & woken, atomic<size_t> & parks, Ready ready)
+    {
+        for (int i = 0; i < spinLimit; i++)
+        {
+            if (ready())
+                return;
+            this_thread::yield();
+        }
+
+        bump(parks);
+        sleeps.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        unique_lock<mutex> lock(sleeping);
+        woken.wait(lock, ready);
+        sleeps.store(false, memory_order_relaxed);
+    }
+
+    // Wakes the other side when it sleeps on `woken`.
+    void wake(atomic<bool> & sleeps, condition_variable & woken)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!sleeps.load(memory_order_relaxed))
+            return;
+        lock_guard<mutex> lock(sleeping);
+        woken.notify_one();
+    }
+
+    // Adds one to a counter written by one thread only.
+    static void bump(atomic<size_t> & counter)
+    {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    // Adds the time since `start` to a counter written by one thread only.
+    static void addTime(atomic<size_t> & counter, chrono::steady_clock::time_point start)
+    {
+        auto time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        counter.store(counter.load(memory_order_relaxed) + time.count(), memory_order_relaxed);
+    }
+
+    vector<T> slots;
+    size_t mask;
+    atomic<bool> closed { false };
+    atomic<bool> cancelled { false };
+
+    // Where a side sleeps once it has spun too long
+    mutex sleeping;
+    condition_variable itemAdded;
+    condition_variable roomFreed;
+    atomic<bool> consumerSleeps { false };
+    atomic<bool> producerSleeps { false };
+
+    // Written by the producer
+    alignas(64) atomic<size_t> tail { 0 };
+    size_t cachedHead = 0;
+    atomic<size_t> pushes { 0 };
+    atomic<size_t> fullStalls { 0 };
+    atomic<size_t> fullParks { 0 };
+    atomic<size_t> fullNanoseconds { 0 };
+    atomic<size_t> occupancy { 0 };
+    atomic<size_t> peak { 0 };
+
+    // Written by the consumer
+    alignas(64) atomic<size_t> head { 0 };
+    size_t cachedTail = 0;
+    atomic<size_t> emptyStalls { 0 };
+    atomic<size_t> emptyParks { 0 };
+    atomic<size_t> emptyNanoseconds { 0 };
+};
+
+void testSpscQueue()
+{
+    cout << "Testing SpscQueue" << endl;
+
+    {
+        // Test items come out in order, up to the capacity
+        SpscQueue<int> queue(3);
+        assert(queue.capacity() == 4);
+        for (int i = 0; i < 4; i++)
+            assert(queue.tryPush(i));
+        int item = 9;
+        assert(!queue.tryPush(item));
+        assert(item == 9);
+        assert(queue.size() == 4);
+        for (int i = 0; i < 4; i++)
+        {
+            assert(queue.tryPop(item));
+            assert(item == i);
+        }
+        assert(!queue.tryPop(item));
+
+        // Test a closed queue drains before pop fails
+        item = 5;
+        assert(queue.push(item));
+        queue.close();
+        assert(queue.pop(item) && item == 5);
+        assert(!queue.pop(item));
+
+        auto stats = queue.stats();
+        assert(stats.pushes == 5);
+        assert(stats.peak == 4);
+        assert(stats.emptyStalls == 1);
+    }
+
+    {
+        // Test a producer and consumer on two threads pass every item in
+        // order, waiting on each other through a small ring
+        SpscQueue<vector<int>> queue(2);
+        const int count = 10000;
+        thread producer([&]
+        {
+            for (int i = 0; i < count; i++)
+            {
+                vector<int> item { i, i * 2 };
+                if (!queue.push(item))
+                    return;
+            }
+            queue.close();
+        });
+        vector<int> item;
+        int expected = 0;
+        while (queue.pop(item))
+        {
+            assert(item.size() == 2 && item[0] == expected && item[1] == expected * 2);
+            expected++;
+        }
+        producer.join();
+        assert(expected == count);
+        auto stats = queue.stats();
+        assert(stats.pushes == size_t(count));
+        assert(stats.peak <= queue.capacity());
+        assert(stats.meanOccupancy >= 1);
+    }
+
+    {
+        // Test cancelling stops a producer waiting for room
+        SpscQueue<int> queue(1);
+        thread producer([&]
+        {
+            int item = 0;
+            while (queue.push(item))
+                item++;
+        });
+        int item;
+        assert(queue.pop(item) && item == 0);
+        queue.cancel();
+        producer.join();
+        assert(queue.stats().fullStalls >= 1);
+    }
+
+    {
+        // Test each side sleeps once it has spun too long, and is woken by
+        // the other
+        SpscQueue<int> queue(1);
+        thread consumer([&]
+        {
+            int item;
+            assert(queue.pop(item) && item == 1);
+            this_thread::sleep_for(chrono::milliseconds(50));
+            assert(queue.pop(item) && item == 2);
+            assert(queue.pop(item) && item == 3);
+            assert(!queue.pop(item));
+        });
+        this_thread::sleep_for(chrono::milliseconds(50));
+        for (int item = 1; item <= 3; item++)
+            assert(queue.push(item));
+        this_thread::sleep_for(chrono::milliseconds(50));
+        queue.close();
+        consumer.join();
+        auto stats = queue.stats();
+        assert(stats.emptyParks >= 2);
+        assert(stats.fullParks >= 1);
+    }
+}
+
+} // end cream::util
+
+template <typename T>
+using SpscQueue = cream::util::SpscQueue<T>;
+using QueueStats = cream::util::QueueStats;
+
+} // end cream
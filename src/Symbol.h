@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 namespace cream {
 namespace symbol {
 
@@ -19,7 +21,7 @@ enum CharacterType
     COMMA,          // ,
     PERIOD,         // .
     SLASH,          // /
-    BACKSLASH,      // \\
+    BACKSLASH,      // \\ (backslash)
     COLON,          // :
     SEMICOLON,      // ;
     PAREN_LEFT,     // (
@@ -40,8 +42,124 @@ enum CharacterType
     QUOTE_SINGLE,   // '
     QUOTE_BACKTICK, // `
     CARET,          // ^
-    TILDE           // ~
+    TILDE,          // ~
+    TAB,            // HT
+    NEWLINE,        // LF
+    NUL,            // NUL
+    OTHER           // Anything else
+};
+
+/**
+ * Character class flags, for skipping runs of characters.
+ */
+
+enum CharacterClass : uint8_t
+{
+    CLASS_IDENTIFIER = 1 << 0, // A-Z a-z 0-9 _
+    CLASS_NUMBER     = 1 << 1, // 0-9 .
+    CLASS_BLANK      = 1 << 2  // SP HT
+};
+
+/**
+ * Gets the type of a character, independent of the locale.
+ */
+
+constexpr CharacterType characterType(unsigned char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) return ALPHA;
+    if (c >= '0' && c <= '9') return DIGIT;
+    switch (c)
+    {
+        case ' ':  return SPACE;
+        case '!':  return EXCLAMATION;
+        case '?':  return QUESTION;
+        case '|':  return PIPE;
+        case '&':  return AMPERSAND;
+        case '+':  return PLUS;
+        case '-':  return MINUS;
+        case '*':  return ASTERISK;
+        case ',':  return COMMA;
+        case '.':  return PERIOD;
+        case '/':  return SLASH;
+        case '\\': return BACKSLASH;
+        case ':':  return COLON;
+        case ';':  return SEMICOLON;
+        case '(':  return PAREN_LEFT;
+        case ')':  return PAREN_RIGHT;
+        case '[':  return BRACKET_LEFT;
+        case ']':  return BRACKET_RIGHT;
+        case '{':  return BRACE_LEFT;
+        case '}':  return BRACE_RIGHT;
+        case '_':  return UNDERSCORE;
+        case '=':  return SIGN_EQ;
+        case '<':  return SIGN_LT;
+        case '>':  return SIGN_GT;
+        case '#':  return SIGN_NUMBER;
+        case '$':  return SIGN_DOLLAR;
+        case '%':  return SIGN_PERCENT;
+        case '@':  return SIGN_AT;
+        case '"':  return QUOTE_DOUBLE;
+        case '\'': return QUOTE_SINGLE;
+        case '`':  return QUOTE_BACKTICK;
+        case '^':  return CARET;
+        case '~':  return TILDE;
+        case '\t': return TAB;
+        case '\n': return NEWLINE;
+        case '\0': return NUL;
+        default:   return OTHER;
+    }
+}
+
+/**
+ * Gets the class flags of a character type.
+ */
+
+constexpr uint8_t characterClass(CharacterType type)
+{
+    switch (type)
+    {
+        case ALPHA:      return CLASS_IDENTIFIER;
+        case UNDERSCORE: return CLASS_IDENTIFIER;
+        case DIGIT:      return CLASS_IDENTIFIER | CLASS_NUMBER;
+        case PERIOD:     return CLASS_NUMBER;
+        case SPACE:      return CLASS_BLANK;
+        case TAB:        return CLASS_BLANK;
+        default:         return 0;
+    }
+}
+
+/**
+ * A 256-entry lookup table of character types and classes.
+ */
+
+struct CharacterTable
+{
+    CharacterType types[256];
+    uint8_t classes[256];
+
+    constexpr CharacterType type(char c) const
+    {
+        return types[(unsigned char) c];
+    }
+
+    constexpr bool is(char c, uint8_t flags) const
+    {
+        return classes[(unsigned char) c] & flags;
+    }
 };
 
+constexpr CharacterTable makeCharacterTable()
+{
+    CharacterTable table {};
+    for (int c = 0; c < 256; c++)
+    {
+        table.types[c] = characterType((unsigned char) c);
+        table.classes[c] = characterClass(table.types[c]);
+    }
+    return table;
+}
+
+constexpr CharacterTable characters = makeCharacterTable();
+
 } // end cream::symbol
 } // end cream
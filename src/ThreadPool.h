@@ -0,0 +1,243 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cream {
+namespace util {
+
+using namespace std;
+
+/**
+ * The ThreadPool class.
+ *
+ * Runs tasks on a fixed set of worker threads, each with its own queue.
+ * Tasks submitted from outside the pool are dealt to the queues in turn,
+ * and tasks submitted by a worker go to its own queue. A worker runs the
+ * newest task of its queue, and when that is empty steals the oldest
+ * task of another, so uneven tasks still keep every worker busy. Each
+ * task returns a future, which also carries any exception it throws.
+ * Workers finish every queue before the pool is destroyed.
+ */
+
+class ThreadPool
+{
+public:
+    // Starts `size` workers, or one per hardware thread.
+    explicit ThreadPool(size_t size=0)
+    {
+        if (!size)
+            size = max(1u, thread::hardware_concurrency());
+        queues.reserve(size);
+        for (size_t i = 0; i < size; i++)
+            queues.emplace_back(new Queue);
+        workers.reserve(size);
+        for (size_t i = 0; i < size; i++)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Finishes queued tasks and joins the workers.
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // Gets the number of workers.
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    // Gets the number of tasks workers took from another's queue.
+    size_t steals() const
+    {
+        return stolen;
+    }
+
+    // Queues `task`, returning a future for its result.
+    template <typename Task>
+    auto submit(Task task) -> future<decltype(task())>
+    {
+        typedef decltype(task()) Result;
+        auto job = make_shared<packaged_task<Result()>>(std::move(task));
+        auto result = job->get_future();
+
+        auto index = current.pool == this ? current.index : next++ % queues.size();
+        {
+            lock_guard<mutex> lock(queues[index]->lock);
+            queues[index]->tasks.emplace_back([job] { (*job)(); });
+            pending++;
+        }
+
+        // Take the lock so a worker checking for tasks cannot miss this one
+        {
+            lock_guard<mutex> lock(sleepMutex);
+        }
+        ready.notify_one();
+        return result;
+    }
+
+private:
+    /**
+     * The tasks queued for one worker.
+     */
+
+    struct Queue
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    /**
+     * The pool and queue of the worker on this thread. Zero on threads
+     * outside any pool, as thread-locals start zeroed.
+     */
+
+    struct Current
+    {
+        ThreadPool* pool;
+        size_t index;
+    };
+
+    // Runs tasks until the pool stops and every queue is empty.
+    void work(size_t index)
+    {
+        current = { this, index };
+        while (true)
+        {
+            function<void()> task;
+            if (take(index, task))
+            {
+                task();
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            ready.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+                return;
+        }
+    }
+
+    // Takes the newest task of queue `index`, or else the oldest task of
+    // another queue. Returns false when every queue is empty.
+    bool take(size_t index, function<void()> & task)
+    {
+        {
+            auto& own = *queues[index];
+            lock_guard<mutex> lock(own.lock);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                pending--;
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++)
+        {
+            auto& other = *queues[(index + i) % queues.size()];
+            lock_guard<mutex> lock(other.lock);
+            if (!other.tasks.empty())
+            {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                pending--;
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+    atomic<size_t> next { 0 };
+    atomic<size_t> pending { 0 };
+    atomic<size_t> stolen { 0 };
+    mutex sleepMutex;
+    condition_variable ready;
+    bool stopping = false;
+
+    static inline thread_local Current current;
+};
+
+void testThreadPool()
+{
+    cout << "Testing ThreadPool" << endl;
+
+    {
+        // Test results come back through futures
+        ThreadPool pool(4);
+        assert(pool.size() == 4);
+        vector<future<int>> results;
+        for (int i = 0; i < 100; i++)
+            results.push_back(pool.submit([i] { return i * i; }));
+        for (int i = 0; i < 100; i++)
+            assert(results[i].get() == i * i);
+    }
+
+    {
+        // Test exceptions reach the caller
+        ThreadPool pool(2);
+        auto result = pool.submit([]() -> int { throw runtime_error("failed"); });
+        bool thrown = false;
+        try { result.get(); }
+        catch (runtime_error& e) { thrown = true; }
+        assert(thrown);
+    }
+
+    {
+        // Test tasks queued by a busy worker are stolen by the others
+        ThreadPool pool(3);
+        atomic<int> count(0);
+        auto outer = pool.submit([&pool, &count]
+        {
+            vector<future<void>> inner;
+            for (int i = 0; i < 20; i++)
+                inner.push_back(pool.submit([&count] { count++; }));
+            while (count < 20)
+                this_thread::yield();
+        });
+        outer.get();
+        assert(count == 20);
+        assert(pool.steals() >= 20);
+    }
+
+    {
+        // Test queued tasks finish before the pool is destroyed
+        atomic<int> count(0);
+        {
+            ThreadPool pool(3);
+            for (int i = 0; i < 50; i++)
+                pool.submit([&count] { count++; });
+        }
+        assert(count == 50);
+    }
+}
+
+} // end cream::util
+
+using ThreadPool = cream::util::ThreadPool;
+
+} // end cream
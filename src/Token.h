@@ -2,11 +2,17 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <list>
 #include <map>
-#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
+#include "CompilationContext.h"
+#include "Interner.h"
 #include "Symbol.h"
 
 namespace cream {
@@ -61,138 +67,224 @@ enum TokenType
     UNKNOWN
 };
 
+/**
+ * Display names, indexed by TokenType.
+ */
+
+constexpr const char* tokenNames[] =
+{
+    "Undefined",
+    "Identifier",
+    "Type",
+    "Keyword",
+    "Number",
+    "String",
+    "Whitespace",
+    "Newline",
+    "Assign",
+    "Arrow",
+    "Params Start",
+    "Params End",
+    "Param Type",
+    "Param Name",
+    "Comma",
+    "Var Type",
+    "Var Name",
+    "Add",
+    "Increment",
+    "Subtract",
+    "Decrement",
+    "Multiply",
+    "Divide",
+    "Bitwise And",
+    "Bitwise Or",
+    "Bitwise Left",
+    "Bitwise Right",
+    "Compare Eq",
+    "Compare LT",
+    "Compare GT",
+    "Compare LTE",
+    "Compare GTE",
+    "And",
+    "Or",
+    "Expression Start",
+    "Expression End",
+    "Statement Start",
+    "Statement End",
+    "Block Start",
+    "Block End",
+    "Indent",
+    "Outdent",
+    "Unknown"
+};
+
+static_assert(sizeof(tokenNames) / sizeof(tokenNames[0]) == UNKNOWN + 1,
+              "Missing token names");
+
+/**
+ * Gets the display name of a token type.
+ */
+
+constexpr const char* tokenName(int type)
+{
+    return (type >= 0 && type <= UNKNOWN) ? tokenNames[type] : "Unknown";
+}
+
+/**
+ * Gets the text of a token synthesized by the rewriter.
+ */
+
+constexpr const char* implicitText(int type)
+{
+    switch (type)
+    {
+        case PARAMS_START:
+        case EXPRESSION_START: return "(";
+        case PARAMS_END:
+        case EXPRESSION_END:   return ")";
+        case BLOCK_START:      return "{";
+        case BLOCK_END:        return "}";
+        case INDENT:           return "  ";
+        default:               return "";
+    }
+}
+
 struct Token;
+struct TokenSpan;
 
 struct Metadata
 {
-    int line;
-    int column;
-    int position;
+    int64_t line;
+    int64_t column;
+    int64_t position;
 };
 
+/**
+ * Finds and links the partners of bracket tokens. Parentheses pair with
+ * parentheses and blocks with blocks, by nesting.
+ */
+
 struct Pair
 {
-    int start;
-    int end;
     template<typename Iterator> static vector<Token> innerTokens(Iterator start);
+    static TokenSpan inner(const Token* start);
     template<typename Iterator> static Iterator endFor(Iterator start);
     template<typename Iterator> static Iterator startFor(Iterator end);
-    template<typename Iterator> static void seekToEnd(Iterator & iter, Pair* pair=0);
-    template<typename Iterator> static void seekToStart(Iterator & iter, Pair* pair=0);
+    template<typename Iterator> static void seekToEnd(Iterator & iter);
+    template<typename Iterator> static void seekToStart(Iterator & iter);
+    static void link(vector<Token> & tokens);
+    static void link(Token* first, Token* last);
 };
 
-struct Line
-{
-    string indent;
-    string content;
-    static int firstIndentSize;
-    static int defaultIndentSize;
-
-    bool isEmpty()
-    {
-        return content.size() == 0;
-    }
-
-    int indentLevel()
-    {
-        return indent.size() / baseIndentSize();
-    }
+/**
+ * Gets the bracket a token of `type` is: 1 for a parenthesis and 2 for a
+ * block, positive for a start and negative for an end, or 0.
+ */
 
-    static int baseIndentSize()
+constexpr int bracketOf(int type)
+{
+    switch (type)
     {
-        return firstIndentSize ? firstIndentSize : defaultIndentSize;
+        case EXPRESSION_START:
+        case PARAMS_START:     return 1;
+        case EXPRESSION_END:
+        case PARAMS_END:       return -1;
+        case BLOCK_START:      return 2;
+        case BLOCK_END:        return -2;
+        default:               return 0;
     }
-};
+}
 
-int Line::firstIndentSize = 0;
-int Line::defaultIndentSize = 2;
+/**
+ * A view of one token.
+ *
+ * The name points into the static name table and the value into the
+ * source, so a Token is only valid while its source is alive. String
+ * values are the literal body as written, without quotes. Identifiers
+ * also carry their interned symbol ID.
+ *
+ * In a token vector, a bracket token also holds the distance to its
+ * partner, so the pair is found by index. The distance stays valid in any
+ * copy of a range holding both tokens. Elsewhere a pair is found by
+ * nesting.
+ */
 
 struct Token
 {
     int type;
-    string name;
-    string value;
+    string_view name;
+    string_view value;
     Metadata meta;
-    Pair pair;
-    shared_ptr<Line> line;
-    shared_ptr<vector<Line*>> lines;
+    interner::SymbolId symbol = interner::noSymbol;
+    int32_t partner = 0;
 
-    string toString()
+    string toString() const
     {
-        return name + " " + value;
+        return string(name) + " " + string(value);
     }
 
-    string debug()
+    string debug() const
     {
-        return "Token '" + value + "'\n" +
-               "  name: " + name + "\n" +
+        return "Token '" + string(value) + "'\n" +
+               "  name: " + string(name) + "\n" +
                "  meta: line " + to_string(meta.line) +
                      ", column " + to_string(meta.column) +
                      ", position " + to_string(meta.position) + "\n" +
-               "  pair.start: " + to_string(pair.end) + "\n" +
-               "  pair.end: " + to_string(pair.end) + "\n";
+               "  partner: " + to_string(partner) + "\n";
     }
 
-    template<typename Iterator> static Iterator nextNewline(Iterator iter, Iterator end)
+    // Gives a synthesized pair the next implicit positions.
+    static void makeImplicitPair(Token & start, Token & end, CompilationContext & context)
     {
-        auto newLine = iter;
-        while (newLine->type != cream::token::NEWLINE && newLine != end)
-        {
-            newLine++;
-        }
-        return newLine;
+        start.meta.position = context.implicitPosition();
+        end.meta.position = context.implicitPosition();
     }
+};
 
+/**
+ * Checks whether a pair can be found by index from `Iterator`.
+ */
 
-    static Pair makePair(Token & start, Token & end)
-    {
-        // Create pair object
-        Pair pair { start.meta.position, end.meta.position };
-
-        // Set token pair data
-        start.pair = pair;
-        end.pair = pair;
+template <typename Iterator>
+constexpr bool isRandomAccess = is_base_of<
+    random_access_iterator_tag,
+    typename iterator_traits<Iterator>::iterator_category
+>::value;
 
-        return pair;
-    }
-    static Pair makeImplicitPair(Token & start, Token & end)
-    {
-        // Set implicit positions
-        start.meta.position = Token::implicitPosition();
-        end.meta.position = Token::implicitPosition();
+/**
+ * Gets inner tokens, given a token pair start iterator.
+ */
 
-        // Set pair data
-        auto pair = makePair(start, end);
+template <typename Iterator>
+vector<Token> Pair::innerTokens(Iterator start)
+{
+    auto inner = start; inner++;
+    return vector<Token>(inner, Pair::endFor(start));
+}
 
-        return pair;
-    }
+/**
+ * A range of tokens in one buffer, viewed without copying them.
+ */
 
-    // Gets the next position for implicit tokens.
-    static int implicitPosition()
-    {
-        return --lastImplicitPos;
-    }
-    static int lastImplicitPos;
+struct TokenSpan
+{
+    const Token* first = nullptr;
+    const Token* last = nullptr;
+
+    const Token* begin() const { return first; }
+    const Token* end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    const Token& operator[](size_t i) const { return first[i]; }
 };
 
-int Token::lastImplicitPos = 0;
-
 /**
- * Gets inner tokens, given a token pair start iterator.
+ * Gets the span of inner tokens, given a linked token pair start.
  */
 
-template <typename Iterator>
-vector<Token> Pair::innerTokens(Iterator start)
+TokenSpan Pair::inner(const Token* start)
 {
-    vector<Token> innerTokens;
-    auto inner = start; inner++;
-    while (inner->meta.position != start->pair.end)
-    {
-        auto innerToken = *inner;
-        innerTokens.push_back(innerToken);
-        inner++;
-    }
-    return innerTokens;
+    return { start + 1, Pair::endFor(start) };
 }
 
 /**
@@ -221,36 +313,194 @@ Iterator Pair::endFor(Iterator start)
 
 /**
  * Seeks iterator to start of a token pair.
+ *
+ * Jumps to the partner when it is linked, else walks back to the start
+ * that the end closes.
  */
 
 template <typename Iterator>
-void Pair::seekToStart(Iterator & iter, Pair* pair)
+void Pair::seekToStart(Iterator & iter)
 {
-    if (!pair) pair = &iter->pair;
-    while (iter->meta.position != pair->start)
+    if constexpr (isRandomAccess<Iterator>)
+    {
+        if (iter->partner < 0)
+        {
+            iter += iter->partner;
+            return;
+        }
+    }
+    auto end = bracketOf(iter->type);
+    int depth = 0;
+    while (true)
     {
+        auto bracket = bracketOf(iter->type);
+        if (bracket == end)
+            depth++;
+        else if (bracket == -end && --depth == 0)
+            return;
         iter--;
     }
 }
 
 /**
  * Seeks iterator to end of a token pair.
+ *
+ * Jumps to the partner when it is linked, else walks on to the end that
+ * closes the start.
  */
 
 template <typename Iterator>
-void Pair::seekToEnd(Iterator & iter, Pair* pair)
+void Pair::seekToEnd(Iterator & iter)
 {
-    if (!pair) pair = &iter->pair;
-    while (iter->meta.position != pair->end)
+    if constexpr (isRandomAccess<Iterator>)
+    {
+        if (iter->partner > 0)
+        {
+            iter += iter->partner;
+            return;
+        }
+    }
+    auto start = bracketOf(iter->type);
+    int depth = 0;
+    while (true)
     {
+        auto bracket = bracketOf(iter->type);
+        if (bracket == start)
+            depth++;
+        else if (bracket == -start && --depth == 0)
+            return;
         iter++;
     }
 }
 
+/**
+ * Links the bracket tokens of `tokens` to their partners by index, in one
+ * pass. Parentheses and blocks are paired separately, as in a TokenStream.
+ */
+
+void Pair::link(vector<Token> & tokens)
+{
+    link(tokens.data(), tokens.data() + tokens.size());
+}
+
+/**
+ * Links the bracket tokens from `first` to `last` alone, as if they were
+ * the whole buffer.
+ */
+
+void Pair::link(Token* first, Token* last)
+{
+    vector<int32_t> parens;
+    vector<int32_t> blocks;
+    auto tokens = first;
+    auto close = [&](vector<int32_t> & starts, int32_t i)
+    {
+        if (starts.empty())
+            return;
+        tokens[i].partner = starts.back() - i;
+        tokens[starts.back()].partner = i - starts.back();
+        starts.pop_back();
+    };
+    for (int32_t i = 0; i < (int32_t) (last - first); i++)
+    {
+        tokens[i].partner = 0;
+        switch (tokens[i].type)
+        {
+            case EXPRESSION_START:
+            case PARAMS_START:
+                parens.push_back(i);
+                break;
+            case BLOCK_START:
+                blocks.push_back(i);
+                break;
+            case EXPRESSION_END:
+            case PARAMS_END:
+                close(parens, i);
+                break;
+            case BLOCK_END:
+                close(blocks, i);
+                break;
+        }
+    }
+}
+
+void testPair()
+{
+    cout << "Testing Pair" << endl;
+
+    // Builds a token of `type`, with no position or pair set
+    auto make = [](int type)
+    {
+        Token token { type, tokenName(type), implicitText(type) };
+        token.meta = { 0, 0, 0 };
+        return token;
+    };
+
+    // { ( a ( b ) ) c }
+    vector<Token> tokens =
+    {
+        make(BLOCK_START),
+        make(EXPRESSION_START),
+        make(IDENTIFIER),
+        make(EXPRESSION_START),
+        make(IDENTIFIER),
+        make(EXPRESSION_END),
+        make(EXPRESSION_END),
+        make(IDENTIFIER),
+        make(BLOCK_END),
+    };
+    Pair::link(tokens);
+    assert(tokens[0].partner == 8);
+    assert(tokens[8].partner == -8);
+    assert(tokens[1].partner == 5);
+    assert(tokens[3].partner == 2);
+    assert(tokens[5].partner == -2);
+    assert(tokens[2].partner == 0);
+
+    // Test pairs are found by index
+    auto start = tokens.begin() + 1;
+    assert(Pair::endFor(start) == tokens.begin() + 6);
+    assert(Pair::startFor(tokens.begin() + 6) == start);
+    auto inner = Pair::innerTokens(start);
+    assert(inner.size() == 4);
+    assert(inner[1].type == EXPRESSION_START);
+
+    // Test distances stay valid in a copied range
+    assert(Pair::endFor(inner.begin() + 1) == inner.begin() + 3);
+
+    // Test pairs are found by nesting in a list, where blocks and
+    // parentheses pair apart
+    list<Token> listed(tokens.begin(), tokens.end());
+    auto first = next(listed.begin());
+    auto last = Pair::endFor(first);
+    assert(distance(listed.begin(), last) == 6);
+    assert(Pair::startFor(last) == first);
+    assert(Pair::endFor(listed.begin()) == prev(listed.end()));
+    assert(Pair::startFor(prev(listed.end())) == listed.begin());
+
+    // Test inner spans view the buffer
+    auto span = Pair::inner(tokens.data());
+    assert(span.begin() == tokens.data() + 1 && span.size() == 7);
+    auto nested = Pair::inner(span.begin() + 2);
+    assert(nested.size() == 1 && nested[0].type == IDENTIFIER);
+    assert(Pair::inner(tokens.data() + 3).begin() == &tokens[4]);
+
+    // Test a deep nesting links in one pass
+    vector<Token> deep;
+    int depth = 100000;
+    for (int i = 0; i < depth; i++)
+        deep.push_back(make(EXPRESSION_START));
+    for (int i = 0; i < depth; i++)
+        deep.push_back(make(EXPRESSION_END));
+    Pair::link(deep);
+    for (int i = 0; i < depth; i++)
+        assert(Pair::endFor(deep.begin() + i) == deep.end() - i - 1);
+}
+
 } // end cream::token
 
 using Token = cream::token::Token;
-using Line = cream::token::Line;
 using Pair = cream::token::Pair;
+using TokenSpan = cream::token::TokenSpan;
 
 } // end cream
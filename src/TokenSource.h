@@ -0,0 +1,712 @@
+
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <iostream>
+#include <istream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Common.h"
+#include "Diagnostics.h"
+#include "Lexer.h"
+#include "LineTable.h"
+#include "Rewriter.h"
+#include "Scanner.h"
+#include "Token.h"
+
+namespace cream {
+namespace lexer {
+
+using namespace std;
+
+/**
+ * The TokenSource class.
+ *
+ * Pulls rewritten tokens from a source on demand. Each call to `next`
+ * scans only as far as the next rewritten line, so a parser can start
+ * before lexing finishes. Memory is bounded by one window plus the stack
+ * of open blocks, not by the size of the source.
+ *
+ * A window is one non-empty line, extended while parentheses are open or
+ * the line ends with an arrow, since the rewriter needs the matching
+ * start or the next line's block. Indentation blocks span windows: the
+ * start and end positions of each are reserved when the block opens.
+ *
+ * Windows are built by removing empty lines and whitespace and turning
+ * indents into blocks as lines are scanned, which does the work of the
+ * whitespace and block passes of the lexer. Those passes cannot be
+ * disabled here, so a lexer with any of them disabled is rejected; the
+ * other passes run on each window when enabled.
+ *
+ * When the context of `lexer` has diagnostics, errors are reported there
+ * and skipped: a window the rewriter rejects is dropped but for its block
+ * and line tokens, unexpected indents open a block for each level, and
+ * extra outdents are ignored, so the blocks always balance.
+ *
+ * A source read from a stream is read a chunk of whole lines at a time,
+ * as scanning reaches the end of the last. Pulled tokens point into the
+ * chunks, so they are kept until `release` is called; only a string can
+ * span chunks, and is scanned again from a copy joined to the next.
+ */
+
+class TokenSource
+{
+public:
+    static constexpr size_t defaultChunkSize = 1 << 12;
+
+    // Passes done while building windows, which must stay enabled
+    static constexpr const char* builtInPasses[] =
+    {
+        "removeEmptyLines",
+        "addIndents",
+        "removeWhitespace",
+        "rewriteIndents",
+        "addBlockMetadata",
+    };
+
+    // Reads a borrowed source using the symbols of `lexer`.
+    TokenSource(Lexer & lexer, SourceText source)
+        : lexer(lexer),
+          rewriter(lexer.context)
+    {
+        for (auto name : builtInPasses)
+        {
+            if (!lexer.passes().isEnabled(name))
+                throw CreamError("Pass '" + string(name) + "' cannot be disabled when pulling tokens\n");
+        }
+        scanner.borrow(source);
+        meta = { 1, 1, 1 };
+        windowPasses = lexer.passes().mask({
+            "addExpressionMetadata",
+            "rewriteKeywords",
+            "rewriteTypes",
+            "rewriteReturnExpressions",
+            "rewriteLambdaExpressions",
+        });
+    }
+
+    // Reads `input` in chunks of about `chunkSize` bytes, using the
+    // symbols of `lexer`.
+    TokenSource(Lexer & lexer, istream & input, size_t chunkSize=defaultChunkSize)
+        : TokenSource(lexer, "")
+    {
+        this->input = &input;
+        this->chunkSize = chunkSize;
+    }
+
+    TokenSource(const TokenSource&) = delete;
+    TokenSource& operator=(const TokenSource&) = delete;
+
+    // Gets the next rewritten token, or returns false at the end.
+    bool next(Token & token)
+    {
+        while (ready.empty())
+        {
+            if (finished)
+                return false;
+            fill();
+        }
+        token = ready.front();
+        ready.pop_front();
+        return true;
+    }
+
+    // Appends the tokens of the next top-level statement to `tokens`: up
+    // to a newline outside any block, or the end. Returns false when no
+    // tokens are left.
+    bool nextStatement(vector<Token> & tokens)
+    {
+        auto start = tokens.size();
+        int depth = 0;
+        Token token;
+        while (next(token))
+        {
+            tokens.push_back(token);
+            if (token.type == cream::token::BLOCK_START)
+                depth++;
+            else if (token.type == cream::token::BLOCK_END)
+                depth--;
+            else if (token.type == cream::token::NEWLINE && depth == 0)
+                return true;
+        }
+        return tokens.size() > start;
+    }
+
+    // Gets the number of tokens waiting to be pulled.
+    size_t buffered() const
+    {
+        return ready.size();
+    }
+
+    // Frees the chunks of a stream holding only tokens already pulled, so
+    // the caller must be done with them.
+    void release()
+    {
+        if (chunks.empty())
+            return;
+        auto keep = ready.empty() ? firstChunk + chunks.size() - 1 : windowChunk;
+        while (firstChunk < keep)
+        {
+            chunks.pop_front();
+            firstChunk++;
+        }
+    }
+
+    // Gets the number of bytes of stream text held.
+    size_t held() const
+    {
+        size_t bytes = 0;
+        for (auto const& chunk : chunks)
+            bytes += chunk.size();
+        return bytes;
+    }
+
+    // Gets the symbol table of the tokens.
+    shared_ptr<const Interner> symbols() const
+    {
+        return lexer.symbols;
+    }
+
+    /**
+     * The raw tokens of one window, and the block ends closing the source
+     * when it is the last.
+     */
+
+    struct Window
+    {
+        list<Token> tokens;
+        vector<Token> closing;
+        bool last = false;
+        bool skip = false;
+    };
+
+    // Scans the next window, or returns false at the end. Scanning and
+    // rewriting are separate steps, so they can run on two threads.
+    bool scanWindow(Window & window)
+    {
+        if (finished)
+            return false;
+
+        windowChunk = firstChunk + (chunks.empty() ? 0 : chunks.size() - 1);
+        bool more = appendLine(window.tokens);
+        while (more && isOpen(window.tokens))
+            more = appendLine(window.tokens);
+        window.last = !more;
+        window.skip = skipWindow;
+        skipWindow = false;
+
+        if (!more)
+        {
+            // Close any blocks on last line
+            while (!blocks.empty())
+                window.closing.push_back(blockEnd());
+            finished = true;
+        }
+        return true;
+    }
+
+    // Rewrites a scanned window in place with `rewriter`, using the
+    // enabled passes of the lexer that work on one window. Errors are
+    // reported to the context of `rewriter`.
+    void rewriteWindow(Window & window, Rewriter & rewriter)
+    {
+        try
+        {
+            if (window.last && parenDepth(window.tokens) > 0)
+                throw CreamError("Unclosed parenthesis at end of source\n", unclosedAt(window.tokens));
+            if (!window.skip)
+                lexer.passes().run(rewriter, window.tokens, windowPasses);
+        }
+        catch (CreamError& e)
+        {
+            rewriter.context->error(e.span.line ? e.span : spanOf(window.tokens), e.what());
+            window.skip = true;
+        }
+        if (window.skip)
+        {
+            // Skip the window, keeping its blocks and line ends
+            window.tokens.remove_if([](const Token & token)
+            {
+                return token.type != cream::token::BLOCK_START &&
+                       token.type != cream::token::BLOCK_END &&
+                       token.type != cream::token::NEWLINE;
+            });
+        }
+        window.tokens.insert(window.tokens.end(), window.closing.begin(), window.closing.end());
+        window.closing.clear();
+    }
+
+    // Gets the number of indentation blocks left open by the windows
+    // scanned so far.
+    size_t openBlocks() const
+    {
+        return blocks.size();
+    }
+
+private:
+    // Rewrites the next window into the ready queue.
+    void fill()
+    {
+        Window window;
+        scanWindow(window);
+        rewriteWindow(window, rewriter);
+        ready.insert(ready.end(), window.tokens.begin(), window.tokens.end());
+    }
+
+    // Appends the next non-empty line to `window`, after the blocks its
+    // indentation opens or closes. Returns false at the end of the source.
+    bool appendLine(list<Token> & window)
+    {
+        vector<Token> line;
+        do
+        {
+            line.clear();
+            Token token;
+            while (scan(token))
+            {
+                line.push_back(token);
+                if (token.type == cream::token::NEWLINE)
+                    break;
+            }
+            if (line.empty())
+                return false;
+        }
+        while (line[0].type == cream::token::NEWLINE && line[0].meta.column == 1);
+
+        // Add indents and outdents as blocks
+        auto const& first = line[0];
+        int level = 0;
+        if (first.type == cream::token::WHITESPACE && first.meta.column == 1)
+            level = first.value.size() / lexer.context->indentSize();
+
+        if (started)
+        {
+            int shift = level - lastLevel;
+            if (shift > 1)
+            {
+                lexer.context->error({ first.meta.line, 1 }, "Unexpected indent\n");
+            }
+            for (int i = 0; i < shift; i++)
+                window.push_back(blockStart());
+            for (int i = 0; i > shift; i--)
+            {
+                if (blocks.empty())
+                {
+                    lexer.context->error({ first.meta.line, 1 }, "Extra block end found\n");
+                    break;
+                }
+                window.push_back(blockEnd());
+            }
+        }
+        started = true;
+        lastLevel = level;
+
+        // Add tokens without whitespace
+        for (auto const& token : line)
+        {
+            if (token.type != cream::token::WHITESPACE)
+                window.push_back(token);
+        }
+        return line.back().type == cream::token::NEWLINE;
+    }
+
+    // Checks whether `window` needs the next line: when parentheses are
+    // open, or an arrow ends the last line.
+    bool isOpen(const list<Token> & window)
+    {
+        if (parenDepth(window) > 0)
+            return true;
+
+        auto last = window.rbegin();
+        if (last != window.rend() && last->type == cream::token::NEWLINE)
+            last++;
+        return last != window.rend() && last->type == cream::token::ARROW;
+    }
+
+    // Counts the parentheses left open in `window`.
+    static int parenDepth(const list<Token> & window)
+    {
+        int depth = 0;
+        for (auto const& token : window)
+        {
+            if (token.type == cream::token::EXPRESSION_START)
+                depth++;
+            else if (token.type == cream::token::EXPRESSION_END)
+                depth--;
+        }
+        return depth;
+    }
+
+    // Gets the position of the outermost parenthesis left open in `window`.
+    static SourceSpan unclosedAt(const list<Token> & window)
+    {
+        vector<const Token*> open;
+        for (auto const& token : window)
+        {
+            if (token.type == cream::token::EXPRESSION_START)
+                open.push_back(&token);
+            else if (token.type == cream::token::EXPRESSION_END && !open.empty())
+                open.pop_back();
+        }
+        if (open.empty())
+            return {};
+        return { open.front()->meta.line, open.front()->meta.column };
+    }
+
+    // Gets the position of the first source token in `window`.
+    static SourceSpan spanOf(const list<Token> & window)
+    {
+        for (auto const& token : window)
+        {
+            if (token.meta.line)
+                return { token.meta.line, token.meta.column };
+        }
+        return {};
+    }
+
+    // Scans the next raw token, or returns false at the end.
+    bool scan(Token & token)
+    {
+        while (!scanner.atEnd(scanner.position) || readChunk(scanner.length()))
+        {
+            Lexer::Lexeme lexeme;
+            try
+            {
+                lexeme = lexer.match(scanner, meta);
+            }
+            catch (CreamError& e)
+            {
+                // A string may go on in the next chunk of a stream
+                if (readChunk(scanner.position))
+                    continue;
+
+                // Only an unterminated string fails, so skip to the end
+                lexer.context->error(e.span, e.what());
+                meta.position += scanner.length() - scanner.position;
+                scanner.to(scanner.length());
+                skipWindow = true;
+                return false;
+            }
+            auto end = lexeme.start + lexeme.length;
+            auto text = scanner.slice(lexeme.start, end);
+
+            token = { lexeme.type, cream::token::tokenName(lexeme.type), text };
+            if (lexeme.type == cream::token::STRING)
+                token.value = text.substr(1, text.size() - 2);
+            token.meta = meta;
+            token.symbol = lexeme.symbol;
+
+            if (lexeme.type == cream::token::WHITESPACE && meta.column == 1)
+                lexer.context->noteIndent(text.size());
+
+            // Update position, line and column
+            meta.position += lexeme.length;
+            scanner.to(end);
+            if (lexeme.type == cream::token::NEWLINE)
+            {
+                meta.column = 1;
+                meta.line += 1;
+            }
+            else
+            {
+                meta.column += lexeme.length;
+            }
+
+            if (lexeme.type)
+                return true;
+        }
+        return false;
+    }
+
+    // Reads the next chunk of a stream, after a copy of the current chunk
+    // from position `keep` on, and scans it from the start. Chunks end at
+    // a line end where the stream has one. Returns false at the end of
+    // the stream.
+    bool readChunk(int64_t keep)
+    {
+        if (!input || !*input)
+            return false;
+
+        string chunk(scanner.slice(keep, scanner.length()));
+        size_t kept = chunk.size();
+        chunk.resize(kept + chunkSize);
+        input->read(&chunk[kept], chunkSize);
+        chunk.resize(kept + input->gcount());
+
+        // Finish the last line
+        string rest;
+        if (chunk.size() > kept && chunk.back() != '\n' && getline(*input, rest))
+        {
+            chunk += rest;
+            if (!input->eof())
+                chunk += '\n';
+        }
+        if (chunk.size() == kept)
+            return false;
+
+        chunks.push_back(std::move(chunk));
+        scanner.borrow(chunks.back());
+        return true;
+    }
+
+    // Opens a block, reserving the position of its end.
+    Token blockStart()
+    {
+        Token start { cream::token::BLOCK_START, "Block Start", "{" };
+        start.meta = { 0, 0, lexer.context->implicitPosition() };
+        blocks.push_back(lexer.context->implicitPosition());
+        return start;
+    }
+
+    // Closes the innermost open block.
+    Token blockEnd()
+    {
+        Token end { cream::token::BLOCK_END, "Block End", "}" };
+        end.meta = { 0, 0, blocks.back() };
+        blocks.pop_back();
+        return end;
+    }
+
+    Lexer & lexer;
+    Scanner scanner;
+    Rewriter rewriter;
+    uint64_t windowPasses;
+    token::Metadata meta;
+    deque<Token> ready;
+    // Positions reserved for the ends of the open blocks
+    vector<int64_t> blocks;
+    int lastLevel = 0;
+    bool started = false;
+    bool finished = false;
+    bool skipWindow = false;
+
+    // Chunks read from a stream, the first being chunk `firstChunk` of
+    // the stream, and the chunk the last window started in
+    istream* input = nullptr;
+    size_t chunkSize = defaultChunkSize;
+    deque<string> chunks;
+    size_t firstChunk = 0;
+    size_t windowChunk = 0;
+};
+
+// Gets the distance from each token to its partner, for comparing pairs.
+vector<int32_t> partnerDistances(vector<Token> tokens)
+{
+    Pair::link(tokens);
+    vector<int32_t> partners;
+    for (auto const& token : tokens)
+        partners.push_back(token.partner);
+    return partners;
+}
+
+void testTokenSource()
+{
+    cout << "Testing TokenSource" << endl;
+
+    {
+        // Test pulled tokens match the batch rewriter
+        const char* sources[] =
+        {
+            "a = 1\nb = 2",
+            "() -> return 123",
+            "-> return 123",
+            "(double a, double b) -> return a * b\n",
+            "int main() ->\n  return 42\n",
+            "int main() ->\n  return 42",
+            "() ->\n  if true\n    a = 1\n\n  else\n    b = 2\n\nbar()",
+            "f = (a,\n  b) -> return a\nc = 'd'\n",
+            "() ->\nfoo\n",
+            "x = () -> y = () -> 1\n",
+            "a\n  () ->\n    b\n      c\n",
+            "",
+            "\n\n",
+        };
+        for (auto source : sources)
+        {
+            Lexer batch;
+            auto expected = batch.tokenize(source);
+
+            Lexer lexer;
+            TokenSource pulled(lexer, source);
+            vector<Token> tokens;
+            Token token;
+            while (pulled.next(token))
+                tokens.push_back(token);
+
+            assert(tokens.size() == expected.size());
+            for (size_t i = 0; i < tokens.size(); i++)
+            {
+                assert(tokens[i].toString() == expected[i].toString());
+                assert(tokens[i].meta.line == expected[i].meta.line);
+                assert(tokens[i].meta.column == expected[i].meta.column);
+            }
+            assert(partnerDistances(tokens) == partnerDistances(expected));
+        }
+    }
+
+    {
+        // Test the window stays small for long sources
+        string source;
+        for (int i = 0; i < 1000; i++)
+            source += "a" + to_string(i) + " = (b + c) * d\n";
+        Lexer lexer;
+        TokenSource pulled(lexer, source);
+        size_t count = 0;
+        size_t peak = 0;
+        Token token;
+        while (pulled.next(token))
+        {
+            count++;
+            peak = max(peak, pulled.buffered());
+        }
+        assert(count == 10000);
+        assert(peak < 10);
+    }
+
+    {
+        // Test a source read from a stream in chunks gives the tokens of the
+        // source borrowed, with strings spanning chunks
+        const char* sources[] =
+        {
+            "a = 1\nb = 2",
+            "int main() ->\n  return 42\n",
+            "f = (a,\n  b) -> return a\nc = 'd'\n",
+            "a = 'b\nc\n\nd' + \"e\\\"\n\"\n",
+            "a = 'b\n",
+            "",
+        };
+        for (auto source : sources)
+        {
+            Lexer borrowing;
+            TokenSource borrowed(borrowing, source);
+            vector<Token> expected;
+            string expectedError;
+            try
+            {
+                Token token;
+                while (borrowed.next(token))
+                    expected.push_back(token);
+            }
+            catch (CreamError& e) { expectedError = e.what(); }
+
+            for (size_t chunkSize : { (size_t) 1, (size_t) 3, TokenSource::defaultChunkSize })
+            {
+                Lexer lexer;
+                istringstream input(source);
+                TokenSource pulled(lexer, input, chunkSize);
+                vector<Token> tokens;
+                string error;
+                try
+                {
+                    Token token;
+                    while (pulled.next(token))
+                        tokens.push_back(token);
+                }
+                catch (CreamError& e) { error = e.what(); }
+
+                assert(error == expectedError);
+                if (!error.empty())
+                    continue;
+                assert(tokens.size() == expected.size());
+                for (size_t i = 0; i < tokens.size(); i++)
+                {
+                    assert(tokens[i].toString() == expected[i].toString());
+                    assert(tokens[i].meta.line == expected[i].meta.line);
+                    assert(tokens[i].meta.column == expected[i].meta.column);
+                }
+                assert(partnerDistances(tokens) == partnerDistances(expected));
+            }
+        }
+    }
+
+    {
+        // Test released chunks keep the text held to about one statement
+        string source;
+        for (int i = 0; i < 2000; i++)
+            source += "f" + to_string(i) + " = (a, b) -> return 'a' + b\n";
+        Lexer lexer;
+        istringstream input(source);
+        TokenSource pulled(lexer, input, 64);
+        vector<Token> statement;
+        size_t statements = 0;
+        size_t peak = 0;
+        while (pulled.nextStatement(statement))
+        {
+            assert(statement[0].value == "f" + to_string(statements));
+            statements++;
+            peak = max(peak, pulled.held());
+            statement.clear();
+            pulled.release();
+        }
+        assert(statements == 2000);
+        assert(peak < 256);
+    }
+
+    {
+        // Test a lexer with a pass done while building windows disabled is
+        // rejected, and one with a window pass disabled is not
+        Lexer lexer;
+        lexer.passes().disable("removeWhitespace");
+        string error;
+        try { TokenSource pulled(lexer, "a = 1\n"); }
+        catch (CreamError& e) { error = e.what(); }
+        assert(error == "Pass 'removeWhitespace' cannot be disabled when pulling tokens\n");
+
+        lexer.passes().enableAll();
+        Token token;
+        TokenSource typed(lexer, "int a\n");
+        assert(typed.next(token) && token.type == cream::token::TYPE);
+        lexer.passes().disable("rewriteTypes");
+        TokenSource untyped(lexer, "int a\n");
+        assert(untyped.next(token) && token.type != cream::token::TYPE);
+    }
+
+    {
+        // Test unexpected indents are reported as they are reached
+        Lexer lexer;
+        TokenSource pulled(lexer, "a\n  b\n      c\n");
+        Token token;
+        assert(pulled.next(token));
+        bool thrown = false;
+        try { while (pulled.next(token)); }
+        catch (CreamError& e) { thrown = true; }
+        assert(thrown);
+    }
+
+    {
+        // Test errors are reported and skipped with diagnostics, keeping
+        // blocks balanced
+        Lexer lexer;
+        Diagnostics diagnostics;
+        lexer.context->diagnostics = &diagnostics;
+        TokenSource pulled(lexer, "a\n  b\n      c\nd = )\ne\n");
+        int depth = 0;
+        vector<string> values;
+        Token token;
+        while (pulled.next(token))
+        {
+            if (token.type == cream::token::BLOCK_START)
+                depth++;
+            else if (token.type == cream::token::BLOCK_END)
+                depth--;
+            else if (token.type != cream::token::NEWLINE)
+                values.push_back(string(token.value));
+        }
+        assert(depth == 0);
+        assert((values == vector<string> { "a", "b", "c", "e" }));
+        assert(diagnostics.errorCount() == 2);
+        assert(diagnostics.list()[0].toString() == "3:1: error: Unexpected indent");
+        assert(diagnostics.list()[1].span.line == 4);
+    }
+}
+
+} // end cream::lexer
+
+using TokenSource = cream::lexer::TokenSource;
+
+} // end cream
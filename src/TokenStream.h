@@ -0,0 +1,388 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Common.h"
+#include "Grammar.h"
+#include "Interner.h"
+#include "LineTable.h"
+#include "Token.h"
+
+namespace cream {
+namespace token {
+
+using namespace std;
+
+class TokenStream;
+
+/**
+ * A token read from the columns of a TokenStream. A bracket holds the
+ * distance to its partner, as in Token, or 0 when unpaired.
+ */
+
+struct StreamToken
+{
+    int type;
+    string_view value;
+    interner::SymbolId symbol;
+    int32_t partner;
+
+    // Lets the `->` of a cursor reach the token it reads.
+    const StreamToken* operator->() const { return this; }
+};
+
+/**
+ * A position in a TokenStream, read as a random access iterator of
+ * tokens. Tokens are read from the columns as they are reached, so no
+ * Token views are built.
+ */
+
+struct StreamCursor
+{
+    const TokenStream* stream = nullptr;
+    uint32_t index = 0;
+
+    StreamToken operator*() const;
+    StreamToken operator->() const { return **this; }
+
+    // Gets the position of the token in the source.
+    SourceSpan span() const;
+
+    StreamCursor& operator++() { index++; return *this; }
+    StreamCursor operator++(int) { return { stream, index++ }; }
+    StreamCursor& operator+=(int64_t count) { index += count; return *this; }
+    StreamCursor operator+(int64_t count) const { return { stream, (uint32_t) (index + count) }; }
+    int64_t operator-(StreamCursor other) const { return (int64_t) index - other.index; }
+    bool operator==(StreamCursor other) const { return index == other.index; }
+    bool operator!=(StreamCursor other) const { return index != other.index; }
+};
+
+/**
+ * The TokenStream class.
+ *
+ * Tokens stored as parallel arrays of a 1-byte type, a 32-bit offset and
+ * length into the source, the 32-bit index of the paired token and the
+ * 32-bit symbol ID of identifiers, for 17 bytes per token and no
+ * allocations per token. Offsets are relative to `base`, so a stream can
+ * cover a window of a larger source. Symbol IDs refer to `interner`.
+ *
+ * Tokens synthesized by the rewriter have an `implicit` offset, and take
+ * their text from `implicitText`. `Token` objects are views built on demand
+ * by `at()` and `tokens()`, while cursors from `begin()` and `end()` read
+ * the columns in place.
+ */
+
+class TokenStream
+{
+public:
+    static constexpr uint32_t implicit = UINT32_MAX;
+    static constexpr uint32_t unpaired = UINT32_MAX;
+
+    // Token columns
+    vector<uint8_t> types;
+    vector<uint32_t> offsets;
+    vector<uint32_t> lengths;
+    vector<uint32_t> partners;
+    vector<interner::SymbolId> symbols;
+
+    // Symbol table of identifiers
+    shared_ptr<const Interner> interner;
+
+    // Source text, borrowed or kept alive by `owner`
+    string_view source;
+    int64_t base = 0;
+    shared_ptr<const void> owner;
+
+    // Line starts of the source
+    shared_ptr<const LineTable> lines;
+
+    // Gets the number of tokens.
+    size_t size() const
+    {
+        return types.size();
+    }
+
+    // Reserves space for `count` tokens.
+    void reserve(size_t count)
+    {
+        types.reserve(count);
+        offsets.reserve(count);
+        lengths.reserve(count);
+        partners.reserve(count);
+        symbols.reserve(count);
+    }
+
+    // Appends a token at `offset` in the source.
+    void push(int type, uint32_t offset, uint32_t length,
+              interner::SymbolId symbol=interner::noSymbol)
+    {
+        types.push_back((uint8_t) type);
+        offsets.push_back(offset);
+        lengths.push_back(length);
+        partners.push_back(unpaired);
+        symbols.push_back(symbol);
+    }
+
+    // Appends a token with no source text.
+    void pushImplicit(int type)
+    {
+        push(type, implicit, 0);
+    }
+
+    // Checks whether token `i` was synthesized.
+    bool isImplicit(size_t i) const
+    {
+        return offsets[i] == implicit;
+    }
+
+    // Gets the text of token `i`, as written.
+    string_view text(size_t i) const
+    {
+        if (isImplicit(i))
+            return implicitText(types[i]);
+        return source.substr(offsets[i], lengths[i]);
+    }
+
+    // Gets the value of token `i`, without the quotes of strings.
+    string_view value(size_t i) const
+    {
+        auto text = this->text(i);
+        if (types[i] == STRING && text.size() >= 2)
+            return text.substr(1, text.size() - 2);
+        return text;
+    }
+
+    // Gets the display name of token `i`.
+    string_view name(size_t i) const
+    {
+        if (types[i] == KEYWORD)
+        {
+            auto word = grammar::keywordFor(symbols[i]);
+            if (word)
+                return word->name;
+        }
+        return tokenName(types[i]);
+    }
+
+    // Gets the 1-based source position of token `i`, or a unique negative
+    // position for synthesized tokens.
+    int64_t position(size_t i) const
+    {
+        if (isImplicit(i))
+            return -(int64_t) (i + 1);
+        return base + offsets[i] + 1;
+    }
+
+    // Gets the distance from token `i` to its partner, or 0 when unpaired.
+    int32_t partner(size_t i) const
+    {
+        if (partners[i] == unpaired)
+            return 0;
+        return (int32_t) partners[i] - (int32_t) i;
+    }
+
+    // Gets the 1-based line and column of token `i`, or none for
+    // synthesized tokens.
+    SourceSpan span(size_t i) const
+    {
+        if (isImplicit(i) || !lines)
+            return {};
+        auto line = lines->lineOf(offsets[i]);
+        return { (int64_t) line + 1, (int64_t) (offsets[i] - lines->start(line)) + 1 };
+    }
+
+    // Gets a view of token `i`.
+    Token at(size_t i) const
+    {
+        Token token { types[i], name(i), value(i) };
+        auto span = this->span(i);
+        token.meta = { span.line, span.column, position(i) };
+        token.symbol = symbols[i];
+        token.partner = partner(i);
+        return token;
+    }
+
+    // Gets a cursor at the first token.
+    StreamCursor begin() const
+    {
+        return { this, 0 };
+    }
+
+    // Gets a cursor past the last token.
+    StreamCursor end() const
+    {
+        return { this, (uint32_t) size() };
+    }
+
+    // Gets views of all tokens.
+    vector<Token> tokens() const
+    {
+        vector<Token> tokens;
+        tokens.reserve(size());
+        for (size_t i = 0; i < size(); i++)
+            tokens.push_back(at(i));
+        return tokens;
+    }
+
+    // Links the partners of bracket tokens, pairing parentheses and blocks
+    // separately so an implicit pair never crosses a block.
+    void linkPartners()
+    {
+        vector<uint32_t> parens;
+        vector<uint32_t> blocks;
+        for (uint32_t i = 0; i < size(); i++)
+        {
+            partners[i] = unpaired;
+            switch (types[i])
+            {
+                case EXPRESSION_START:
+                case PARAMS_START:
+                    parens.push_back(i);
+                    break;
+                case BLOCK_START:
+                    blocks.push_back(i);
+                    break;
+                case EXPRESSION_END:
+                case PARAMS_END:
+                    link(parens, i);
+                    break;
+                case BLOCK_END:
+                    link(blocks, i);
+                    break;
+            }
+        }
+    }
+
+    // Builds a stream over the source of `origin` from token views.
+    static TokenStream fromTokens(const TokenStream & origin, const vector<Token> & tokens)
+    {
+        TokenStream stream;
+        stream.source = origin.source;
+        stream.base = origin.base;
+        stream.owner = origin.owner;
+        stream.lines = origin.lines;
+        stream.interner = origin.interner;
+        stream.reserve(tokens.size());
+        for (auto const& token : tokens)
+        {
+            if (token.meta.position <= 0)
+            {
+                stream.pushImplicit(token.type);
+                continue;
+            }
+            auto offset = token.meta.position - 1 - origin.base;
+            auto length = token.value.size() + (token.type == STRING ? 2 : 0);
+            stream.push(token.type, (uint32_t) offset, (uint32_t) length, token.symbol);
+        }
+        stream.linkPartners();
+        return stream;
+    }
+
+private:
+    // Pairs the end token `i` with the innermost open start.
+    void link(vector<uint32_t> & starts, uint32_t i)
+    {
+        if (starts.empty())
+            return;
+        partners[i] = starts.back();
+        partners[starts.back()] = i;
+        starts.pop_back();
+    }
+};
+
+StreamToken StreamCursor::operator*() const
+{
+    return { stream->types[index], stream->value(index), stream->symbols[index], stream->partner(index) };
+}
+
+SourceSpan StreamCursor::span() const
+{
+    return stream->span(index);
+}
+
+void testTokenStream()
+{
+    cout << "Testing TokenStream" << endl;
+
+    {
+        // Test token views
+        TokenStream stream;
+        stream.source = "(a 'b')\nreturn";
+        stream.lines = make_shared<LineTable>(stream.source);
+        stream.push(EXPRESSION_START, 0, 1);
+        stream.push(IDENTIFIER, 1, 1);
+        stream.push(STRING, 3, 3);
+        stream.push(EXPRESSION_END, 6, 1);
+        stream.push(NEWLINE, 7, 1);
+        stream.push(KEYWORD, 8, 6, interner::SYMBOL_RETURN);
+        stream.pushImplicit(BLOCK_END);
+        stream.linkPartners();
+
+        auto tokens = stream.tokens();
+        assert(tokens.size() == 7);
+        assert(tokens[0].toString() == "Expression Start (");
+        assert(tokens[2].toString() == "String b");
+        assert(tokens[5].toString() == "Return return");
+        assert(tokens[6].toString() == "Block End }");
+        assert(tokens[0].partner == 3);
+        assert(tokens[3].partner == -3);
+        assert(tokens[5].meta.line == 2);
+        assert(tokens[5].meta.column == 1);
+        assert(tokens[5].meta.position == 9);
+        assert(tokens[6].meta.position < 0);
+        assert(tokens[6].meta.line == 0);
+        assert(tokens[6].partner == 0);
+
+        // Cursors read the same tokens from the columns
+        auto cursor = stream.begin();
+        assert(stream.end() - cursor == 7);
+        assert(cursor->type == EXPRESSION_START && cursor->partner == 3);
+        assert((cursor + 3)->partner == -3);
+        cursor += 2;
+        assert(cursor->value == "b");
+        assert((*cursor++).type == STRING);
+        assert(cursor->type == EXPRESSION_END);
+        assert((cursor + 2)->symbol == interner::SYMBOL_RETURN);
+        assert((cursor + 2).span().line == 2 && (cursor + 2).span().column == 1);
+        assert((cursor + 3).span().line == 0 && (cursor + 3)->partner == 0);
+    }
+
+    {
+        // Test round trip through views
+        TokenStream stream;
+        stream.source = "x (y) z";
+        stream.base = 100;
+        stream.lines = make_shared<LineTable>(stream.source);
+        stream.push(IDENTIFIER, 0, 1, 42);
+        stream.push(EXPRESSION_START, 2, 1);
+        stream.push(IDENTIFIER, 3, 1);
+        stream.push(EXPRESSION_END, 4, 1);
+        stream.pushImplicit(BLOCK_START);
+        stream.push(IDENTIFIER, 6, 1);
+        stream.pushImplicit(BLOCK_END);
+        stream.linkPartners();
+
+        auto copy = TokenStream::fromTokens(stream, stream.tokens());
+        assert(copy.types == stream.types);
+        assert(copy.offsets == stream.offsets);
+        assert(copy.lengths == stream.lengths);
+        assert(copy.partners == stream.partners);
+        assert(copy.symbols == stream.symbols);
+        assert(copy.partners[4] == 6);
+        assert(copy.at(2).meta.position == 104);
+    }
+}
+
+} // end cream::token
+
+using TokenStream = cream::token::TokenStream;
+using StreamCursor = cream::token::StreamCursor;
+
+} // end cream
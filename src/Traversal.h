@@ -0,0 +1,304 @@
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+#include "Interner.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+namespace cream {
+namespace parser {
+
+using namespace std;
+
+/**
+ * Tree walks.
+ *
+ * Iterators step from node to node through the parent and slot of each
+ * node, so walking a tree of any size or depth allocates nothing. A walk
+ * covers the node it starts at and everything under it, skipping empty
+ * statements. Nodes must be linked by the parser; a walk may start at
+ * the root block of an AST or at any node under it.
+ */
+
+// Gets the parent of `node` within a walk from `start`.
+Node* parentWithin(Node* node, Node* start)
+{
+    // Only top-level statements have no parent, so the walk is of the root
+    return node->parent ? node->parent : start;
+}
+
+// Gets the next sibling of `node` within a walk from `start`, or NULL.
+Node* nextSibling(Node* node, Node* start)
+{
+    if (node == start)
+        return nullptr;
+    return childFrom(parentWithin(node, start), node->slot + 1);
+}
+
+/**
+ * Steps through a tree in pre-order: each node before its children.
+ */
+
+struct PreOrder
+{
+    static Node* first(Node* start)
+    {
+        return start;
+    }
+
+    static Node* next(Node* node, Node* start)
+    {
+        if (auto child = childFrom(node, 0))
+            return child;
+        for (; node != start; node = parentWithin(node, start))
+        {
+            if (auto sibling = nextSibling(node, start))
+                return sibling;
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * Steps through a tree in post-order: each node after its children.
+ */
+
+struct PostOrder
+{
+    static Node* first(Node* start)
+    {
+        return deepestFirst(start);
+    }
+
+    static Node* next(Node* node, Node* start)
+    {
+        if (node == start)
+            return nullptr;
+        if (auto sibling = nextSibling(node, start))
+            return deepestFirst(sibling);
+        return parentWithin(node, start);
+    }
+
+    // Follows first children down from `node` to a leaf.
+    static Node* deepestFirst(Node* node)
+    {
+        while (auto child = childFrom(node, 0))
+            node = child;
+        return node;
+    }
+};
+
+/**
+ * A walk over a tree in the order of `Order`, used as a range.
+ */
+
+template <typename Order>
+class Walk
+{
+public:
+    struct Iterator
+    {
+        Node* operator*() const { return node; }
+        Iterator& operator++() { node = Order::next(node, start); return *this; }
+        bool operator==(const Iterator & other) const { return node == other.node; }
+        bool operator!=(const Iterator & other) const { return node != other.node; }
+
+        Node* node;
+        Node* start;
+    };
+
+    explicit Walk(Node* start)
+        : start(start)
+    {}
+
+    Iterator begin() const { return { start ? Order::first(start) : nullptr, start }; }
+    Iterator end() const { return { nullptr, start }; }
+
+private:
+    Node* start;
+};
+
+// Walks `start` and the nodes under it, parents first.
+Walk<PreOrder> preOrder(Node* start)
+{
+    return Walk<PreOrder>(start);
+}
+
+// Walks `start` and the nodes under it, children first.
+Walk<PostOrder> postOrder(Node* start)
+{
+    return Walk<PostOrder>(start);
+}
+
+/**
+ * The nodes of a pre-order walk matching a predicate, used as a range.
+ *
+ *   for (auto node : query(&ast.root, ofKind(NodeKind::FunctionDefinition)))
+ *       ...
+ */
+
+template <typename Predicate>
+class Query
+{
+public:
+    struct Iterator
+    {
+        Node* operator*() const { return node; }
+        Iterator& operator++() { node = PreOrder::next(node, query->start); seek(); return *this; }
+        bool operator==(const Iterator & other) const { return node == other.node; }
+        bool operator!=(const Iterator & other) const { return node != other.node; }
+
+        // Moves to the first match from the current node.
+        void seek()
+        {
+            while (node && !query->predicate(node))
+                node = PreOrder::next(node, query->start);
+        }
+
+        Node* node;
+        const Query* query;
+    };
+
+    Query(Node* start, Predicate predicate)
+        : start(start),
+          predicate(predicate)
+    {}
+
+    Iterator begin() const
+    {
+        Iterator iter { start, this };
+        iter.seek();
+        return iter;
+    }
+
+    Iterator end() const { return { nullptr, this }; }
+
+    // Gets the first match, or NULL.
+    Node* first() const
+    {
+        return *begin();
+    }
+
+    // Counts the matches.
+    size_t count() const
+    {
+        size_t count = 0;
+        for (auto iter = begin(); iter != end(); ++iter)
+            count++;
+        return count;
+    }
+
+private:
+    Node* start;
+    Predicate predicate;
+};
+
+// Finds the nodes under `start` matching `predicate`.
+template <typename Predicate>
+Query<Predicate> query(Node* start, Predicate predicate)
+{
+    return Query<Predicate>(start, predicate);
+}
+
+// Matches nodes of `kind`.
+auto ofKind(NodeKind kind)
+{
+    return [kind](const Node* node) { return node->kind == kind; };
+}
+
+// Matches identifiers naming `symbol`.
+auto identifierNamed(SymbolId symbol)
+{
+    return [symbol](const Node* node)
+    {
+        return node->kind == NodeKind::Identifier &&
+               static_cast<const Identifier*>(node)->symbol == symbol;
+    };
+}
+
+void testTraversal()
+{
+    cout << "Testing Traversal" << endl;
+
+    Parser parser;
+    Lexer lexer;
+
+    // Gets the kinds of the nodes of a walk.
+    auto kinds = [](auto walk)
+    {
+        vector<NodeKind> kinds;
+        for (auto node : walk)
+            kinds.push_back(node->kind);
+        return kinds;
+    };
+
+    {
+        // Test children and parents
+        auto source = "a = (b + 1)";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto assignment = ast.root.statements[0].outer;
+        auto children = assignment->children();
+        assert(children.size() == 2);
+        assert(children[0]->kind == NodeKind::Identifier);
+        assert(children[1]->kind == NodeKind::ExpressionGroup);
+        assert(children[1]->parent == assignment && children[1]->slot == 1);
+        assert(assignment->parent == nullptr);
+        assert(ast.root.children().size() == 1);
+    }
+
+    {
+        // Test pre-order and post-order walks
+        auto source = "a = (b + 1)\n"
+                      "c";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        assert((kinds(preOrder(&ast.root)) == vector<NodeKind> {
+            NodeKind::Block, NodeKind::Assignment, NodeKind::Identifier,
+            NodeKind::ExpressionGroup, NodeKind::Addition, NodeKind::Identifier,
+            NodeKind::Number, NodeKind::Identifier }));
+        assert((kinds(postOrder(&ast.root)) == vector<NodeKind> {
+            NodeKind::Identifier, NodeKind::Identifier, NodeKind::Number,
+            NodeKind::Addition, NodeKind::ExpressionGroup, NodeKind::Assignment,
+            NodeKind::Identifier, NodeKind::Block }));
+
+        // Test walks of a subtree stay in it
+        auto group = ast.root.statements[0].outer->as<BinaryOperation>()->right;
+        assert((kinds(preOrder(group)) == vector<NodeKind> {
+            NodeKind::ExpressionGroup, NodeKind::Addition, NodeKind::Identifier, NodeKind::Number }));
+        assert((kinds(postOrder(group)) == vector<NodeKind> {
+            NodeKind::Identifier, NodeKind::Number, NodeKind::Addition, NodeKind::ExpressionGroup }));
+        assert(kinds(preOrder(nullptr)).empty());
+    }
+
+    {
+        // Test queries
+        auto source = "int square(int a) -> return a * a\n"
+                      "int twice(int a) ->\n"
+                      "  b = a\n"
+                      "  return b + b\n";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        auto functions = query(&ast.root, ofKind(NodeKind::FunctionDefinition));
+        assert(functions.count() == 2);
+        auto twice = ast.root.statements[1].outer;
+        assert(functions.first() == ast.root.statements[0].outer);
+        assert(query(&ast.root, identifierNamed(lexer.symbols->find("a"))).count() == 3);
+        assert(query(twice, identifierNamed(lexer.symbols->find("b"))).count() == 3);
+        assert(query(twice, ofKind(NodeKind::Return)).first()->parent->kind == NodeKind::Block);
+        assert(query(&ast.root, ofKind(NodeKind::String)).first() == nullptr);
+    }
+}
+
+} // end cream::parser
+
+template <typename Order>
+using Walk = cream::parser::Walk<Order>;
+template <typename Predicate>
+using Query = cream::parser::Query<Predicate>;
+
+} // end cream
@@ -0,0 +1,214 @@
+
+#pragma once
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "Lexer.h"
+#include "Parser.h"
+
+namespace cream {
+namespace parser {
+
+using namespace std;
+
+/**
+ * The Visitor class.
+ *
+ * Dispatches a node to the `visit` method of `Derived` for its kind with
+ * one switch on `kind`, with no virtual calls or RTTI. `Derived` defines
+ * only the methods it needs; the others fall back to the method for the
+ * node's base struct, so `visitAddition` falls back to
+ * `visitBinaryOperation`, then `visitOperation`, `visitExpression` and
+ * `visitNode`, which returns `Result()`.
+ *
+ *   struct Counter : Visitor<Counter, int>
+ *   {
+ *       int visitNumber(Number* number) { return 1; }
+ *       int visitNode(Node* node) { return 0; }
+ *   };
+ */
+
+template <typename Derived, typename Result=void>
+class Visitor
+{
+public:
+    // Calls the visit method for the kind of `node`.
+    Result visit(Node* node)
+    {
+        auto self = this->self();
+        switch (node->kind)
+        {
+            case NodeKind::Node: return self->visitNode(node);
+            case NodeKind::Expression: return self->visitExpression(node->as<Expression>());
+            case NodeKind::Variable: return self->visitVariable(node->as<Variable>());
+            case NodeKind::VariableDeclaration: return self->visitVariableDeclaration(node->as<VariableDeclaration>());
+            case NodeKind::Number: return self->visitNumber(node->as<Number>());
+            case NodeKind::String: return self->visitString(node->as<String>());
+            case NodeKind::Identifier: return self->visitIdentifier(node->as<Identifier>());
+            case NodeKind::Operation: return self->visitOperation(node->as<Operation>());
+            case NodeKind::UnaryOperation: return self->visitUnaryOperation(node->as<UnaryOperation>());
+            case NodeKind::Return: return self->visitReturn(node->as<Return>());
+            case NodeKind::BinaryOperation: return self->visitBinaryOperation(node->as<BinaryOperation>());
+            case NodeKind::Addition: return self->visitAddition(node->as<Addition>());
+            case NodeKind::Subtraction: return self->visitSubtraction(node->as<Subtraction>());
+            case NodeKind::Multiplication: return self->visitMultiplication(node->as<Multiplication>());
+            case NodeKind::Division: return self->visitDivision(node->as<Division>());
+            case NodeKind::BitwiseAnd: return self->visitBitwiseAnd(node->as<BitwiseAnd>());
+            case NodeKind::BitwiseOr: return self->visitBitwiseOr(node->as<BitwiseOr>());
+            case NodeKind::BitwiseLeft: return self->visitBitwiseLeft(node->as<BitwiseLeft>());
+            case NodeKind::BitwiseRight: return self->visitBitwiseRight(node->as<BitwiseRight>());
+            case NodeKind::CompareLT: return self->visitCompareLT(node->as<CompareLT>());
+            case NodeKind::CompareLTE: return self->visitCompareLTE(node->as<CompareLTE>());
+            case NodeKind::CompareGT: return self->visitCompareGT(node->as<CompareGT>());
+            case NodeKind::CompareGTE: return self->visitCompareGTE(node->as<CompareGTE>());
+            case NodeKind::CompareEQ: return self->visitCompareEQ(node->as<CompareEQ>());
+            case NodeKind::LogicalAnd: return self->visitLogicalAnd(node->as<LogicalAnd>());
+            case NodeKind::LogicalOr: return self->visitLogicalOr(node->as<LogicalOr>());
+            case NodeKind::Assignment: return self->visitAssignment(node->as<Assignment>());
+            case NodeKind::ExpressionGroup: return self->visitExpressionGroup(node->as<ExpressionGroup>());
+            case NodeKind::Block: return self->visitBlock(node->as<Block>());
+            case NodeKind::ParamList: return self->visitParamList(node->as<ParamList>());
+            case NodeKind::Lambda: return self->visitLambda(node->as<Lambda>());
+            case NodeKind::Function: return self->visitFunction(node->as<Function>());
+            case NodeKind::FunctionDefinition: return self->visitFunctionDefinition(node->as<FunctionDefinition>());
+        }
+        return self->visitNode(node);
+    }
+
+    Result visitNode(Node* node) { return Result(); }
+    Result visitExpression(Expression* node) { return self()->visitNode(node); }
+    Result visitVariable(Variable* node) { return self()->visitExpression(node); }
+    Result visitVariableDeclaration(VariableDeclaration* node) { return self()->visitExpression(node); }
+    Result visitNumber(Number* node) { return self()->visitExpression(node); }
+    Result visitString(String* node) { return self()->visitExpression(node); }
+    Result visitIdentifier(Identifier* node) { return self()->visitExpression(node); }
+    Result visitOperation(Operation* node) { return self()->visitExpression(node); }
+    Result visitUnaryOperation(UnaryOperation* node) { return self()->visitOperation(node); }
+    Result visitReturn(Return* node) { return self()->visitUnaryOperation(node); }
+    Result visitBinaryOperation(BinaryOperation* node) { return self()->visitOperation(node); }
+    Result visitAddition(Addition* node) { return self()->visitBinaryOperation(node); }
+    Result visitSubtraction(Subtraction* node) { return self()->visitBinaryOperation(node); }
+    Result visitMultiplication(Multiplication* node) { return self()->visitBinaryOperation(node); }
+    Result visitDivision(Division* node) { return self()->visitBinaryOperation(node); }
+    Result visitBitwiseAnd(BitwiseAnd* node) { return self()->visitBinaryOperation(node); }
+    Result visitBitwiseOr(BitwiseOr* node) { return self()->visitBinaryOperation(node); }
+    Result visitBitwiseLeft(BitwiseLeft* node) { return self()->visitBinaryOperation(node); }
+    Result visitBitwiseRight(BitwiseRight* node) { return self()->visitBinaryOperation(node); }
+    Result visitCompareLT(CompareLT* node) { return self()->visitBinaryOperation(node); }
+    Result visitCompareLTE(CompareLTE* node) { return self()->visitBinaryOperation(node); }
+    Result visitCompareGT(CompareGT* node) { return self()->visitBinaryOperation(node); }
+    Result visitCompareGTE(CompareGTE* node) { return self()->visitBinaryOperation(node); }
+    Result visitCompareEQ(CompareEQ* node) { return self()->visitBinaryOperation(node); }
+    Result visitLogicalAnd(LogicalAnd* node) { return self()->visitBinaryOperation(node); }
+    Result visitLogicalOr(LogicalOr* node) { return self()->visitBinaryOperation(node); }
+    Result visitAssignment(Assignment* node) { return self()->visitBinaryOperation(node); }
+    Result visitExpressionGroup(ExpressionGroup* node) { return self()->visitExpression(node); }
+    Result visitBlock(Block* node) { return self()->visitExpression(node); }
+    Result visitParamList(ParamList* node) { return self()->visitExpression(node); }
+    Result visitLambda(Lambda* node) { return self()->visitExpression(node); }
+    Result visitFunction(Function* node) { return self()->visitExpression(node); }
+    Result visitFunctionDefinition(FunctionDefinition* node) { return self()->visitExpression(node); }
+
+private:
+    Derived* self()
+    {
+        return static_cast<Derived*>(this);
+    }
+};
+
+void testVisitor()
+{
+    cout << "Testing Visitor" << endl;
+
+    /**
+     * Prints a tree of operations, falling back to node names.
+     */
+
+    struct Printer : Visitor<Printer, string>
+    {
+        string visitBinaryOperation(BinaryOperation* node)
+        {
+            return "(" + visit(node->left) + " " + string(node->value) + " " + visit(node->right) + ")";
+        }
+        string visitAddition(Addition* node)
+        {
+            return "add" + visitBinaryOperation(node);
+        }
+        string visitExpressionGroup(ExpressionGroup* node)
+        {
+            return visit(node->inner);
+        }
+        string visitNumber(Number* node)
+        {
+            return string(node->value);
+        }
+        string visitNode(Node* node)
+        {
+            return nodeName(node->kind);
+        }
+    };
+
+    /**
+     * Counts nodes of each kind with no result.
+     */
+
+    struct Counter : Visitor<Counter>
+    {
+        void visitBinaryOperation(BinaryOperation* node)
+        {
+            binaries++;
+            visit(node->left);
+            visit(node->right);
+        }
+        void visitExpressionGroup(ExpressionGroup* node)
+        {
+            visit(node->inner);
+        }
+        void visitExpression(Expression* node)
+        {
+            others++;
+        }
+        int binaries = 0;
+        int others = 0;
+    };
+
+    Parser parser;
+    Lexer lexer;
+
+    {
+        // Test nodes dispatch to their most specific method
+        auto source = "(1 + 2) * a";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        Printer printer;
+        assert(printer.visit(ast.root.statements[0].outer) == "(add(1 + 2) * Identifier)");
+    }
+
+    {
+        // Test visitors without a result
+        auto source = "(a < b) & c";
+        auto tokens = lexer.tokenize(source);
+        auto ast = parser.parse(tokens);
+        Counter counter;
+        counter.visit(ast.root.statements[0].outer);
+        assert(counter.binaries == 2);
+        assert(counter.others == 3);
+    }
+
+    {
+        // Test node names
+        assert(string(nodeName(NodeKind::FunctionDefinition)) == "Function Definition");
+        assert(isBinaryOperation(NodeKind::Assignment));
+        assert(!isBinaryOperation(NodeKind::Return));
+        Number number("7");
+        assert(number.toString() == "Number 7");
+    }
+}
+
+} // end cream::parser
+
+template <typename Derived, typename Result=void>
+using Visitor = cream::parser::Visitor<Derived, Result>;
+
+} // end cream
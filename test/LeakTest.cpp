@@ -0,0 +1,224 @@
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/Compiler.h"
+#include "../src/Lexer.h"
+#include "../src/Pipeline.h"
+#include "../src/Rewriter.h"
+#include "../src/Scanner.h"
+#include "../src/ThreadPool.h"
+#include "../src/TokenSource.h"
+#include "../src/TokenStream.h"
+#include "../src/Traversal.h"
+
+using namespace std;
+using namespace cream;
+
+/**
+ * Lexes, rewrites and compiles many sources in a loop, checking the heap
+ * holds as many blocks after the last one as after the first, including
+ * when compiling recovers from errors. Built with a leak checker when
+ * the compiler has one, which reports anything left behind at exit. Also
+ * checks walking and querying a parsed tree allocates nothing.
+ *
+ * Usage: LeakTest [rounds]
+ */
+
+// Number of heap blocks allocated and not yet freed
+static atomic<long> liveBlocks(0);
+
+// Number of heap blocks ever allocated
+static atomic<long> allocations(0);
+
+void* operator new(size_t size)
+{
+    void* block = malloc(size ? size : 1);
+    if (!block)
+        throw bad_alloc();
+    liveBlocks++;
+    allocations++;
+    return block;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* block) noexcept
+{
+    if (!block)
+        return;
+    liveBlocks--;
+    free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+    operator delete(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+    operator delete(block);
+}
+
+void operator delete[](void* block, size_t) noexcept
+{
+    operator delete(block);
+}
+
+// Sources using every token the rewriter synthesizes
+const char* sources[] =
+{
+    "() -> return 123",
+    "-> return 123",
+    "(double a, double b) -> return a * b\n",
+    "int main() ->\n  return 42\n",
+    "() ->\n  if true\n    a = 1\n\n  else\n    b = 2\n\nbar()",
+    "f = (a,\n  b) -> return a\nc = 'd'\n",
+    "x = () -> y = () -> 1\n",
+    "a\n  () ->\n    b\n      c\n",
+    "a\n  b\n      c\n",
+};
+
+// Sources the parser accepts or rejects cleanly
+const char* programs[] =
+{
+    "a = 1\nb = 'c'\n",
+    "(double a, double b) -> return (a + b) * a\n",
+    "int square(int a) -> return a * a\n",
+    "int main() ->\n  return 42\n",
+    "x = () -> y = () -> 1\n",
+};
+
+// Lexes, rewrites and compiles each source through every path once,
+// compiling in parallel on `pool` and pipelined.
+void compileAll(ThreadPool & pool)
+{
+    for (auto source : sources)
+    {
+        Lexer lexer;
+        try
+        {
+            lexer.tokenize(source);
+
+            Scanner scanner;
+            scanner.borrow(source);
+            Rewriter rewriter;
+            rewriter.rewritePasses(lexer.scanTokens(scanner));
+
+            TokenSource pulled(lexer, source);
+            Token token;
+            while (pulled.next(token));
+        }
+        catch (CreamError& e)
+        {
+        }
+    }
+
+    for (auto source : programs)
+    {
+        Compiler compiler;
+        try
+        {
+            compiler.compile(source);
+            compiler.pool = &pool;
+            compiler.chunkSize = 1;
+            compiler.compile(source);
+        }
+        catch (CreamError& e)
+        {
+        }
+        try
+        {
+            Pipeline pipeline(compiler);
+            pipeline.batchSize = 1;
+            pipeline.compile(source);
+        }
+        catch (CreamError& e)
+        {
+        }
+        try
+        {
+            istringstream input(source);
+            ostringstream output;
+            compiler.compile(input, output);
+        }
+        catch (CreamError& e)
+        {
+        }
+    }
+
+    for (auto source : sources)
+    {
+        // Recover from errors, stopping at the second
+        Compiler compiler;
+        Diagnostics diagnostics(2);
+        compiler.compile(source, diagnostics);
+        Diagnostics pipelined(2);
+        Pipeline(compiler).compile(source, pipelined);
+        Diagnostics streamed(2);
+        istringstream input(source);
+        ostringstream output;
+        compiler.compile(input, output, streamed);
+    }
+}
+
+// Walks and queries a parsed program, returning the allocations made.
+long walkAll()
+{
+    Lexer lexer;
+    Parser parser;
+    auto tokens = lexer.tokenize(programs[1]);
+    auto ast = parser.parse(tokens);
+    auto symbol = lexer.symbols->find("a");
+
+    auto before = allocations.load();
+    size_t nodes = 0;
+    for (auto node : preOrder(&ast.root))
+        nodes += node->children().size();
+    for (auto node : postOrder(&ast.root))
+        nodes += node->slot;
+    nodes += query(&ast.root, parser::identifierNamed(symbol)).count();
+    nodes += query(&ast.root, parser::ofKind(NodeKind::Lambda)).count();
+    auto made = allocations.load() - before;
+
+    if (nodes == 0)
+        cerr << "Walked an empty tree" << endl;
+    return made;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? stoi(argv[1]) : 1000;
+
+    // Warm up static tables before counting
+    ThreadPool pool(2);
+    compileAll(pool);
+    auto baseline = liveBlocks.load();
+
+    for (int i = 0; i < rounds; i++)
+        compileAll(pool);
+
+    auto growth = liveBlocks.load() - baseline;
+    cout << rounds << " rounds, " << growth << " blocks left" << endl;
+    if (growth != 0)
+    {
+        cerr << "Heap grew by " << growth << " blocks" << endl;
+        return 1;
+    }
+
+    auto walkAllocations = walkAll();
+    if (walkAllocations != 0)
+    {
+        cerr << "Walking the tree made " << walkAllocations << " allocations" << endl;
+        return 1;
+    }
+    return 0;
+}